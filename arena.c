@@ -0,0 +1,150 @@
+/*****************************************************************************
+ Fixed size per session arena for data negotiated via telopt, ie enviroment
+ variables, terminal type and username. The arena is allocated once when the
+ master starts and is never grown so a hostile client can't make the master's
+ heap grow without bound by sending endless NEW-ENVIRON data. Variables are
+ stored as "name=value" strings ready to be passed straight to execve().
+ *****************************************************************************/
+
+#include "globals.h"
+
+extern char **environ;
+
+static char *arena;
+static char **env_vars;
+static int arena_used;
+static int env_var_cnt;
+
+static int findEnvVar(char **vars, int cnt, char *name, int namelen);
+
+
+void initArena(void)
+{
+	/* +1 so we never malloc zero bytes */
+	arena = (char *)malloc(telopt_env_max_bytes + 1);
+	assert(arena);
+	env_vars = (char **)malloc(sizeof(char *) * (telopt_env_max_vars + 1));
+	assert(env_vars);
+	arena_used = 0;
+	env_var_cnt = 0;
+}
+
+
+
+
+/*** Store the variable in the arena. Returns a pointer to the stored value or
+     NULL if the arena caps have been reached. If the variable already exists
+     the old string is left where it is as something may still point to it ***/
+char *arenaSetEnv(char *name, char *value)
+{
+	char *str;
+	int namelen;
+	int len;
+	int i;
+
+	namelen = strlen(name);
+	len = namelen + strlen(value) + 2;
+
+	if (arena_used + len > telopt_env_max_bytes)
+	{
+		logprintfLimit(NULL,master_pid,"WARNING: Enviroment arena full (%d bytes), ignoring \"%s\".\n",
+			telopt_env_max_bytes,name);
+		return NULL;
+	}
+	if ((i = findEnvVar(env_vars,env_var_cnt,name,namelen)) == -1)
+	{
+		if (env_var_cnt == telopt_env_max_vars)
+		{
+			logprintfLimit(NULL,master_pid,"WARNING: Enviroment variable limit (%d) reached, ignoring \"%s\".\n",
+				telopt_env_max_vars,name);
+			return NULL;
+		}
+		i = env_var_cnt++;
+	}
+	str = arena + arena_used;
+	sprintf(str,"%s=%s",name,value);
+	arena_used += len;
+	env_vars[i] = str;
+
+	return str + namelen + 1;
+}
+
+
+
+
+char *arenaGetEnv(char *name)
+{
+	int namelen = strlen(name);
+	int i;
+
+	if ((i = findEnvVar(env_vars,env_var_cnt,name,namelen)) == -1)
+		return NULL;
+	return env_vars[i] + namelen + 1;
+}
+
+
+
+
+/*** Only removes the variable from the list, the bytes stay used ***/
+void arenaUnsetEnv(char *name)
+{
+	int i;
+
+	if ((i = findEnvVar(env_vars,env_var_cnt,name,strlen(name))) != -1)
+		env_vars[i] = env_vars[--env_var_cnt];
+}
+
+
+
+
+int arenaEnvCount(void)
+{
+	return env_var_cnt;
+}
+
+
+
+
+/*** Create the enviroment array for the slave's execve(). This is the
+     inherited enviroment with the arena variables added on the end, the arena
+     values overriding any with the same name. Called by the master just
+     before it starts the slave. ***/
+char **arenaEnvArray(void)
+{
+	char **envp;
+	char *eq;
+	int cnt;
+	int i;
+
+	for(cnt=0;environ[cnt];++cnt);
+	envp = (char **)malloc(sizeof(char *) * (cnt + env_var_cnt + 1));
+	assert(envp);
+
+	for(i=cnt=0;environ[i];++i)
+	{
+		if ((eq = strchr(environ[i],'=')) &&
+		    findEnvVar(env_vars,env_var_cnt,environ[i],(int)(eq - environ[i])) != -1)
+		{
+			continue;
+		}
+		envp[cnt++] = environ[i];
+	}
+	for(i=0;i < env_var_cnt;++i) envp[cnt++] = env_vars[i];
+	envp[cnt] = NULL;
+
+	return envp;
+}
+
+
+
+
+int findEnvVar(char **vars, int cnt, char *name, int namelen)
+{
+	int i;
+	for(i=0;i < cnt;++i)
+	{
+		if (!strncmp(vars[i],name,namelen) && vars[i][namelen] == '=')
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,217 @@
+/*****************************************************************************
+ IPMATCHBENCH
+ Compares matching addresses against an IP/DNS list by running the old
+ recursive wildMatch() against each pattern in turn with matching against
+ all the patterns at once with the compiled matcher in wildcard.c. Also
+ checks they agree. Run from the top level directory with "make bench" then
+ "bench/ipmatchbench".
+ *****************************************************************************/
+
+#include "globals.h"
+#include "wildcard.h"
+
+#define BENCH_SECS   2
+#define NUM_ADDRS    1000
+#define MAX_PATTERNS 10000
+
+static char *pats[MAX_PATTERNS];
+static char *addrs[NUM_ADDRS];
+static int pat_cnt;
+static struct st_wildcard *wc;
+
+static void   createPatterns(int cnt);
+static void   createAddrs(void);
+static int    oldMatch(char *addr);
+static int    newMatch(char *addr);
+static int    wildMatch(const char *str, const char *pat);
+static double runBench(int (*func)(char *));
+static double now(void);
+
+
+int main(void)
+{
+	int sizes[] = { 10, 1000, MAX_PATTERNS };
+	double old_usecs;
+	double new_usecs;
+	int bad;
+	int i;
+	int j;
+
+	srandom(getpid());
+	createAddrs();
+
+	puts("  Patterns  Old match (usecs)  Compiled match (usecs)  Speedup");
+	puts("  ========  =================  ======================  =======");
+	for(i=0;i < (int)(sizeof(sizes) / sizeof(int));++i)
+	{
+		createPatterns(sizes[i]);
+		wc = compileWildcards(pats,pat_cnt);
+
+		for(j=bad=0;j < NUM_ADDRS;++j)
+			if (oldMatch(addrs[j]) != newMatch(addrs[j])) ++bad;
+		if (bad)
+		{
+			printf("ERROR: %d addresses matched differently.\n",bad);
+			return 1;
+		}
+
+		old_usecs = runBench(oldMatch);
+		new_usecs = runBench(newMatch);
+		printf("  %8d  %17.3f  %22.3f  %6.0fx\n",
+			pat_cnt,old_usecs,new_usecs,old_usecs / new_usecs);
+
+		freeWildcards(wc);
+		for(j=0;j < pat_cnt;++j) free(pats[j]);
+	}
+
+	/* Something that makes backtracking blow up */
+	pats[0] = "*a*a*a*a*a*a*a*a*b";
+	pat_cnt = 1;
+	wc = compileWildcards(pats,pat_cnt);
+	for(i=0;i < NUM_ADDRS;++i)
+		addrs[i] = "aaaaaaaaaaaaaaaaaaaaaaaaa.example.com";
+	printf("\nPathological pattern \"%s\"\n",pats[0]);
+	printf("  Old match     : %.3f usecs\n",runBench(oldMatch));
+	printf("  Compiled match: %.3f usecs\n",runBench(newMatch));
+	return 0;
+}
+
+
+
+
+/*** A mix of IP and DNS patterns. Some have no wildcards. ***/
+void createPatterns(int cnt)
+{
+	for(pat_cnt=0;pat_cnt < cnt;++pat_cnt)
+	{
+		switch(random() % 5)
+		{
+		case 0:
+			asprintf(&pats[pat_cnt],"10.%ld.%ld.*",
+				random() % 256,random() % 256);
+			break;
+		case 1:
+			asprintf(&pats[pat_cnt],"192.168.%ld.%ld",
+				random() % 256,random() % 256);
+			break;
+		case 2:
+			asprintf(&pats[pat_cnt],"172.1?.%ld.*",random() % 256);
+			break;
+		case 3:
+			asprintf(&pats[pat_cnt],"*.host%ld.example.com",
+				random() % 100000);
+			break;
+		default:
+			asprintf(&pats[pat_cnt],"user-%ld-*.isp%ld.net",
+				random() % 1000,random() % 100);
+		}
+	}
+}
+
+
+
+
+void createAddrs(void)
+{
+	int i;
+
+	for(i=0;i < NUM_ADDRS;++i)
+	{
+		switch(random() % 3)
+		{
+		case 0:
+			asprintf(&addrs[i],"%ld.%ld.%ld.%ld",
+				random() % 2 ? 10L : 192L,
+				random() % 256,random() % 256,random() % 256);
+			break;
+		case 1:
+			asprintf(&addrs[i],"www.host%ld.example.com",
+				random() % 100000);
+			break;
+		default:
+			asprintf(&addrs[i],"user-%ld-%ld.isp%ld.net",
+				random() % 1000,random() % 1000,random() % 100);
+		}
+	}
+}
+
+
+
+
+int oldMatch(char *addr)
+{
+	int i;
+	for(i=0;i < pat_cnt;++i) if (wildMatch(addr,pats[i])) return 1;
+	return 0;
+}
+
+
+
+
+int newMatch(char *addr)
+{
+	return matchWildcards(wc,addr);
+}
+
+
+
+
+/*** The original matcher from iplist.c ***/
+int wildMatch(const char *str, const char *pat)
+{
+	char *s;
+	char *s2;
+	char *p;
+
+	for(s=(char *)str,p=(char *)pat;*s && *p;++s,++p)
+	{
+		switch(*p)
+		{
+		case '?':
+			continue;
+
+		case '*':
+			if (!*(p+1)) return 1;
+
+			for(s2=s;*s2;++s2) if (wildMatch(s2,p+1)) return 1;
+			return 0;
+		}
+		if (toupper(*s) != toupper(*p)) return 0;
+	}
+	if (!*s)
+	{
+		for(;*p && *p == '*';++p);
+		if (!*p) return 1;
+	}
+	return 0;
+}
+
+
+
+
+/*** Returns microseconds per match ***/
+double runBench(int (*func)(char *))
+{
+	double start;
+	double end;
+	int cnt;
+
+	start = now();
+	end = start + BENCH_SECS;
+	for(cnt=0;now() < end;)
+	{
+		func(addrs[cnt % NUM_ADDRS]);
+		++cnt;
+	}
+	return (now() - start) * 1000000 / cnt;
+}
+
+
+
+
+double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+ LOGLIMITBENCH
+ Times logprintfLimit() for a scan from many addresses, which is what the
+ log limiting is there for, and checks that no more than
+ log_limit_site_burst connection lines plus the summaries get logged
+ however many addresses there are. Run from the top level directory with
+ "make bench" then "bench/loglimitbench".
+ *****************************************************************************/
+
+#define MAINFILE
+#include "globals.h"
+
+#define NUM_ADDRS  100000
+#define BURST      5
+#define SITE_BURST 100
+
+static int logged;
+static int summaries;
+
+static double now(void);
+
+
+int main(void)
+{
+	char addr[20];
+	double start;
+	double usecs;
+	int ret = 0;
+	int i;
+
+	log_limit_burst = BURST;
+	log_limit_site_burst = SITE_BURST;
+	log_limit_secs = 3600;
+
+	start = now();
+	for(i=0;i < NUM_ADDRS;++i)
+	{
+		snprintf(addr,sizeof(addr),"10.%d.%d.%d",
+			(i >> 16) & 0xFF,(i >> 8) & 0xFF,i & 0xFF);
+		logprintfLimit(addr,1,"CONNECTION: remote IP = %s\n",addr);
+		logprintfLimit(addr,1,"CONNECTION REFUSED: %s\n",addr);
+	}
+	usecs = (now() - start) * 1000000 / (NUM_ADDRS * 2);
+	flushLogLimits(1);
+
+	printf("Addresses      : %d\n",NUM_ADDRS);
+	printf("Lines logged   : %d (site burst %d for each of 2 sites)\n",
+		logged,SITE_BURST);
+	printf("Summaries      : %d\n",summaries);
+	printf("Usecs per call : %.3f\n",usecs);
+
+	if (logged > SITE_BURST * 2)
+	{
+		puts("ERROR: Logged more than the site burst.");
+		ret = 1;
+	}
+	if (summaries != 2)
+	{
+		puts("ERROR: Expected one summary for each site.");
+		ret = 1;
+	}
+	return ret;
+}
+
+
+
+
+/*** Stand in for the one in printf.c ***/
+void vlogprintf(pid_t pid, char *fmt, va_list args)
+{
+	(void)pid;
+	(void)args;
+	if (!strncmp(fmt,"LOG: Suppressed",15))
+		++summaries;
+	else
+		++logged;
+}
+
+
+
+
+void logprintf(pid_t pid, char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args,fmt);
+	vlogprintf(pid,fmt,args);
+	va_end(args);
+}
+
+
+
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
@@ -0,0 +1,181 @@
+/*****************************************************************************
+ PTYECHO
+ Measures the round trip time of a keystroke through a PTY the way a session
+ does it: this process stands in for the master and writes a byte to the
+ PTY master side, a child standing in for the shell reads it on the slave
+ side and writes it back. Run with both processes pinned to the same CPU,
+ pinned to different CPUs and left to the scheduler to show what the
+ cpu_affinity option buys. Run from the top level directory with
+ "make bench" then "bench/ptyecho [CPU [OTHER CPU]]".
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define NUM_ECHOS  20000
+#define NUM_WARMUP 1000
+
+static double samples[NUM_ECHOS];
+static cpu_set_t allowed;
+
+static void   runBench(char *desc, int master_cpu, int slave_cpu);
+static void   runEcho(int fd);
+static void   pinCPU(int cpu);
+static int    cmpDouble(const void *a, const void *b);
+static double now(void);
+
+
+int main(int argc, char **argv)
+{
+	int cpu1 = -1;
+	int cpu2 = -1;
+	int i;
+
+	/* Default to the first two CPUs we're allowed to use */
+	if (sched_getaffinity(0,sizeof(allowed),&allowed) == -1)
+	{
+		perror("sched_getaffinity()");
+		return 1;
+	}
+	for(i=0;i < CPU_SETSIZE;++i)
+	{
+		if (!CPU_ISSET(i,&allowed)) continue;
+		if (cpu1 == -1) cpu1 = i;
+		else if (cpu2 == -1) cpu2 = i;
+	}
+	if (argc > 1) cpu1 = atoi(argv[1]);
+	if (argc > 2) cpu2 = atoi(argv[2]);
+
+	printf("%d round trips per run\n\n",NUM_ECHOS);
+	puts("  Placement          Mean (usecs)  Median (usecs)  99th % (usecs)");
+	puts("  =========          ============  ==============  ==============");
+	runBench("Same CPU",cpu1,cpu1);
+	if (cpu2 == -1)
+		puts("  Different CPUs     <only one CPU available>");
+	else
+		runBench("Different CPUs",cpu1,cpu2);
+	runBench("Unpinned",-1,-1);
+	return 0;
+}
+
+
+
+
+void runBench(char *desc, int master_cpu, int slave_cpu)
+{
+	struct termios tio;
+	double start;
+	double total;
+	pid_t pid;
+	char c;
+	int ptym;
+	int ptys;
+	int i;
+
+	if ((ptym = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+	    grantpt(ptym) == -1 ||
+	    unlockpt(ptym) == -1 ||
+	    (ptys = open(ptsname(ptym),O_RDWR | O_NOCTTY)) == -1)
+	{
+		perror("PTY");
+		exit(1);
+	}
+
+	/* Raw so the line discipline passes each byte straight through and
+	   doesn't echo it itself */
+	tcgetattr(ptys,&tio);
+	cfmakeraw(&tio);
+	tcsetattr(ptys,TCSANOW,&tio);
+
+	switch((pid = fork()))
+	{
+	case -1:
+		perror("fork()");
+		exit(1);
+	case 0:
+		close(ptym);
+		pinCPU(slave_cpu);
+		runEcho(ptys);
+		_exit(0);
+	}
+	close(ptys);
+	pinCPU(master_cpu);
+
+	for(i=0,total=0;i < NUM_WARMUP + NUM_ECHOS;++i)
+	{
+		c = 'a' + i % 26;
+		start = now();
+		if (write(ptym,&c,1) != 1 || read(ptym,&c,1) != 1)
+		{
+			perror("PTY I/O");
+			exit(1);
+		}
+		if (i < NUM_WARMUP) continue;
+		samples[i - NUM_WARMUP] = now() - start;
+		total += samples[i - NUM_WARMUP];
+	}
+	close(ptym);
+	kill(pid,SIGKILL);
+	waitpid(pid,NULL,0);
+	pinCPU(-1);
+
+	qsort(samples,NUM_ECHOS,sizeof(double),cmpDouble);
+	printf("  %-17s  %12.2f  %14.2f  %14.2f\n",
+		desc,
+		total / NUM_ECHOS,
+		samples[NUM_ECHOS / 2],
+		samples[NUM_ECHOS * 99 / 100]);
+}
+
+
+
+
+/*** The "shell" ***/
+void runEcho(int fd)
+{
+	char c;
+
+	while(read(fd,&c,1) == 1)
+		if (write(fd,&c,1) != 1) break;
+}
+
+
+
+
+/*** -1 puts back the CPUs we started with ***/
+void pinCPU(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu == -1)
+		set = allowed;
+	else
+	{
+		CPU_ZERO(&set);
+		CPU_SET(cpu,&set);
+	}
+	if (sched_setaffinity(0,sizeof(set),&set) == -1)
+	{
+		fprintf(stderr,"sched_setaffinity(CPU %d): %s\n",cpu,strerror(errno));
+		exit(1);
+	}
+}
+
+
+
+
+int cmpDouble(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return d < 0 ? -1 : (d > 0);
+}
+
+
+
+
+/*** In microseconds ***/
+double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return (double)tv.tv_sec * 1000000 + tv.tv_usec;
+}
@@ -0,0 +1,185 @@
+/*****************************************************************************
+ PWDBENCH
+ Compares the cost of looking up a user in the telnetd password file as a
+ text file, done the way telnetd used to do it (map the file and scan it line
+ by line with splitPwdLine()), against a lookup in the cdb database built by
+ tduser -b. Run from the top level directory with "make bench" then
+ "bench/pwdbench [directory for temporary files]".
+ *****************************************************************************/
+
+#include "globals.h"
+#include "cdb.h"
+
+#define BENCH_SECS  2
+#define MAX_LOOKUPS 200000
+
+static char *text_file;
+static char *db_file;
+static int num_users;
+
+static void   createFiles(void);
+static int    textLookup(char *uname);
+static int    cdbLookup(char *uname);
+static double runBench(int (*func)(char *));
+static double now(void);
+
+
+int main(int argc, char **argv)
+{
+	int sizes[] = { 1000, 100000, 1000000 };
+	double text_usecs;
+	double cdb_usecs;
+	char *dir;
+	int i;
+
+	dir = argc > 1 ? argv[1] : "/tmp";
+	asprintf(&text_file,"%s/pwdbench.pwd",dir);
+	asprintf(&db_file,"%s/pwdbench.pwd.cdb",dir);
+	srandom(getpid());
+
+	puts("     Users  Text lookup (usecs)  CDB lookup (usecs)  Speedup");
+	puts("     =====  ===================  ==================  =======");
+	for(i=0;i < (int)(sizeof(sizes) / sizeof(int));++i)
+	{
+		num_users = sizes[i];
+		createFiles();
+		text_usecs = runBench(textLookup);
+		cdb_usecs = runBench(cdbLookup);
+		printf("%10d  %19.2f  %18.2f  %6.0fx\n",
+			num_users,text_usecs,cdb_usecs,text_usecs / cdb_usecs);
+	}
+	unlink(text_file);
+	unlink(db_file);
+	return 0;
+}
+
+
+
+
+/*** Write the text file and the cdb file with the same users ***/
+void createFiles(void)
+{
+	struct st_cdb_make cm;
+	FILE *fp;
+	char line[100];
+	char data[104];
+	char *colon;
+	int len;
+	int i;
+
+	if (!(fp = fopen(text_file,"w")) || !cdbMakeStart(&cm,db_file))
+	{
+		perror("ERROR: createFiles()");
+		exit(1);
+	}
+	for(i=0;i < num_users;++i)
+	{
+		len = sprintf(line,"user%07d:ab01FAX.bQRSU:0::/bin/bash -l",i);
+		fprintf(fp,"%s\n",line);
+
+		memcpy(data,&i,4);
+		memcpy(data+4,line,len);
+		colon = strchr(line,':');
+		if (!cdbMakeAdd(&cm,line,(int)(colon - line),data,len + 4))
+		{
+			perror("ERROR: cdbMakeAdd()");
+			exit(1);
+		}
+	}
+	fclose(fp);
+	if (!cdbMakeFinish(&cm))
+	{
+		perror("ERROR: cdbMakeFinish()");
+		exit(1);
+	}
+}
+
+
+
+
+/*** What validate.c used to do for every login attempt ***/
+int textLookup(char *uname)
+{
+	struct stat fs;
+	char *field[NUM_PWD_FIELDS];
+	char *map_start;
+	char *map_end;
+	char *ptr;
+	int found = 0;
+	int fd;
+
+	if ((fd = open(text_file,O_RDONLY)) == -1 || fstat(fd,&fs) == -1)
+		return -1;
+	map_start = (char *)mmap(
+		NULL,fs.st_size+1,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (map_start == MAP_FAILED) return -1;
+	map_end = map_start + fs.st_size;
+
+	for(ptr=map_start;ptr < map_end;)
+	{
+		ptr = splitPwdLine(ptr,map_end,field);
+		if (field[PWD_USER] && !strcmp(uname,field[PWD_USER]))
+		{
+			found = 1;
+			break;
+		}
+	}
+	munmap(map_start,fs.st_size+1);
+	return found;
+}
+
+
+
+
+/*** What validate.c does with pwd_db_file set ***/
+int cdbLookup(char *uname)
+{
+	char *data;
+	uint32_t dlen;
+	int ret;
+	int fd;
+
+	if ((fd = open(db_file,O_RDONLY)) == -1) return -1;
+	if ((ret = cdbFind(fd,uname,strlen(uname),&data,&dlen)) == 1)
+		free(data);
+	close(fd);
+	return ret;
+}
+
+
+
+
+/*** Returns the average microseconds per lookup of random users ***/
+double runBench(int (*func)(char *))
+{
+	char uname[20];
+	double start;
+	double end;
+	int i;
+
+	start = now();
+	for(i=0;i < MAX_LOOKUPS;)
+	{
+		sprintf(uname,"user%07ld",random() % num_users);
+		if (func(uname) != 1)
+		{
+			fprintf(stderr,"ERROR: Lookup of \"%s\" failed.\n",uname);
+			exit(1);
+		}
+		/* Don't check the time every lookup as it's not free */
+		if (!(++i % 10) && (end = now()) - start >= BENCH_SECS) break;
+	}
+	end = now();
+	return (end - start) * 1000000 / i;
+}
+
+
+
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + (double)ts.tv_nsec / 1000000000;
+}
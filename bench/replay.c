@@ -0,0 +1,593 @@
+/*****************************************************************************
+ REPLAY
+ Replays what clients sent, taken from the "RX: |" lines a telnetd running
+ with hexdump YES writes to its log, against a running telnetd over many
+ connections at once and reports the latency and throughput of each
+ session. tdcap output is in the same format so captures can be used too.
+
+ The lines of each master pid from its "STARTED: Master process" line on
+ make up one session. A line of less than 10 bytes ends a read, as does a
+ TX line or a new second, and each read is sent as one write at the time it
+ was logged relative to the start of the session. The log only has whole
+ seconds so reads within the same second are spread evenly over it.
+
+ Latency is the time from sending a read to the first data back from the
+ server. If nothing comes back before the next one is sent, eg for a
+ password, it counts as no reply rather than a sample. The recorded RX has
+ the client's usernames and passwords in it so replay against a server
+ that has the same test accounts.
+
+ Run from the top level directory with "make bench" then
+ "bench/replay [options] <log file>..." or "tdcap <file> | bench/replay -".
+ *****************************************************************************/
+
+#include "globals.h"
+#include <poll.h>
+
+#define HEXDUMP_CHARS   10
+#define LINE_LEN        1000
+#define MAX_CONNECTIONS 1000
+#define END_WAIT_SECS   1.0
+
+struct st_chunk
+{
+	double offset;   /* Secs from the start of the session */
+	int len;
+	u_char *data;
+};
+
+struct st_log_session
+{
+	int pid;
+	time_t start;
+	time_t last;      /* Second the chunks being added are in */
+	int last_first;   /* Index of the first chunk in that second */
+	int chunk_cnt;
+	int open;         /* Still adding to the last chunk */
+	int ended;        /* Pid has been reused */
+	struct st_chunk *chunks;
+};
+
+struct st_replay
+{
+	struct st_log_session *ls;
+	int fd;
+	int next;
+	double start;
+	double end;
+	double last_send;
+	double sent_time;   /* -1 if no reply outstanding */
+	long tx_bytes;
+	long rx_bytes;
+	int no_reply;
+	int lat_cnt;
+	double *lat;
+	int failed;
+};
+
+static struct st_log_session *lsessions = NULL;
+static int lsession_cnt = 0;
+static struct st_replay *replays;
+static int replay_cnt;
+static double *all_lat = NULL;
+static int all_lat_cnt = 0;
+
+static char  *host = "127.0.0.1";
+static int    tport = 23;
+static int    max_conns = 10;
+static int    num_replays = 0;
+static double scale = 1;
+static double max_gap = 5;
+
+static void   parseArgs(int argc, char **argv);
+static void   loadLog(char *path);
+static void   parseLine(char *line);
+static struct st_log_session *findSession(int pid, int create);
+static void   addRX(struct st_log_session *ls, time_t when, u_char *data, int len, int end);
+static void   spreadSecond(struct st_log_session *ls);
+static void   runReplays(void);
+static int    startReplay(struct st_replay *r, double tnow);
+static void   stepReplay(struct st_replay *r, short revents, double tnow);
+static double nextTime(struct st_replay *r);
+static void   endReplay(struct st_replay *r, double tnow);
+static void   printResults(double secs);
+static void   stats(double *samples, int cnt, double *mean, double *p50, double *p99);
+static int    cmpDouble(const void *a, const void *b);
+static double now(void);
+
+
+int main(int argc, char **argv)
+{
+	double start;
+	int i;
+
+	parseArgs(argc,argv);
+
+	/* Drop sessions with nothing to send */
+	for(i=0;i < lsession_cnt;)
+	{
+		spreadSecond(&lsessions[i]);
+		if (lsessions[i].chunk_cnt)
+			++i;
+		else
+			lsessions[i] = lsessions[--lsession_cnt];
+	}
+	if (!lsession_cnt)
+	{
+		fprintf(stderr,"No sessions with RX data found.\n");
+		return 1;
+	}
+	if (!num_replays) num_replays = lsession_cnt;
+	replay_cnt = num_replays;
+	replays = (struct st_replay *)calloc(replay_cnt,sizeof(struct st_replay));
+	assert(replays);
+	for(i=0;i < replay_cnt;++i)
+	{
+		replays[i].ls = &lsessions[i % lsession_cnt];
+		replays[i].fd = -1;
+		replays[i].lat = (double *)malloc(
+			sizeof(double) * replays[i].ls->chunk_cnt);
+		assert(replays[i].lat);
+	}
+
+	printf("%d sessions loaded, %d replays to %s:%d, %d at a time, timing x %g\n\n",
+		lsession_cnt,replay_cnt,host,tport,max_conns,scale);
+	signal(SIGPIPE,SIG_IGN);
+	start = now();
+	runReplays();
+	printResults(now() - start);
+	return 0;
+}
+
+
+
+
+void parseArgs(int argc, char **argv)
+{
+	int files = 0;
+	int i;
+	char c;
+
+	for(i=1;i < argc;++i)
+	{
+		if (argv[i][0] != '-' || strlen(argv[i]) != 2)
+		{
+			loadLog(argv[i]);
+			++files;
+			continue;
+		}
+		c = argv[i][1];
+		if (++i == argc) goto USAGE;
+
+		switch(c)
+		{
+		case 'h':
+			host = argv[i];
+			continue;
+		case 'p':
+			if ((tport = atoi(argv[i])) < 1) goto USAGE;
+			continue;
+		case 'c':
+			max_conns = atoi(argv[i]);
+			if (max_conns < 1 || max_conns > MAX_CONNECTIONS) goto USAGE;
+			continue;
+		case 'n':
+			if ((num_replays = atoi(argv[i])) < 1) goto USAGE;
+			continue;
+		case 's':
+			if ((scale = atof(argv[i])) < 0) goto USAGE;
+			continue;
+		case 'g':
+			if ((max_gap = atof(argv[i])) < 0) goto USAGE;
+			continue;
+		default:
+			goto USAGE;
+		}
+	}
+	if (files) return;
+
+	USAGE:
+	printf("Usage: %s [options] <log file> [<log file>...]\n"
+	       "       -h <host>  : Server address. Default = 127.0.0.1\n"
+	       "       -p <port>  : Server port. Default = 23\n"
+	       "       -c <count> : Connections at once. Default = 10\n"
+	       "       -n <count> : Replays to do, going round the sessions again if\n"
+	       "                    there are more than sessions. Default = 1 each.\n"
+	       "       -s <scale> : Multiply the logged timing by this. 0 sends each read\n"
+	       "                    as soon as the last one has had a reply. Default = 1\n"
+	       "       -g <secs>  : Longest gap between reads, after scaling. Default = 5\n"
+	       "A log file of - reads stdin.\n",argv[0]);
+	exit(1);
+}
+
+
+
+
+void loadLog(char *path)
+{
+	char line[LINE_LEN];
+	FILE *fp;
+
+	if (!strcmp(path,"-"))
+		fp = stdin;
+	else if (!(fp = fopen(path,"r")))
+	{
+		fprintf(stderr,"ERROR: Can't open \"%s\": %s\n",path,strerror(errno));
+		exit(1);
+	}
+	while(fgets(line,sizeof(line),fp)) parseLine(line);
+	if (fp != stdin) fclose(fp);
+}
+
+
+
+
+/*** "YYYY-MM-DD HH:MM:SS: <pid>: <text>". Lines without the preamble, eg
+     the config dump, are skipped. ***/
+void parseLine(char *line)
+{
+	static char last_tstr[20] = "";
+	static time_t last_time;
+	struct st_log_session *ls;
+	struct tm tms;
+	u_char data[HEXDUMP_CHARS];
+	char *ptr;
+	int pid;
+	int len;
+	u_int val;
+
+	if (strlen(line) < 22 || line[4] != '-' || line[19] != ':') return;
+
+	/* Lines come in bursts with the same time so only convert a new one */
+	if (strncmp(line,last_tstr,19))
+	{
+		bzero(&tms,sizeof(tms));
+		if (sscanf(line,"%d-%d-%d %d:%d:%d",
+			&tms.tm_year,&tms.tm_mon,&tms.tm_mday,
+			&tms.tm_hour,&tms.tm_min,&tms.tm_sec) != 6) return;
+		tms.tm_year -= 1900;
+		tms.tm_mon -= 1;
+		tms.tm_isdst = -1;
+		last_time = mktime(&tms);
+		memcpy(last_tstr,line,19);
+	}
+	if ((pid = atoi(line + 21)) < 1 || !(ptr = strchr(line + 21,':')))
+		return;
+	ptr += 2;
+
+	if (!strncmp(ptr,"STARTED: Master process",23))
+	{
+		/* Pids get reused in a long log */
+		if ((ls = findSession(pid,0))) ls->ended = 1;
+		ls = findSession(pid,1);
+		ls->start = last_time;
+		return;
+	}
+	if (!(ls = findSession(pid,0))) return;
+
+	if (!strncmp(ptr,"TX: | ",6))
+	{
+		ls->open = 0;
+		return;
+	}
+	if (strncmp(ptr,"RX: | ",6)) return;
+
+	for(ptr+=6,len=0;len < HEXDUMP_CHARS && sscanf(ptr,"%2x",&val) == 1;ptr+=3)
+		data[len++] = (u_char)val;
+	if (len) addRX(ls,last_time,data,len,len < HEXDUMP_CHARS);
+}
+
+
+
+
+struct st_log_session *findSession(int pid, int create)
+{
+	struct st_log_session *ls;
+	int i;
+
+	/* Recent sessions are the likeliest */
+	for(i=lsession_cnt-1;i >= 0;--i)
+	{
+		if (lsessions[i].pid == pid && !lsessions[i].ended)
+			return &lsessions[i];
+	}
+	if (!create) return NULL;
+
+	lsessions = (struct st_log_session *)realloc(
+		lsessions,sizeof(struct st_log_session) * (lsession_cnt + 1));
+	assert(lsessions);
+	ls = &lsessions[lsession_cnt++];
+	bzero(ls,sizeof(struct st_log_session));
+	ls->pid = pid;
+	return ls;
+}
+
+
+
+
+void addRX(struct st_log_session *ls, time_t when, u_char *data, int len, int end)
+{
+	struct st_chunk *ch;
+
+	if (when != ls->last)
+	{
+		spreadSecond(ls);
+		ls->last = when;
+		ls->last_first = ls->chunk_cnt;
+		ls->open = 0;
+	}
+	if (!ls->open)
+	{
+		ls->chunks = (struct st_chunk *)realloc(
+			ls->chunks,sizeof(struct st_chunk) * (ls->chunk_cnt + 1));
+		assert(ls->chunks);
+		ch = &ls->chunks[ls->chunk_cnt++];
+		ch->offset = (double)(when - ls->start);
+		ch->len = 0;
+		ch->data = NULL;
+		ls->open = 1;
+	}
+	ch = &ls->chunks[ls->chunk_cnt - 1];
+	ch->data = (u_char *)realloc(ch->data,ch->len + len);
+	assert(ch->data);
+	memcpy(ch->data + ch->len,data,len);
+	ch->len += len;
+	if (end) ls->open = 0;
+}
+
+
+
+
+/*** Space out the reads logged in the same second ***/
+void spreadSecond(struct st_log_session *ls)
+{
+	int cnt = ls->chunk_cnt - ls->last_first;
+	int i;
+
+	for(i=1;i < cnt;++i)
+		ls->chunks[ls->last_first + i].offset += (double)i / cnt;
+	ls->last_first = ls->chunk_cnt;
+}
+
+
+
+
+/*** Poll loop over all the connections ***/
+void runReplays(void)
+{
+	struct pollfd pfd[MAX_CONNECTIONS];
+	struct st_replay *active[MAX_CONNECTIONS];
+	struct st_replay *r;
+	double tnow;
+	double wake;
+	double t;
+	int started = 0;
+	int act_cnt = 0;
+	int i;
+
+	for(;;)
+	{
+		tnow = now();
+		while(act_cnt < max_conns && started < replay_cnt)
+		{
+			r = &replays[started++];
+			if (startReplay(r,tnow)) active[act_cnt++] = r;
+		}
+		if (!act_cnt) break;
+
+		for(i=0,wake=-1;i < act_cnt;++i)
+		{
+			pfd[i].fd = active[i]->fd;
+			pfd[i].events = POLLIN;
+			t = nextTime(active[i]);
+			if (wake < 0 || t < wake) wake = t;
+		}
+		t = (wake - tnow) * 1000;
+		poll(pfd,act_cnt,t < 0 ? 0 : (int)t + 1);
+
+		tnow = now();
+		for(i=0;i < act_cnt;++i)
+			stepReplay(active[i],pfd[i].revents,tnow);
+
+		/* Remove finished ones */
+		for(i=0;i < act_cnt;)
+		{
+			if (active[i]->fd == -1)
+				active[i] = active[--act_cnt];
+			else
+				++i;
+		}
+	}
+}
+
+
+
+
+/*** Returns 0 if the connection failed straight away ***/
+int startReplay(struct st_replay *r, double tnow)
+{
+	struct sockaddr_in addr;
+
+	bzero(&addr,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(tport);
+	if (!inet_aton(host,&addr.sin_addr))
+	{
+		fprintf(stderr,"ERROR: Invalid address \"%s\"\n",host);
+		exit(1);
+	}
+	r->start = r->last_send = tnow;
+	r->sent_time = -1;
+
+	/* The server sends first so it's simplest to just wait for this */
+	if ((r->fd = socket(AF_INET,SOCK_STREAM,0)) == -1 ||
+	    connect(r->fd,(struct sockaddr *)&addr,sizeof(addr)) == -1 ||
+	    fcntl(r->fd,F_SETFL,O_NONBLOCK) == -1)
+	{
+		fprintf(stderr,"ERROR: Connect: %s\n",strerror(errno));
+		if (r->fd != -1) close(r->fd);
+		r->fd = -1;
+		r->failed = 1;
+		r->end = tnow;
+		return 0;
+	}
+	return 1;
+}
+
+
+
+
+void stepReplay(struct st_replay *r, short revents, double tnow)
+{
+	struct st_chunk *ch;
+	u_char rbuff[65536];
+	int len;
+
+	if (revents & (POLLIN | POLLERR | POLLHUP))
+	{
+		if ((len = read(r->fd,rbuff,sizeof(rbuff))) < 1)
+		{
+			if (len == -1 && errno == EAGAIN) return;
+			if (len == -1 || (!r->rx_bytes && !r->tx_bytes))
+				r->failed = 1;
+			endReplay(r,tnow);
+			return;
+		}
+		if (r->sent_time >= 0)
+		{
+			r->lat[r->lat_cnt++] = tnow - r->sent_time;
+			r->sent_time = -1;
+		}
+		r->rx_bytes += len;
+	}
+	if (r->next == r->ls->chunk_cnt)
+	{
+		if (tnow >= nextTime(r)) endReplay(r,tnow);
+		return;
+	}
+	if (tnow < nextTime(r)) return;
+
+	ch = &r->ls->chunks[r->next++];
+	if (r->sent_time >= 0) ++r->no_reply;
+	r->sent_time = r->last_send = tnow;
+	if (write(r->fd,ch->data,ch->len) != ch->len)
+	{
+		/* Only a few bytes so the buffer shouldn't ever be full */
+		r->failed = 1;
+		endReplay(r,tnow);
+		return;
+	}
+	r->tx_bytes += ch->len;
+}
+
+
+
+
+/*** When the next read is due, or when to give up waiting for the end.
+     With a scale of 0 the next one goes once the last one has had a reply
+     or after a second. ***/
+double nextTime(struct st_replay *r)
+{
+	struct st_chunk *ch;
+	double gap;
+
+	if (r->next == r->ls->chunk_cnt) return r->last_send + END_WAIT_SECS;
+	if (!scale) return r->sent_time >= 0 ? r->last_send + 1 : 0;
+
+	ch = &r->ls->chunks[r->next];
+	gap = (ch->offset - (r->next ? ch[-1].offset : 0)) * scale;
+	if (gap > max_gap) gap = max_gap;
+	return r->last_send + gap;
+}
+
+
+
+
+void endReplay(struct st_replay *r, double tnow)
+{
+	if (r->sent_time >= 0) ++r->no_reply;
+	close(r->fd);
+	r->fd = -1;
+	r->end = tnow;
+}
+
+
+
+
+void printResults(double secs)
+{
+	struct st_replay *r;
+	double mean;
+	double p50;
+	double p99;
+	long tx = 0;
+	long rx = 0;
+	int failed = 0;
+	int i;
+
+	puts("  Replay  Log pid   Reads  No reply  TX bytes  RX bytes   Secs  RX KB/s  Mean ms   p50 ms   p99 ms");
+	puts("  ======  =======  ======  ========  ========  ========  =====  =======  =======  =======  =======");
+	for(i=0,r=replays;i < replay_cnt;++i,++r)
+	{
+		stats(r->lat,r->lat_cnt,&mean,&p50,&p99);
+		printf("  %6d  %7d  %6d  %8d  %8ld  %8ld  %5.1f  %7.1f  %7.2f  %7.2f  %7.2f%s\n",
+			i + 1,r->ls->pid,r->next,r->no_reply,r->tx_bytes,r->rx_bytes,
+			r->end - r->start,
+			r->end > r->start ? r->rx_bytes / 1024.0 / (r->end - r->start) : 0,
+			mean * 1000,p50 * 1000,p99 * 1000,
+			r->failed ? "  FAILED" : "");
+
+		all_lat = (double *)realloc(
+			all_lat,sizeof(double) * (all_lat_cnt + r->lat_cnt + 1));
+		assert(all_lat);
+		memcpy(all_lat + all_lat_cnt,r->lat,sizeof(double) * r->lat_cnt);
+		all_lat_cnt += r->lat_cnt;
+		tx += r->tx_bytes;
+		rx += r->rx_bytes;
+		failed += r->failed;
+	}
+	stats(all_lat,all_lat_cnt,&mean,&p50,&p99);
+	printf("\n%d replays, %d failed, in %.1f secs\n",replay_cnt,failed,secs);
+	printf("TX %ld bytes, RX %ld bytes, %.1f RX KB/s overall\n",
+		tx,rx,secs > 0 ? rx / 1024.0 / secs : 0);
+	printf("Latency over %d replies: mean %.2f ms, p50 %.2f ms, p99 %.2f ms\n",
+		all_lat_cnt,mean * 1000,p50 * 1000,p99 * 1000);
+}
+
+
+
+
+/*** Sorts the samples ***/
+void stats(double *samples, int cnt, double *mean, double *p50, double *p99)
+{
+	double total;
+	int i;
+
+	*mean = *p50 = *p99 = 0;
+	if (!cnt) return;
+	qsort(samples,cnt,sizeof(double),cmpDouble);
+	for(i=0,total=0;i < cnt;++i) total += samples[i];
+	*mean = total / cnt;
+	*p50 = samples[cnt / 2];
+	*p99 = samples[cnt * 99 / 100];
+}
+
+
+
+
+int cmpDouble(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return d < 0 ? -1 : (d > 0);
+}
+
+
+
+
+/*** In seconds ***/
+double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
@@ -0,0 +1,173 @@
+/*****************************************************************************
+ Binary wire capture. If capture_dir is set each master writes everything
+ it reads from and writes to the socket, timestamped, to its own file in
+ there. Unlike the hexdump option nothing is formatted, the records go into
+ a buffer which is only written out when it fills, when the session has
+ been idle for CAPTURE_FLUSH_SECS or when the master exits. tdcap turns a
+ capture back into the hexdump log format.
+ *****************************************************************************/
+
+#include "globals.h"
+#include "capture.h"
+
+#define CAPTURE_BUFF       65536
+#define CAPTURE_FLUSH_SECS 1
+
+static u_char *cap_buff = NULL;
+static int cap_len = 0;
+static int cap_fd = -1;
+static time_t cap_first = 0;
+
+static void addCapture(void *data, int len);
+static void flushCapture(void);
+
+
+/*** Called by the master when it starts. The file can have passwords in it
+     so only the owner can read it. ***/
+void startCapture(struct sockaddr_in *ip_addr)
+{
+	struct st_cap_header hdr;
+	struct timeval tv;
+	char tstr[20];
+	char *path;
+
+	if (!capture_dir) return;
+
+	gettimeofday(&tv,NULL);
+	strftime(tstr,sizeof(tstr),"%Y%m%d-%H%M%S",localtime(&tv.tv_sec));
+	asprintf(&path,"%s/%s-%d.cap",capture_dir,tstr,master_pid);
+
+	if ((cap_fd = open(
+		path,O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,0600)) == -1)
+	{
+		logprintf(master_pid,"ERROR: startCapture(): open(\"%s\"): %s\n",
+			path,strerror(errno));
+		free(path);
+		return;
+	}
+	logprintf(master_pid,"Capture file = %s\n",path);
+	free(path);
+
+	cap_buff = (u_char *)malloc(CAPTURE_BUFF);
+	assert(cap_buff);
+	cap_len = 0;
+
+	memcpy(hdr.magic,CAPTURE_MAGIC,CAPTURE_MAGIC_LEN);
+	hdr.pid = htonl(master_pid);
+	hdr.addr = ip_addr->sin_addr.s_addr;
+	hdr.port = htonl(ntohs(ip_addr->sin_port));
+	hdr.secs = htonl((uint32_t)tv.tv_sec);
+	hdr.usecs = htonl((uint32_t)tv.tv_usec);
+	addCapture(&hdr,sizeof(hdr));
+	flags.capture = 1;
+}
+
+
+
+
+/*** Called from readSock() and writeSock() ***/
+void captureData(u_char *data, int len, int type)
+{
+	struct st_cap_record rec;
+	struct timeval tv;
+
+	gettimeofday(&tv,NULL);
+	rec.secs = htonl((uint32_t)tv.tv_sec);
+	rec.usecs = htonl((uint32_t)tv.tv_usec);
+	rec.type = htonl(type);
+	rec.len = htonl(len);
+	if (!cap_len) cap_first = tv.tv_sec;
+
+	addCapture(&rec,sizeof(rec));
+	addCapture(data,len);
+}
+
+
+
+
+/*** Make sure the master wakes up to flush the buffer ***/
+void setCaptureTimeout(struct timeval *tv, struct timeval **tvp)
+{
+	if (!cap_len) return;
+	if (!*tvp || tv->tv_sec >= CAPTURE_FLUSH_SECS)
+	{
+		tv->tv_sec = CAPTURE_FLUSH_SECS;
+		tv->tv_usec = 0;
+		*tvp = tv;
+	}
+}
+
+
+
+
+/*** Call after select() in the master ***/
+void checkCapture(void)
+{
+	if (cap_len && time(0) - cap_first >= CAPTURE_FLUSH_SECS)
+		flushCapture();
+}
+
+
+
+
+void endCapture(void)
+{
+	if (cap_fd == -1) return;
+	flushCapture();
+	close(cap_fd);
+	cap_fd = -1;
+	flags.capture = 0;
+}
+
+
+
+
+void addCapture(void *data, int len)
+{
+	int cnt;
+
+	while(len)
+	{
+		if (cap_len == CAPTURE_BUFF) flushCapture();
+		cnt = len < CAPTURE_BUFF - cap_len ? len : CAPTURE_BUFF - cap_len;
+		memcpy(cap_buff + cap_len,data,cnt);
+		cap_len += cnt;
+		data = (u_char *)data + cnt;
+		len -= cnt;
+	}
+}
+
+
+
+
+/*** If the write fails stop capturing rather than leave a file with a
+     hole in it ***/
+void flushCapture(void)
+{
+	int len;
+	int i;
+
+	if (cap_fd == -1)
+	{
+		cap_len = 0;
+		return;
+	}
+	for(i=0;i < cap_len;i += len)
+	{
+		if ((len = write(cap_fd,cap_buff + i,cap_len - i)) == -1)
+		{
+			if (errno == EINTR)
+			{
+				len = 0;
+				continue;
+			}
+			logprintf(master_pid,"ERROR: flushCapture(): write(): %s\n",
+				strerror(errno));
+			close(cap_fd);
+			cap_fd = -1;
+			flags.capture = 0;
+			break;
+		}
+	}
+	cap_len = 0;
+}
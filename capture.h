@@ -0,0 +1,32 @@
+/*****************************************************************************
+ Wire capture file format shared by telnetd and tdcap. A header then one
+ record per read from or write to the socket, each followed by its data.
+ All fields are 32 bit big endian so a capture can be read on any machine.
+ *****************************************************************************/
+
+#define CAPTURE_MAGIC     "TDCAP001"
+#define CAPTURE_MAGIC_LEN 8
+
+enum
+{
+	CAPTURE_RX = 1,
+	CAPTURE_TX
+};
+
+struct st_cap_header
+{
+	char magic[CAPTURE_MAGIC_LEN];
+	uint32_t pid;
+	uint32_t addr;   /* IPv4 address, already in network order */
+	uint32_t port;
+	uint32_t secs;
+	uint32_t usecs;
+};
+
+struct st_cap_record
+{
+	uint32_t secs;
+	uint32_t usecs;
+	uint32_t type;
+	uint32_t len;
+};
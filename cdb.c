@@ -0,0 +1,295 @@
+/*****************************************************************************
+ Write and read a cdb constant database. The database is written to a
+ uniquely named temporary file with the same permissions as the one it
+ replaces, or 0600 as it holds password hashes, which is renamed over the
+ real one when complete so that readers never see a partially written file. A lookup is a read of the
+ header slot, one or more reads of the hash table slots and a read of the
+ record, all via pread() so there's no need to map or scan the file.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cdb.h"
+
+static void packUint32(u_char *p, uint32_t u);
+static uint32_t unpackUint32(u_char *p);
+static int writeAll(struct st_cdb_make *cm, void *data, uint32_t len);
+static int readAll(int fd, void *data, uint32_t len, uint32_t pos);
+
+
+/*** The standard cdb hash function ***/
+uint32_t cdbHash(char *key, uint32_t klen)
+{
+	uint32_t h = 5381;
+	uint32_t i;
+
+	for(i=0;i < klen;++i) h = ((h << 5) + h) ^ (u_char)key[i];
+	return h;
+}
+
+
+
+
+/********************************** WRITING *********************************/
+
+int cdbMakeStart(struct st_cdb_make *cm, char *path)
+{
+	u_char header[CDB_HEADER_SIZE];
+	struct stat fs;
+	mode_t mode;
+	int fd;
+
+	memset(cm,0,sizeof(struct st_cdb_make));
+	cm->path = path;
+	mode = stat(path,&fs) == -1 ? 0600 : (fs.st_mode & 07777);
+
+	if (asprintf(&cm->tmp_path,"%s.XXXXXX",path) == -1) return 0;
+	if ((fd = mkstemp(cm->tmp_path)) == -1)
+	{
+		free(cm->tmp_path);
+		return 0;
+	}
+	if (fchmod(fd,mode) == -1 || !(cm->fp = fdopen(fd,"w")))
+	{
+		close(fd);
+		cdbMakeAbort(cm);
+		return 0;
+	}
+
+	/* Space for the header which gets written at the end */
+	memset(header,0,sizeof(header));
+	cm->pos = 0;
+	if (!writeAll(cm,header,sizeof(header)))
+	{
+		cdbMakeAbort(cm);
+		return 0;
+	}
+	return 1;
+}
+
+
+
+
+int cdbMakeAdd(
+	struct st_cdb_make *cm,
+	char *key, uint32_t klen, char *data, uint32_t dlen)
+{
+	u_char lens[8];
+	struct st_cdb_rec *rec;
+
+	cm->recs = (struct st_cdb_rec *)realloc(
+		cm->recs,sizeof(struct st_cdb_rec) * (cm->rec_cnt + 1));
+	if (!cm->recs) return 0;
+	rec = &cm->recs[cm->rec_cnt++];
+	rec->hash = cdbHash(key,klen);
+	rec->pos = cm->pos;
+
+	packUint32(lens,klen);
+	packUint32(lens+4,dlen);
+	return (writeAll(cm,lens,8) &&
+	        writeAll(cm,key,klen) && writeAll(cm,data,dlen));
+}
+
+
+
+
+/*** Write the hash tables and header then rename the temporary file to the
+     real one ***/
+int cdbMakeFinish(struct st_cdb_make *cm)
+{
+	u_char header[CDB_HEADER_SIZE];
+	u_char slot[8];
+	struct st_cdb_rec *table;
+	uint32_t count[CDB_NUM_TABLES];
+	uint32_t tlen;
+	uint32_t s;
+	uint32_t i;
+	uint32_t t;
+
+	memset(count,0,sizeof(count));
+	for(i=0;i < cm->rec_cnt;++i) ++count[cm->recs[i].hash & 255];
+
+	/* Each table has twice as many slots as records so it's never full */
+	table = (struct st_cdb_rec *)malloc(
+		sizeof(struct st_cdb_rec) * (cm->rec_cnt * 2 + 1));
+	if (!table) goto ERROR;
+
+	for(t=0;t < CDB_NUM_TABLES;++t)
+	{
+		tlen = count[t] * 2;
+		packUint32(header + t * 8,cm->pos);
+		packUint32(header + t * 8 + 4,tlen);
+		if (!tlen) continue;
+
+		memset(table,0,sizeof(struct st_cdb_rec) * tlen);
+		for(i=0;i < cm->rec_cnt;++i)
+		{
+			if ((cm->recs[i].hash & 255) != t) continue;
+			for(s=(cm->recs[i].hash >> 8) % tlen;
+			    table[s].pos;s = (s + 1) % tlen);
+			table[s] = cm->recs[i];
+		}
+		for(s=0;s < tlen;++s)
+		{
+			packUint32(slot,table[s].hash);
+			packUint32(slot+4,table[s].pos);
+			if (!writeAll(cm,slot,8))
+			{
+				free(table);
+				goto ERROR;
+			}
+		}
+	}
+	free(table);
+
+	if (fseek(cm->fp,0,SEEK_SET) == -1 ||
+	    fwrite(header,sizeof(header),1,cm->fp) != 1 ||
+	    fflush(cm->fp) == EOF ||
+	    fsync(fileno(cm->fp)) == -1) goto ERROR;
+
+	fclose(cm->fp);
+	cm->fp = NULL;
+	if (rename(cm->tmp_path,cm->path) == -1) goto ERROR;
+
+	free(cm->tmp_path);
+	free(cm->recs);
+	return 1;
+
+	ERROR:
+	cdbMakeAbort(cm);
+	return 0;
+}
+
+
+
+
+/*** Tidy up and remove the temporary file. Preserves errno. ***/
+void cdbMakeAbort(struct st_cdb_make *cm)
+{
+	int en = errno;
+
+	if (cm->fp) fclose(cm->fp);
+	unlink(cm->tmp_path);
+	free(cm->tmp_path);
+	free(cm->recs);
+	memset(cm,0,sizeof(struct st_cdb_make));
+	errno = en;
+}
+
+
+
+
+/********************************** READING *********************************/
+
+/*** Returns 1 if found with a malloc'd copy of the data, 0 if not found
+     and -1 on error ***/
+int cdbFind(int fd, char *key, uint32_t klen, char **data, uint32_t *dlen)
+{
+	u_char buff[8];
+	char *rkey;
+	uint32_t h;
+	uint32_t tpos;
+	uint32_t tlen;
+	uint32_t s;
+	uint32_t i;
+	uint32_t pos;
+
+	h = cdbHash(key,klen);
+	if (!readAll(fd,buff,8,(h & 255) * 8)) return -1;
+	tpos = unpackUint32(buff);
+	if (!(tlen = unpackUint32(buff+4))) return 0;
+
+	for(i=0,s=(h >> 8) % tlen;i < tlen;++i,s = (s + 1) % tlen)
+	{
+		if (!readAll(fd,buff,8,tpos + s * 8)) return -1;
+		if (!(pos = unpackUint32(buff+4))) return 0;
+		if (unpackUint32(buff) != h) continue;
+
+		/* Hash matches, check the key */
+		if (!readAll(fd,buff,8,pos)) return -1;
+		if (unpackUint32(buff) != klen) continue;
+
+		*dlen = unpackUint32(buff+4);
+		if (!(rkey = (char *)malloc(klen + *dlen + 1))) return -1;
+		if (!readAll(fd,rkey,klen + *dlen,pos + 8))
+		{
+			free(rkey);
+			return -1;
+		}
+		if (memcmp(rkey,key,klen))
+		{
+			free(rkey);
+			continue;
+		}
+		memmove(rkey,rkey + klen,*dlen);
+		rkey[*dlen] = 0;
+		*data = rkey;
+		return 1;
+	}
+	return 0;
+}
+
+
+
+
+/********************************** SUPPORT *********************************/
+
+/*** cdb numbers are always little endian ***/
+void packUint32(u_char *p, uint32_t u)
+{
+	p[0] = u & 0xFF;
+	p[1] = (u >> 8) & 0xFF;
+	p[2] = (u >> 16) & 0xFF;
+	p[3] = (u >> 24) & 0xFF;
+}
+
+
+
+
+uint32_t unpackUint32(u_char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+
+
+int writeAll(struct st_cdb_make *cm, void *data, uint32_t len)
+{
+	/* The file format uses 32 bit offsets */
+	if (cm->pos + len < cm->pos)
+	{
+		errno = EFBIG;
+		return 0;
+	}
+	if (len && fwrite(data,len,1,cm->fp) != 1) return 0;
+	cm->pos += len;
+	return 1;
+}
+
+
+
+
+int readAll(int fd, void *data, uint32_t len, uint32_t pos)
+{
+	ssize_t l;
+	uint32_t got;
+
+	for(got=0;got < len;got += l)
+	{
+		if ((l = pread(fd,(char *)data + got,len - got,pos + got)) < 1)
+		{
+			if (!l) errno = EPROTO; /* Truncated file */
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,30 @@
+/*****************************************************************************
+ Constant database functions shared by telnetd and tduser. The file format
+ is the same as D.J.Bernstein's cdb so the standard cdb tools can read it.
+ *****************************************************************************/
+
+#define CDB_HEADER_SIZE 2048
+#define CDB_NUM_TABLES  256
+
+struct st_cdb_rec
+{
+	uint32_t hash;
+	uint32_t pos;
+};
+
+struct st_cdb_make
+{
+	FILE *fp;
+	char *path;
+	char *tmp_path;
+	struct st_cdb_rec *recs;
+	uint32_t rec_cnt;
+	uint32_t pos;
+};
+
+uint32_t cdbHash(char *key, uint32_t klen);
+int cdbMakeStart(struct st_cdb_make *cm, char *path);
+int cdbMakeAdd(struct st_cdb_make *cm, char *key, uint32_t klen, char *data, uint32_t dlen);
+int cdbMakeFinish(struct st_cdb_make *cm);
+void cdbMakeAbort(struct st_cdb_make *cm);
+int cdbFind(int fd, char *key, uint32_t klen, char **data, uint32_t *dlen);
@@ -0,0 +1,376 @@
+/*****************************************************************************
+ Per session resource limits. If cgroup_dir is set and is in a cgroup v2
+ hierarchy each session's slave is put in its own cgroup under it with the
+ session_cpu_weight, session_memory_max_mb and session_pids_max limits and
+ its peak memory and CPU use are logged when the session ends. Anything the
+ user left running in the cgroup is killed at that point so the figures are
+ final and the cgroup can be removed. Otherwise, or
+ if the cgroup can't be created, the nearest setrlimit() and nice values are
+ used instead. The limits can be overridden per user in the limits field of
+ the telnetd password file.
+ *****************************************************************************/
+
+#include "globals.h"
+#include <dirent.h>
+
+#define CGROUP_PREFIX "session-"
+
+/* How long to wait for the killed processes to leave the cgroup */
+#define CGROUP_EMPTY_WAIT_MSECS 1000
+#define CGROUP_POLL_MSECS       10
+
+static char *session_cgroup = NULL;
+
+static void killCgroup(void);
+static int  cgroupPopulated(void);
+static void removeCgroup(void);
+static int  writeCgroupFile(char *dir, char *file, char *fmt, ...);
+static int  readCgroupFile(char *file, char *buff, int size);
+static int  weightToNice(int weight);
+
+
+/*** Called by the parent after the config has been read. Turns on the
+     controllers for the session cgroups and removes any empty ones left
+     over from a previous run. ***/
+void initCgroups(void)
+{
+	struct dirent *de;
+	DIR *dir;
+	char *path;
+
+	if (!cgroup_dir) return;
+
+	if (mkdir(cgroup_dir,0755) == -1 && errno != EEXIST)
+	{
+		logprintf(0,"WARNING: initCgroups(): mkdir(\"%s\"): %s\n",
+			cgroup_dir,strerror(errno));
+		return;
+	}
+	if (!writeCgroupFile(
+		cgroup_dir,"cgroup.subtree_control","+cpu +memory +pids"))
+	{
+		logprintf(0,"WARNING: Can't enable cgroup controllers in \"%s\", setrlimit() will be used.\n",
+			cgroup_dir);
+	}
+
+	if (!(dir = opendir(cgroup_dir))) return;
+	while((de = readdir(dir)))
+	{
+		if (strncmp(de->d_name,CGROUP_PREFIX,strlen(CGROUP_PREFIX)))
+			continue;
+		asprintf(&path,"%s/%s",cgroup_dir,de->d_name);
+		rmdir(path);
+		free(path);
+	}
+	closedir(dir);
+}
+
+
+
+
+/*** Parse the limits field from the password file. It's a comma separated
+     list of cpu_weight=, memory_max_mb= and pids_max= settings. Overwrites
+     the globals as we're the master. ***/
+int parseUserLimits(char *str, int linenum)
+{
+	char *name;
+	char *ptr;
+	char *end;
+	int val;
+
+	for(ptr=str;*ptr;)
+	{
+		name = ptr;
+		if (!(ptr = strchr(name,'='))) goto ERROR;
+		val = (int)strtol(++ptr,&end,10);
+		if (end == ptr || val < 0 || (*end && *end != ',')) goto ERROR;
+
+		if (!strncmp(name,"cpu_weight=",11))
+		{
+			/* Zero turns off a weight set in the config */
+			if (val > 10000) goto ERROR;
+			session_cpu_weight = val;
+		}
+		else if (!strncmp(name,"memory_max_mb=",14))
+			session_memory_max_mb = val;
+		else if (!strncmp(name,"pids_max=",9))
+			session_pids_max = val;
+		else
+			goto ERROR;
+
+		ptr = *end ? end + 1 : end;
+	}
+	return 1;
+
+	ERROR:
+	logprintf(master_pid,"ERROR: User \"%s\": Invalid limits \"%s\" on line %d.\n",
+		username,str,linenum);
+	return 0;
+}
+
+
+
+
+/*** Called by the master before starting the slave. Creates the session's
+     cgroup and sets its limits, else works out the fallback rlimits. ***/
+void prepareSessionLimits(struct st_limits *lim)
+{
+	char *procs;
+
+	bzero(lim,sizeof(struct st_limits));
+	lim->cgroup_fd = -1;
+	if (!session_cpu_weight && !session_memory_max_mb && !session_pids_max)
+		return;
+
+	if (cgroup_dir)
+	{
+		asprintf(&session_cgroup,"%s/%s%d",cgroup_dir,CGROUP_PREFIX,master_pid);
+		if (mkdir(session_cgroup,0755) == -1)
+		{
+			logprintf(master_pid,"ERROR: prepareSessionLimits(): mkdir(\"%s\"): %s\n",
+				session_cgroup,strerror(errno));
+			FREE(session_cgroup);
+			session_cgroup = NULL;
+		}
+		else if ((session_cpu_weight &&
+		          !writeCgroupFile(session_cgroup,"cpu.weight","%d",session_cpu_weight)) ||
+		         (session_memory_max_mb &&
+		          !writeCgroupFile(session_cgroup,"memory.max","%lld",
+		                           (long long)session_memory_max_mb * 1024 * 1024)) ||
+		         (session_pids_max &&
+		          !writeCgroupFile(session_cgroup,"pids.max","%d",session_pids_max)))
+		{
+			removeCgroup();
+		}
+		else
+		{
+			/* The slave writes itself into this before it execs */
+			asprintf(&procs,"%s/cgroup.procs",session_cgroup);
+			if ((lim->cgroup_fd = open(procs,O_WRONLY | O_CLOEXEC)) == -1)
+			{
+				logprintf(master_pid,"ERROR: prepareSessionLimits(): open(\"%s\"): %s\n",
+					procs,strerror(errno));
+				removeCgroup();
+			}
+			free(procs);
+		}
+		if (lim->cgroup_fd != -1)
+		{
+			logprintf(master_pid,"Session cgroup = %s\n",session_cgroup);
+			return;
+		}
+		logprintf(master_pid,"WARNING: Using setrlimit() for session limits.\n");
+	}
+
+	/* RLIMIT_NPROC is per user, not per session, but it's the nearest */
+	if (session_memory_max_mb)
+	{
+		lim->set_as = 1;
+		lim->as.rlim_cur = (rlim_t)session_memory_max_mb * 1024 * 1024;
+		lim->as.rlim_max = lim->as.rlim_cur;
+	}
+	if (session_pids_max)
+	{
+		lim->set_nproc = 1;
+		lim->nproc.rlim_cur = session_pids_max;
+		lim->nproc.rlim_max = session_pids_max;
+	}
+	if (session_cpu_weight)
+	{
+		lim->set_nice = 1;
+		lim->nice = weightToNice(session_cpu_weight);
+	}
+}
+
+
+
+
+/*** Called by the master when it exits. Kills anything still in the session
+     cgroup, logs what the session used and removes the cgroup. If it somehow
+     still can't be removed it's done by initCgroups() next time around. ***/
+void endSessionCgroup(void)
+{
+	char buff[1000];
+	char peakstr[30];
+	char *ptr;
+	char *path;
+	long long peak = -1;
+	long long usage = -1;
+	long long user = -1;
+	long long sys = -1;
+
+	if (!session_cgroup) return;
+
+	killCgroup();
+
+	asprintf(&path,"%s/memory.peak",session_cgroup);
+	if (readCgroupFile(path,buff,sizeof(buff))) peak = atoll(buff);
+	free(path);
+
+	asprintf(&path,"%s/cpu.stat",session_cgroup);
+	if (readCgroupFile(path,buff,sizeof(buff)))
+	{
+		if ((ptr = strstr(buff,"usage_usec "))) usage = atoll(ptr + 11);
+		if ((ptr = strstr(buff,"user_usec "))) user = atoll(ptr + 10);
+		if ((ptr = strstr(buff,"system_usec "))) sys = atoll(ptr + 12);
+	}
+	free(path);
+
+	if (usage != -1)
+	{
+		/* One call so it's one line in the log ring */
+		if (peak == -1)
+			strcpy(peakstr,"<unknown>");
+		else
+		{
+			snprintf(peakstr,sizeof(peakstr),"%.1f MB",
+				(double)peak / (1024 * 1024));
+		}
+		logprintf(master_pid,"Session usage: CPU = %.3f secs (user %.3f, system %.3f), peak memory = %s\n",
+			(double)usage / 1000000,
+			(double)user / 1000000,(double)sys / 1000000,peakstr);
+	}
+
+	removeCgroup();
+}
+
+
+
+
+/*** The shell may have exited leaving background jobs or daemons behind in
+     the cgroup. cgroup.kill does it in one go on 5.14+ kernels, otherwise
+     kill whatever's listed in cgroup.procs until nothing is left. ***/
+void killCgroup(void)
+{
+	char buff[4096];
+	char *path;
+	char *ptr;
+	char *end;
+	pid_t pid;
+	int have_kill;
+	int fd;
+	int i;
+
+	if (!cgroupPopulated()) return;
+
+	/* Open directly rather than use writeCgroupFile() as ENOENT just means
+	   an older kernel and isn't worth logging */
+	asprintf(&path,"%s/cgroup.kill",session_cgroup);
+	have_kill = ((fd = open(path,O_WRONLY)) != -1 && write(fd,"1",1) == 1);
+	if (fd != -1) close(fd);
+	free(path);
+
+	asprintf(&path,"%s/cgroup.procs",session_cgroup);
+	for(i=0;i < CGROUP_EMPTY_WAIT_MSECS / CGROUP_POLL_MSECS;++i)
+	{
+		if (!have_kill && readCgroupFile(path,buff,sizeof(buff)))
+		{
+			for(ptr=buff;(pid = (pid_t)strtol(ptr,&end,10)) > 0;ptr=end)
+				kill(pid,SIGKILL);
+		}
+		if (!cgroupPopulated()) break;
+		usleep(CGROUP_POLL_MSECS * 1000);
+	}
+	free(path);
+
+	if (cgroupPopulated())
+	{
+		logprintf(master_pid,"WARNING: Processes still running in cgroup \"%s\" after %dms.\n",
+			session_cgroup,CGROUP_EMPTY_WAIT_MSECS);
+	}
+}
+
+
+
+
+/*** Returns 1 if there's anything in the cgroup or if we can't tell ***/
+int cgroupPopulated(void)
+{
+	char buff[200];
+	char *path;
+	char *ptr;
+	int ret;
+
+	asprintf(&path,"%s/cgroup.events",session_cgroup);
+	ret = (!readCgroupFile(path,buff,sizeof(buff)) ||
+	       !(ptr = strstr(buff,"populated ")) || atoi(ptr + 10) != 0);
+	free(path);
+	return ret;
+}
+
+
+
+
+void removeCgroup(void)
+{
+	if (rmdir(session_cgroup) == -1 && errno != EBUSY)
+	{
+		logprintf(master_pid,"ERROR: removeCgroup(): rmdir(\"%s\"): %s\n",
+			session_cgroup,strerror(errno));
+	}
+	free(session_cgroup);
+	session_cgroup = NULL;
+}
+
+
+
+
+/*** Returns 0 on failure ***/
+int writeCgroupFile(char *dir, char *file, char *fmt, ...)
+{
+	va_list args;
+	char *path;
+	char *str;
+	int len;
+	int fd;
+	int ok;
+
+	asprintf(&path,"%s/%s",dir,file);
+	va_start(args,fmt);
+	len = vasprintf(&str,fmt,args);
+	va_end(args);
+
+	ok = ((fd = open(path,O_WRONLY)) != -1 && write(fd,str,len) == len);
+	if (!ok)
+	{
+		logprintf(getpid(),"ERROR: writeCgroupFile(): \"%s\" to \"%s\": %s\n",
+			str,path,strerror(errno));
+	}
+	if (fd != -1) close(fd);
+	free(path);
+	free(str);
+	return ok;
+}
+
+
+
+
+int readCgroupFile(char *file, char *buff, int size)
+{
+	int len;
+	int fd;
+
+	if ((fd = open(file,O_RDONLY)) == -1) return 0;
+	len = read(fd,buff,size - 1);
+	close(fd);
+	if (len < 1) return 0;
+	buff[len] = 0;
+	return 1;
+}
+
+
+
+
+/*** The kernel gives about 1.25 times more CPU per nice level and 100 is
+     the default weight so map it to the nearest nice value ***/
+int weightToNice(int weight)
+{
+	double w;
+	int nice;
+
+	if (weight >= 100)
+		for(nice=0,w=100;w * 1.118 < weight && nice > -20;w *= 1.25,--nice);
+	else
+		for(nice=0,w=100;w / 1.118 > weight && nice < 19;w /= 1.25,++nice);
+	return nice;
+}
@@ -8,6 +8,8 @@
 #define LOGIN_SVRERR_MSG       "Server error. Contact your system administrator."
 #define LOGIN_TIMEOUT_MSG      "Timeout."
 #define BANNED_USER_MSG        "Login banned."
+#define MAX_SESSIONS_MSG       "Server full. Try again later."
+#define LOGIN_POOL_TERM        "xterm"
 
 #define SET_STR_FIELD(P) \
 	if (P) \
@@ -20,10 +22,24 @@
 	P = strdup(value);
 
 
+static char *log_level_name[NUM_LOG_LEVELS] =
+{
+	"error","warn","info","debug","trace"
+};
+
+static char *record_format_name[NUM_RECORD_FORMATS] =
+{
+	"asciicast","ttyrec"
+};
+
 static void processConfigParam(char **words, int word_cnt, int linenum);
 static void parseBannedUsers(char *list);
 static void parseInterfaces(char **words, int word_cnt, int linenum);
 static void parseIPList(char **words, int word_cnt);
+static void parseIPListFiles(char **words, int word_cnt);
+static void parseRateLimit(char **words, int word_cnt, int type, int linenum);
+static void parseCPUList(char *str, int linenum);
+static void addToList(char ***list, int *cnt, char *str);
 static void printParams(void);
 
 
@@ -145,6 +161,49 @@ void parseConfigFile(void)
  		if (!shell_exec_argv)
 			logprintf(0,"WARNING: The pwd_file field is set but shell_program field is not.\n");
 	}
+	else if (pwd_db_file)
+	{
+		logprintf(0,"WARNING: The pwd_db_file field is set but pwd_file field is not, ignoring.\n");
+		free(pwd_db_file);
+		pwd_db_file = NULL;
+	}
+	if (record_users && !shell_exec_argv)
+	{
+		/* A login program gets the username itself and all we have is
+		   what the client sent which it could change to dodge it */
+		logprintf(0,"ERROR: The record_users field requires the shell_program field.\n");
+		parentExit(1);
+	}
+	if (login_pool_size && (shell_exec_argv || flags.preserve_env))
+		logprintf(0,"WARNING: The login_pool_size field is ignored with shell_program or login_preserve_env.\n");
+	else if (login_pool_size &&
+	         (session_cpu_weight || session_memory_max_mb || session_pids_max))
+	{
+		logprintf(0,"WARNING: The login_pool_size field is ignored with the session_* limit fields.\n");
+	}
+#ifdef __linux__
+	if (affinity_cpu_cnt)
+	{
+		cpu_set_t set;
+		int i;
+
+		/* Only warn as the allowed set can change under us */
+		if (sched_getaffinity(0,sizeof(set),&set) != -1)
+		{
+			for(i=0;i < affinity_cpu_cnt;++i)
+			{
+				if (!CPU_ISSET(affinity_cpus[i],&set))
+				{
+					logprintf(0,"WARNING: CPU %d in the cpu_affinity field is not available.\n",
+						affinity_cpus[i]);
+				}
+			}
+		}
+	}
+#else
+	if (affinity_cpu_cnt)
+		logprintf(0,"WARNING: The cpu_affinity field is only supported on Linux, ignoring.\n");
+#endif
 #ifdef __APPLE__
 	/* Require our own password file as we can't get user password info 
 	   from MacOS as it doesn't have the getpwnam() system function, it 
@@ -168,6 +227,9 @@ void parseConfigFile(void)
 	if (!login_svrerr_msg) login_svrerr_msg = strdup(LOGIN_SVRERR_MSG);
 	if (!login_timeout_msg) login_timeout_msg = strdup(LOGIN_TIMEOUT_MSG);
 	if (!banned_user_msg) banned_user_msg = strdup(BANNED_USER_MSG);
+	if (!max_sessions_msg) max_sessions_msg = strdup(MAX_SESSIONS_MSG);
+	if (!login_pool_term) login_pool_term = strdup(LOGIN_POOL_TERM);
+	renderMessages();
 
 	/* The 0 index is set in main.c:init() to be INADDR_ANY as a
 	   default */
@@ -195,43 +257,99 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 		FIELD_STORE_HOST_IN_UTMP,
 		FIELD_SHOW_TERM_RESIZE,
 		FIELD_IGNORE_SIGHUP,
+		FIELD_CAPTURE_TRACED_ONLY,
 
-		/* Numeric */
+		/* 10 Numeric */
 		FIELD_PORT,
-		/* 10 */
 		FIELD_TELOPT_TIMEOUT_SECS,
 		FIELD_LOG_FILE_MAX_FAILS,
 		FIELD_LOGIN_MAX_ATTEMPTS,
 		FIELD_LOGIN_TIMEOUT_SECS,
+
+		/* 15 */
 		FIELD_LOGIN_PAUSE_SECS,
+		FIELD_TELOPT_ENV_MAX_VARS,
+		FIELD_TELOPT_ENV_MAX_BYTES,
+		FIELD_LOCKOUT_MAX_FAILS,
+		FIELD_LOCKOUT_DECAY_SECS,
 
-		/* 15 Strings */
+		/* 20 */
+		FIELD_LOCKOUT_TABLE_SIZE,
+		FIELD_CONN_RATE_IP,
+		FIELD_CONN_RATE_SUBNET,
+		FIELD_CONN_RATE_GLOBAL,
+		FIELD_MAX_SESSIONS,
+
+		/* 25 */
+		FIELD_MAX_IFACE_SESSIONS,
+		FIELD_SESSION_QUEUE_SIZE,
+		FIELD_SESSION_QUEUE_TIMEOUT_SECS,
+		FIELD_PTY_POOL_SIZE,
+		FIELD_LOGIN_POOL_SIZE,
+
+		/* 30 */
+		FIELD_SESSION_CPU_WEIGHT,
+		FIELD_SESSION_MEMORY_MAX_MB,
+		FIELD_SESSION_PIDS_MAX,
+		FIELD_DNS_CACHE_SIZE,
+		FIELD_DNS_CACHE_TTL_SECS,
+
+		/* 35 */
+		FIELD_DNS_CACHE_NEG_TTL_SECS,
+		FIELD_DNS_TIMEOUT_SECS,
+		FIELD_LOG_LIMIT_BURST,
+		FIELD_LOG_LIMIT_SITE_BURST,
+		FIELD_LOG_LIMIT_SECS,
+
+		/* 40 */
+		FIELD_RECORD_BUFFER_KB,
+
+		/* Strings */
 		FIELD_NETWORK_INTERFACE,
 		FIELD_LOGIN_PROGRAM,
 		FIELD_LOGIN_PROMPT,
 		FIELD_LOGIN_INCORRECT_MSG,
+		/* 45 */
 		FIELD_LOGIN_MAX_ATTEMPTS_MSG,
-
-		/* 20 */
 		FIELD_LOGIN_SVRERR_MSG,
 		FIELD_LOGIN_TIMEOUT_MSG,
 		FIELD_PWD_PROMPT,
 		FIELD_SHELL_PROGRAM,
-		FIELD_BANNED_USERS,
 
-		/* 25 */
+		/* 50 */
+		FIELD_BANNED_USERS,
 		FIELD_BANNED_USER_MSG,
 		FIELD_MOTD_FILE,
 		FIELD_PRE_MOTD_FILE,
 		FIELD_POST_MOTD_FILE,
-		FIELD_LOG_FILE,
 
-		/* 30 */
+		/* 55 */
+		FIELD_LOG_FILE,
 		FIELD_LOG_FILE_RM,
 		FIELD_PWD_FILE,
+		FIELD_PWD_DB_FILE,
 		FIELD_IP_WHITELIST,
+
+		/* 60 */
 		FIELD_IP_BLACKLIST,
+		FIELD_IP_WHITELIST_FILE,
+		FIELD_IP_BLACKLIST_FILE,
 		FIELD_IP_BANNED_MSG,
+		FIELD_MAX_SESSIONS_MSG,
+
+		/* 65 */
+		FIELD_LOGIN_POOL_TERM,
+		FIELD_CGROUP_DIR,
+		FIELD_CPU_AFFINITY,
+		FIELD_LOG_LEVEL,
+		FIELD_CAPTURE_DIR,
+
+		/* 70 */
+		FIELD_CONTROL_SOCKET,
+		FIELD_RECORD_DIR,
+		FIELD_RECORD_FORMAT,
+		FIELD_RECORD_USERS,
+		FIELD_RECORD_INTERFACES,
 
 		NUM_PARAMS
 	};
@@ -249,43 +367,99 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 		"store_host_in_utmp",
 		"show_term_resize",
 		"ignore_sighup",
+		"capture_traced_only",
 
-		/* Numeric values */
+		/* 10 Numeric values */
 		"port",
-		/* 10 */
 		"telopt_timeout_secs",
 		"log_file_max_fails",
 		"login_max_attempts",
 		"login_timeout_secs",
+
+		/* 15 */
 		"login_pause_secs",
+		"telopt_env_max_vars",
+		"telopt_env_max_bytes",
+		"lockout_max_fails",
+		"lockout_decay_secs",
 
-		/* 15 String values */
+		/* 20 */
+		"lockout_table_size",
+		"conn_rate_ip",
+		"conn_rate_subnet",
+		"conn_rate_global",
+		"max_sessions",
+
+		/* 25 */
+		"max_iface_sessions",
+		"session_queue_size",
+		"session_queue_timeout_secs",
+		"pty_pool_size",
+		"login_pool_size",
+
+		/* 30 */
+		"session_cpu_weight",
+		"session_memory_max_mb",
+		"session_pids_max",
+		"dns_cache_size",
+		"dns_cache_ttl_secs",
+
+		/* 35 */
+		"dns_cache_neg_ttl_secs",
+		"dns_timeout_secs",
+		"log_limit_burst",
+		"log_limit_site_burst",
+		"log_limit_secs",
+
+		/* 40 */
+		"record_buffer_kb",
+
+		/* String values */
 		"network_interface",
 		"login_program",
 		"login_prompt",
 		"login_incorrect_msg",
+		/* 45 */
 		"login_max_attempts_msg",
-
-		/* 20 */
 		"login_svrerr_msg",
 		"login_timeout_msg",
 		"pwd_prompt",
 		"shell_program",
-		"banned_users",
 
-		/* 25 */
+		/* 50 */
+		"banned_users",
 		"banned_user_msg",
 		"motd_file",
 		"pre_motd_file",
 		"post_motd_file",
-		"log_file",
 
-		/* 30 */
+		/* 55 */
+		"log_file",
 		"log_file_rm",
 		"pwd_file",
+		"pwd_db_file",
 		"ip_whitelist",
+
+		/* 60 */
 		"ip_blacklist",
-		"banned_ip_msg"
+		"ip_whitelist_file",
+		"ip_blacklist_file",
+		"banned_ip_msg",
+		"max_sessions_msg",
+
+		/* 65 */
+		"login_pool_term",
+		"cgroup_dir",
+		"cpu_affinity",
+		"log_level",
+		"capture_dir",
+
+		/* 70 */
+		"control_socket",
+		"record_dir",
+		"record_format",
+		"record_users",
+		"record_interfaces"
 	};
 	char *param = words[0];
 	char *value = words[1];
@@ -315,7 +489,13 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 		{
 		case FIELD_IP_WHITELIST:
 		case FIELD_IP_BLACKLIST:
+		case FIELD_IP_WHITELIST_FILE:
+		case FIELD_IP_BLACKLIST_FILE:
 		case FIELD_NETWORK_INTERFACE:
+		case FIELD_RECORD_INTERFACES:
+		case FIELD_CONN_RATE_IP:
+		case FIELD_CONN_RATE_SUBNET:
+		case FIELD_CONN_RATE_GLOBAL:
 			break;
 		default:
 			if (word_cnt > 2)
@@ -381,6 +561,11 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 			flags.ignore_sighup = yes;
 			break;
 
+		case FIELD_CAPTURE_TRACED_ONLY:
+			if (yes == -1) goto VAL_ERROR;
+			flags.capture_traced_only = yes;
+			break;
+
 		/* Numeric values */
 		case FIELD_PORT:
 			/* Ignore if SIGHUP as it would mean closing the
@@ -425,6 +610,128 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 			login_pause_secs = ivalue;
 			break;
 
+		case FIELD_TELOPT_ENV_MAX_VARS:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			telopt_env_max_vars = ivalue;
+			break;
+
+		case FIELD_TELOPT_ENV_MAX_BYTES:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			telopt_env_max_bytes = ivalue;
+			break;
+
+		case FIELD_LOCKOUT_MAX_FAILS:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			lockout_max_fails = ivalue;
+			break;
+
+		case FIELD_LOCKOUT_DECAY_SECS:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			lockout_decay_secs = ivalue;
+			break;
+
+		case FIELD_LOCKOUT_TABLE_SIZE:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			lockout_table_size = ivalue;
+			break;
+
+		case FIELD_CONN_RATE_IP:
+			parseRateLimit(words,word_cnt,RATE_IP,linenum);
+			break;
+
+		case FIELD_CONN_RATE_SUBNET:
+			parseRateLimit(words,word_cnt,RATE_SUBNET,linenum);
+			break;
+
+		case FIELD_CONN_RATE_GLOBAL:
+			parseRateLimit(words,word_cnt,RATE_GLOBAL,linenum);
+			break;
+
+		case FIELD_MAX_SESSIONS:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			max_sessions = ivalue;
+			break;
+
+		case FIELD_MAX_IFACE_SESSIONS:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			max_iface_sessions = ivalue;
+			break;
+
+		case FIELD_SESSION_QUEUE_SIZE:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			session_queue_size = ivalue;
+			break;
+
+		case FIELD_SESSION_QUEUE_TIMEOUT_SECS:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			session_queue_timeout_secs = ivalue;
+			break;
+
+		case FIELD_PTY_POOL_SIZE:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			pty_pool_size = ivalue;
+			break;
+
+		case FIELD_LOGIN_POOL_SIZE:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			login_pool_size = ivalue;
+			break;
+
+		case FIELD_SESSION_CPU_WEIGHT:
+			if (!is_num || ivalue < 0 || ivalue > 10000) goto VAL_ERROR;
+			session_cpu_weight = ivalue;
+			break;
+
+		case FIELD_SESSION_MEMORY_MAX_MB:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			session_memory_max_mb = ivalue;
+			break;
+
+		case FIELD_SESSION_PIDS_MAX:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			session_pids_max = ivalue;
+			break;
+
+		case FIELD_DNS_CACHE_SIZE:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			dns_cache_size = ivalue;
+			break;
+
+		case FIELD_DNS_CACHE_TTL_SECS:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			dns_cache_ttl_secs = ivalue;
+			break;
+
+		case FIELD_DNS_CACHE_NEG_TTL_SECS:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			dns_cache_neg_ttl_secs = ivalue;
+			break;
+
+		case FIELD_DNS_TIMEOUT_SECS:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			dns_timeout_secs = ivalue;
+			break;
+
+		case FIELD_LOG_LIMIT_BURST:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			log_limit_burst = ivalue;
+			break;
+
+		case FIELD_LOG_LIMIT_SITE_BURST:
+			if (!is_num || ivalue < 0) goto VAL_ERROR;
+			log_limit_site_burst = ivalue;
+			break;
+
+		case FIELD_LOG_LIMIT_SECS:
+			if (!is_num || ivalue < 1) goto VAL_ERROR;
+			log_limit_secs = ivalue;
+			break;
+
+		case FIELD_RECORD_BUFFER_KB:
+			if (!is_num || ivalue < 4) goto VAL_ERROR;
+			record_buffer_kb = ivalue;
+			break;
+
 		/* String values */
 		case FIELD_NETWORK_INTERFACE:
 			if (flags.rx_sighup) goto IGNORE_WARNING;
@@ -516,13 +823,20 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 			parsePath(&pwd_file);
 			break;
 
+		case FIELD_PWD_DB_FILE:
+			SET_STR_FIELD(pwd_db_file);
+			parsePath(&pwd_db_file);
+			break;
+
 		case FIELD_IP_WHITELIST:
 			switch(iplist_type)
 			{
 			case IP_NO_LIST:
 				break;
 			case IP_WHITELIST:
-				goto ALREADY_SET_ERROR;
+				/* Could have been set by ip_whitelist_file */
+				if (iplist_cnt) goto ALREADY_SET_ERROR;
+				break;
 			case IP_BLACKLIST:
 				goto IPLIST_ERROR;
 			}
@@ -539,17 +853,91 @@ void processConfigParam(char **words, int word_cnt, int linenum)
 				case IP_WHITELIST:
 					goto IPLIST_ERROR;
 				case IP_BLACKLIST:
-					goto ALREADY_SET_ERROR;
+					if (iplist_cnt) goto ALREADY_SET_ERROR;
+					break;
 				}
 				iplist_type = IP_BLACKLIST;
 			}
 			parseIPList(words,word_cnt);
 			break;
 
+		/* The files can be used alongside the config list of the same
+		   type */
+		case FIELD_IP_WHITELIST_FILE:
+			if (iplist_type == IP_BLACKLIST) goto IPLIST_ERROR;
+			iplist_type = IP_WHITELIST;
+			parseIPListFiles(words,word_cnt);
+			break;
+
+		case FIELD_IP_BLACKLIST_FILE:
+			if (iplist_type == IP_WHITELIST) goto IPLIST_ERROR;
+			iplist_type = IP_BLACKLIST;
+			parseIPListFiles(words,word_cnt);
+			break;
+
 		case FIELD_IP_BANNED_MSG:
 			SET_STR_FIELD(banned_ip_msg);
 			break;
 
+		case FIELD_MAX_SESSIONS_MSG:
+			SET_STR_FIELD(max_sessions_msg);
+			break;
+
+		case FIELD_LOGIN_POOL_TERM:
+			SET_STR_FIELD(login_pool_term);
+			break;
+
+		case FIELD_CGROUP_DIR:
+			SET_STR_FIELD(cgroup_dir);
+			break;
+
+		case FIELD_CPU_AFFINITY:
+			if (affinity_cpus) goto ALREADY_SET_ERROR;
+			if (word_cnt != 2) goto VAL_ERROR;
+			parseCPUList(value,linenum);
+			break;
+
+		case FIELD_CAPTURE_DIR:
+			SET_STR_FIELD(capture_dir);
+			break;
+
+		case FIELD_CONTROL_SOCKET:
+			SET_STR_FIELD(control_socket);
+			break;
+
+		case FIELD_RECORD_DIR:
+			SET_STR_FIELD(record_dir);
+			break;
+
+		case FIELD_RECORD_FORMAT:
+			for(i=0;i < NUM_RECORD_FORMATS &&
+			        strcasecmp(value,record_format_name[i]);++i);
+			if (i == NUM_RECORD_FORMATS) goto VAL_ERROR;
+			record_format = i;
+			break;
+
+		case FIELD_RECORD_USERS:
+			if (record_users) goto ALREADY_SET_ERROR;
+			for(ptr=strtok(value,",");ptr;ptr=strtok(NULL,","))
+				addToList(&record_users,&record_users_cnt,ptr);
+			break;
+
+		case FIELD_RECORD_INTERFACES:
+			if (record_interfaces) goto ALREADY_SET_ERROR;
+			for(i=1;i < word_cnt;++i)
+			{
+				addToList(
+					&record_interfaces,&record_interfaces_cnt,words[i]);
+			}
+			break;
+
+		case FIELD_LOG_LEVEL:
+			for(i=0;i < NUM_LOG_LEVELS &&
+			        strcasecmp(value,log_level_name[i]);++i);
+			if (i == NUM_LOG_LEVELS) goto VAL_ERROR;
+			log_level = i;
+			break;
+
 		default:
 			assert(0);
 		}
@@ -702,12 +1090,110 @@ void parseIPList(char **words, int word_cnt)
 
 
 
+void parseIPListFiles(char **words, int word_cnt)
+{
+	int i;
+	for(i=1;i < word_cnt;++i) addToIPListFiles(words[i]);
+}
+
+
+
+
+/*** Format is: <connections per minute> [<burst>]. Burst defaults to the
+     per minute value. ***/
+void parseRateLimit(char **words, int word_cnt, int type, int linenum)
+{
+	int val[2];
+	char *ptr;
+	int i;
+
+	if (word_cnt > 3)
+	{
+		logprintf(0,"ERROR: Too many arguments (%d) for field.\n",word_cnt);
+		parentExit(-1);
+	}
+	for(i=0;i < word_cnt-1;++i)
+	{
+		for(ptr=words[i+1];*ptr && isdigit(*ptr);++ptr);
+		if (*ptr || (val[i] = atoi(words[i+1])) < (i ? 1 : 0))
+		{
+			logprintf(0,"ERROR: Invalid value \"%s\" on line %d.\n",
+				words[i+1],linenum);
+			parentExit(-1);
+		}
+	}
+	rate_limit[type].per_min = val[0];
+	rate_limit[type].burst = (word_cnt == 3 ? val[1] : val[0]);
+}
+
+
+
+
+/*** Parse a list of CPUs in the same format as taskset -c, eg "0-3,6".
+     Duplicates are dropped so the round robin stays even. ***/
+void parseCPUList(char *str, int linenum)
+{
+	char *ptr;
+	char *end;
+	int from;
+	int to;
+	int cpu;
+	int i;
+
+	for(ptr=str;*ptr;)
+	{
+		from = (int)strtol(ptr,&end,10);
+		if (end == ptr || !isdigit(*ptr)) goto ERROR;
+		to = from;
+		if (*end == '-')
+		{
+			ptr = end + 1;
+			to = (int)strtol(ptr,&end,10);
+			if (end == ptr || !isdigit(*ptr) || to < from) goto ERROR;
+		}
+		if (to >= CPU_SETSIZE || (*end && *end != ',')) goto ERROR;
+
+		for(cpu=from;cpu <= to;++cpu)
+		{
+			for(i=0;i < affinity_cpu_cnt && affinity_cpus[i] != cpu;++i);
+			if (i < affinity_cpu_cnt) continue;
+
+			affinity_cpus = (int *)realloc(
+				affinity_cpus,sizeof(int) * (affinity_cpu_cnt + 1));
+			assert(affinity_cpus);
+			affinity_cpus[affinity_cpu_cnt++] = cpu;
+		}
+		ptr = *end ? end + 1 : end;
+	}
+	if (affinity_cpu_cnt) return;
+
+	ERROR:
+	logprintf(0,"ERROR: Invalid CPU list \"%s\" on line %d.\n",str,linenum);
+	parentExit(-1);
+}
+
+
+
+
+void addToList(char ***list, int *cnt, char *str)
+{
+	*list = (char **)realloc(*list,(*cnt + 1) * sizeof(char *));
+	assert(*list);
+	(*list)[*cnt] = strdup(str);
+	assert((*list)[*cnt]);
+	++*cnt;
+}
+
+
+
+
 #define NOTSET    "<not set>\n"
 #define PRTSTR(S) (S ? S : "<not set>")
 #define YESNO(F)  (F ? "YES" : "NO")
 
 void printParams(void)
 {
+	char *rate_name[NUM_RATE_TYPES] = { "IP", "subnet", "global" };
 	int i;
 
 	/* Don't need parent id as we're doing short log lines */
@@ -717,8 +1203,36 @@ void printParams(void)
 	logprintf(0,"    Pre login MOTD file   : %s\n",PRTSTR(pre_motd_file));
 	logprintf(0,"    Post login MOTD file  : %s\n",PRTSTR(post_motd_file));
 	logprintf(0,"    Password file         : %s\n",PRTSTR(pwd_file));
+	logprintf(0,"    Password DB file      : %s\n",PRTSTR(pwd_db_file));
 	logprintf(0,"    Log file              : %s\n",PRTSTR(log_file));
 	logprintf(0,"    Log file max wrt fails: %d\n",log_file_max_fails);
+	logprintf(0,"    Log level             : %s%s\n",
+		log_level_name[log_level],
+		log_level > LOG_MAX_LEVEL ? " (not compiled in)" : "");
+	logprintf(0,"    Capture dir           : %s\n",PRTSTR(capture_dir));
+	logprintf(0,"    Capture traced only   : %s\n",YESNO(flags.capture_traced_only));
+	logprintf(0,"    Control socket        : %s\n",PRTSTR(control_socket));
+	logprintf(0,"    Record dir            : %s\n",PRTSTR(record_dir));
+	if (record_dir)
+	{
+		logprintf(0,"    Record format         : %s\n",
+			record_format_name[record_format]);
+		logprintf(0,"    Record buffer         : %dK\n",record_buffer_kb);
+		logprintf(0,"    Record users          : ");
+		for(i=0;i < record_users_cnt;++i)
+			logprintf(0,"%s ",record_users[i]);
+		logprintf(0,"\n    Record interfaces     : ");
+		for(i=0;i < record_interfaces_cnt;++i)
+			logprintf(0,"%s ",record_interfaces[i]);
+		logprintf(0,"\n");
+	}
+	logprintf(0,"    Log limit             : ");
+	if (log_limit_burst || log_limit_site_burst)
+	{
+		logprintf(0,"%d per key, %d per message in %d secs\n",
+			log_limit_burst,log_limit_site_burst,log_limit_secs);
+	}
+	else logprintf(0,"<off>\n");
 	logprintf(0,"    Network interfaces    : ");
 	for(i=0;i < num_interfaces;++i)
 	{
@@ -735,12 +1249,56 @@ void printParams(void)
 	logprintf(0,"\n");
 	logprintf(0,"    Port                  : %d\n",port);
 	logprintf(0,"    Telopt timeout        : %d secs\n",telopt_timeout_secs);
+	logprintf(0,"    Telopt env max vars   : %d\n",telopt_env_max_vars);
+	logprintf(0,"    Telopt env max bytes  : %d\n",telopt_env_max_bytes);
 	logprintf(0,"    Be daemon             : %s\n",YESNO(flags.daemon_tmp));
 	logprintf(0,"    Hexdump               : %s\n",YESNO(flags.hexdump));
 	logprintf(0,"    Do DNS lookup         : %s\n",YESNO(flags.dns_lookup));
+	if (flags.dns_lookup)
+	{
+		logprintf(0,"    DNS timeout           : %d secs\n",
+			dns_timeout_secs);
+		logprintf(0,"    DNS cache size        : %d\n",dns_cache_size);
+		logprintf(0,"    DNS cache TTL         : %d secs\n",
+			dns_cache_ttl_secs);
+		logprintf(0,"    DNS cache negative TTL: %d secs\n",
+			dns_cache_neg_ttl_secs);
+	}
 	logprintf(0,"    Ignore SIGHUP         : %s\n",YESNO(flags.ignore_sighup));
+	for(i=0;i < NUM_RATE_TYPES;++i)
+	{
+		logprintf(0,"    Conn rate %-6s      : ",rate_name[i]);
+		if (rate_limit[i].per_min)
+		{
+			logprintf(0,"%d/min, burst %d\n",
+				rate_limit[i].per_min,rate_limit[i].burst);
+		}
+		else logprintf(0,"<off>\n");
+	}
+	logprintf(0,"    Max sessions          : %d\n",max_sessions);
+	logprintf(0,"    Max iface sessions    : %d\n",max_iface_sessions);
+	logprintf(0,"    Session queue size    : %d\n",session_queue_size);
+	logprintf(0,"    Session queue timeout : %d secs\n",
+		session_queue_timeout_secs);
+	logprintf(0,"    PTY pool size         : %d\n",pty_pool_size);
+	logprintf(0,"    Session cgroup dir    : %s\n",PRTSTR(cgroup_dir));
+	logprintf(0,"    Session CPU weight    : %d\n",session_cpu_weight);
+	logprintf(0,"    Session memory max    : %d MB\n",session_memory_max_mb);
+	logprintf(0,"    Session pids max      : %d\n",session_pids_max);
+	logprintf(0,"    Session CPUs          : ");
+	if (affinity_cpu_cnt)
+	{
+		for(i=0;i < affinity_cpu_cnt;++i)
+			logprintf(0,"%s%d",i ? "," : "",affinity_cpus[i]);
+		logprintf(0," (round robin)\n");
+	}
+	else logprintf(0,"<any>\n");
 	if (!shell_exec_argv)
+	{
 		logprintf(0,"    Login append user     : %s\n",YESNO(flags.append_user));
+		logprintf(0,"    Login pool size       : %d (TERM = %s)\n",
+			login_pool_size,login_pool_term);
+	}
 
 	if (login_exec_argv)
 	{
@@ -795,6 +1353,13 @@ void printParams(void)
 	logprintf(0,"    Login timeout message : \"%s\"\n",login_timeout_msg);
 	logprintf(0,"    Login timeout         : %d secs\n",login_timeout_secs);
 	logprintf(0,"    Login pause           : %d secs\n",login_pause_secs);
+	logprintf(0,"    Lockout max fails     : ");
+	if (lockout_max_fails)
+	{
+		logprintf(0,"%d (decay %d secs, table size %d)\n",
+			lockout_max_fails,lockout_decay_secs,lockout_table_size);
+	}
+	else logprintf(0,"<off>\n");
 	logprintf(0,"    Banned users          : ");
 	if (banned_users_cnt)
 	{
@@ -819,6 +1384,17 @@ void printParams(void)
 		logprintf(0,"\n");
 	}
 	else logprintf(0,"<none>\n");
+	logprintf(0,"    Banned IP files       : ");
+	if (iplist_files_cnt)
+	{
+		for(i=0;i < iplist_files_cnt;++i)
+		{
+			if (i) logprintf(0,", ");
+			logprintf(0,"%s",iplist_files[i]);
+		}
+		logprintf(0,"\n");
+	}
+	else logprintf(0,"<none>\n");
 
 	logprintf(0,"    Banned IP message     : ");
 	if (banned_ip_msg)
@@ -0,0 +1,359 @@
+/*****************************************************************************
+ Reverse DNS lookups with a cache in shared memory created by the parent so
+ every master process can use the results of the others. The cache is set
+ associative: an address hashes to a set of DNS_CACHE_WAYS entries and when
+ the set is full the least recently used entry is replaced. Failed lookups
+ are cached too but for a shorter time (dns_cache_neg_ttl_secs) so a broken
+ resolver doesn't cost every connection the full timeout.
+
+ On a cache miss the lookup is done by a short lived resolver child which
+ writes the name down a pipe. The master carries on with the telopt
+ negotiation and MOTD meanwhile and only waits for the result, for at most
+ dns_timeout_secs, when it's about to need it.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define DNS_CACHE_WAYS 4
+#define DNS_NAME_LEN   256
+
+struct st_dns_entry
+{
+	uint32_t ip;
+	int found;
+	time_t expires;
+	u_long last_used;
+	char name[DNS_NAME_LEN];
+};
+
+struct st_dns_cache
+{
+	volatile pid_t lock;
+	int sets;
+	u_long tick;
+	u_long hits;
+	u_long misses;
+	struct st_dns_entry entry[1];
+};
+
+static struct st_dns_cache *cache = NULL;
+static size_t cache_bytes = 0;
+static struct in_addr lookup_addr;
+static struct timeval lookup_start;
+static pid_t resolver_pid = -1;
+static int resolver_fd = -1;
+
+static void dnsResolve(struct in_addr addr, int fd);
+static int  cacheLookup(struct in_addr addr);
+static struct st_dns_entry *findEntry(uint32_t ip, time_t now);
+static void storeEntry(uint32_t ip, char *name, time_t now);
+static void readResolver(void);
+static void endResolver(char *name);
+static double elapsed(void);
+
+
+/*** Called by the parent after the config has been read. As with the
+     lockout table the cache is kept over a restart if the size hasn't
+     changed. ***/
+void initDNSCache(void)
+{
+	size_t bytes;
+	int sets;
+
+	sets = (dns_cache_size + DNS_CACHE_WAYS - 1) / DNS_CACHE_WAYS;
+	if (!flags.dns_lookup || !sets)
+	{
+		if (cache)
+		{
+			munmap(cache,cache_bytes);
+			cache = NULL;
+		}
+		return;
+	}
+	if (cache && cache->sets == sets) return;
+	if (cache) munmap(cache,cache_bytes);
+
+	bytes = sizeof(struct st_dns_cache) +
+	        sizeof(struct st_dns_entry) * (sets * DNS_CACHE_WAYS - 1);
+	if (!(cache = (struct st_dns_cache *)mapSharedMem(bytes)))
+	{
+		logprintf(0,"WARNING: DNS cache disabled.\n");
+		return;
+	}
+	cache_bytes = bytes;
+	cache->sets = sets;
+}
+
+
+
+
+/*** Called by the parent for the control socket list command. Returns 0 if
+     there's no cache. ***/
+int getDNSCacheStats(u_long *hits, u_long *misses)
+{
+	if (!cache) return 0;
+	shmLock(&cache->lock);
+	*hits = cache->hits;
+	*misses = cache->misses;
+	shmUnlock(&cache->lock);
+	return 1;
+}
+
+
+
+
+/*** Called by the master. Sets dnsaddr straight away if the address is in
+     the cache else starts a resolver process. SIGCHLD must not have a
+     handler set by now or it'll interrupt the master's select(). ***/
+void startDNSLookup(struct in_addr addr)
+{
+	int fd[2];
+
+	lookup_addr = addr;
+	gettimeofday(&lookup_start,NULL);
+	if (cacheLookup(addr)) return;
+
+	if (pipe(fd) == -1)
+	{
+		logprintf(master_pid,"ERROR: startDNSLookup(): pipe(): %s\n",
+			strerror(errno));
+		return;
+	}
+	fcntl(fd[0],F_SETFD,FD_CLOEXEC);
+	switch((resolver_pid = fork()))
+	{
+	case -1:
+		logprintf(master_pid,"ERROR: startDNSLookup(): fork(): %s\n",
+			strerror(errno));
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	case 0:
+		/* Resolver process. Don't hold the connection open if the
+		   master exits first. */
+		close(fd[0]);
+		close(sock);
+		if (ptym != -1) close(ptym);
+		dnsResolve(addr,fd[1]);
+		_exit(0);
+	}
+	close(fd[1]);
+	resolver_fd = fd[0];
+}
+
+
+
+
+/*** In the resolver process. Writes the name, or nothing if there isn't
+     one. ***/
+void dnsResolve(struct in_addr addr, int fd)
+{
+	struct hostent *host;
+
+	host = gethostbyaddr((char *)&addr.s_addr,sizeof(addr.s_addr),AF_INET);
+	if (host) write(fd,host->h_name,strlen(host->h_name));
+}
+
+
+
+
+void setDNSMask(fd_set *mask)
+{
+	if (resolver_fd != -1) FD_SET(resolver_fd,mask);
+}
+
+
+
+
+/*** Call after select() in the master ***/
+void checkDNS(fd_set *mask)
+{
+	if (resolver_fd == -1) return;
+	if (FD_ISSET(resolver_fd,mask))
+		readResolver();
+	else if (elapsed() >= dns_timeout_secs)
+		endResolver(NULL);
+}
+
+
+
+
+/*** Block until the lookup finishes or times out ***/
+void waitDNS(void)
+{
+	struct timeval tv;
+	fd_set mask;
+	double left;
+
+	while(resolver_fd != -1)
+	{
+		if ((left = dns_timeout_secs - elapsed()) <= 0)
+		{
+			endResolver(NULL);
+			return;
+		}
+		tv.tv_sec = (int)left;
+		tv.tv_usec = (int)((left - tv.tv_sec) * 1000000);
+
+		FD_ZERO(&mask);
+		FD_SET(resolver_fd,&mask);
+		if (select(FD_SETSIZE,&mask,0,0,&tv) == -1 && errno != EINTR)
+		{
+			logprintf(master_pid,"ERROR: waitDNS(): select(): %s\n",
+				strerror(errno));
+			endResolver(NULL);
+			return;
+		}
+		checkDNS(&mask);
+	}
+}
+
+
+
+
+/*** Returns 1 and sets dnsaddr if the address is in the cache ***/
+int cacheLookup(struct in_addr addr)
+{
+	struct st_dns_entry *entry;
+	time_t now;
+	u_long hits;
+	u_long misses;
+	int found = 0;
+
+	if (!cache) return 0;
+
+	time(&now);
+	shmLock(&cache->lock);
+	if ((entry = findEntry(addr.s_addr,now)))
+	{
+		found = 1;
+		if (entry->found) dnsaddr = strdup(entry->name);
+		entry->last_used = ++cache->tick;
+		++cache->hits;
+	}
+	else ++cache->misses;
+	hits = cache->hits;
+	misses = cache->misses;
+	shmUnlock(&cache->lock);
+
+	LOGPRINTF(LOG_DEBUG,master_pid,"DNS: Cache %s. Hits = %lu, misses = %lu\n",
+		found ? "hit" : "miss",hits,misses);
+	if (found)
+	{
+		logprintf(master_pid,"DNS name = %s\n",
+			dnsaddr ? dnsaddr : "<not found>");
+	}
+	return found;
+}
+
+
+
+
+/*** Returns the unexpired entry for the address. Must be called with the
+     lock held. ***/
+struct st_dns_entry *findEntry(uint32_t ip, time_t now)
+{
+	struct st_dns_entry *entry;
+	int i;
+
+	entry = &cache->entry[(ntohl(ip) % cache->sets) * DNS_CACHE_WAYS];
+	for(i=0;i < DNS_CACHE_WAYS;++i,++entry)
+	{
+		if (entry->last_used && entry->ip == ip && entry->expires > now)
+			return entry;
+	}
+	return NULL;
+}
+
+
+
+
+/*** Replace the same address if it's there, else an empty or expired entry,
+     else the least recently used one ***/
+void storeEntry(uint32_t ip, char *name, time_t now)
+{
+	struct st_dns_entry *entry;
+	struct st_dns_entry *victim;
+	int i;
+
+	shmLock(&cache->lock);
+	entry = &cache->entry[(ntohl(ip) % cache->sets) * DNS_CACHE_WAYS];
+	for(i=0,victim=NULL;i < DNS_CACHE_WAYS;++i,++entry)
+	{
+		if (entry->last_used && entry->ip == ip)
+		{
+			victim = entry;
+			break;
+		}
+		if (!victim ||
+		    (victim->last_used && victim->expires > now &&
+		     (!entry->last_used || entry->expires <= now ||
+		      entry->last_used < victim->last_used)))
+		{
+			victim = entry;
+		}
+	}
+	victim->ip = ip;
+	victim->found = (name != NULL);
+	victim->expires = now +
+		(name ? dns_cache_ttl_secs : dns_cache_neg_ttl_secs);
+	victim->last_used = ++cache->tick;
+	snprintf(victim->name,DNS_NAME_LEN,"%s",name ? name : "");
+	shmUnlock(&cache->lock);
+}
+
+
+
+
+void readResolver(void)
+{
+	char name[DNS_NAME_LEN];
+	int len;
+
+	if ((len = read(resolver_fd,name,sizeof(name) - 1)) == -1)
+	{
+		if (errno == EINTR) return;
+		len = 0;
+	}
+	name[len] = 0;
+	endResolver(len ? name : NULL);
+}
+
+
+
+
+/*** A NULL name means the lookup failed or timed out ***/
+void endResolver(char *name)
+{
+	int status;
+
+	if (name)
+		dnsaddr = strdup(name);
+	else if (elapsed() >= dns_timeout_secs)
+	{
+		logprintf(master_pid,"WARNING: DNS lookup timed out after %d secs.\n",
+			dns_timeout_secs);
+	}
+	logprintf(master_pid,"DNS name = %s (%.3f secs)\n",
+		dnsaddr ? dnsaddr : "<not found>",elapsed());
+
+	close(resolver_fd);
+	resolver_fd = -1;
+	kill(resolver_pid,SIGKILL);
+	waitpid(resolver_pid,&status,0);
+	resolver_pid = -1;
+
+	/* Cache timeouts too so the next connection doesn't wait as well */
+	if (cache) storeEntry(lookup_addr.s_addr,name,time(0));
+}
+
+
+
+
+double elapsed(void)
+{
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	return (now.tv_sec - lookup_start.tv_sec) +
+	       (double)(now.tv_usec - lookup_start.tv_usec) / 1000000;
+}
@@ -22,14 +22,18 @@
 #endif
 #include <errno.h>
 #include <assert.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 #include <sys/file.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -38,7 +42,7 @@
 #include "build_date.h"
 
 #define SVR_NAME    "NRJ-TelnetD"
-#define SVR_VERSION "20240906"
+#define SVR_VERSION "20261019"
 
 #define PORT                23
 #define BUFFSIZE            2000
@@ -48,9 +52,35 @@
 #define TELOPT_TIMEOUT_SECS 2
 #define LOG_FILE_MAX_FAILS  2
 #define MAX_INTERFACES      256 /* Don't know system limit but can't be more */
+#define ENV_MAX_VARS        32
+#define ENV_MAX_BYTES       4096
+#define LOCKOUT_MAX_FAILS   0
+#define LOCKOUT_DECAY_SECS  60
+#define LOCKOUT_TABLE_SIZE  4096
+#define MAX_SESSIONS        0
+#define MAX_IFACE_SESSIONS  0
+#define SESSION_QUEUE_SIZE  0
+#define SESSION_QUEUE_TIMEOUT_SECS 60
+#define DNS_CACHE_SIZE      1024
+#define DNS_CACHE_TTL_SECS  3600
+#define DNS_CACHE_NEG_TTL_SECS 60
+#define DNS_TIMEOUT_SECS    5
+#define PTY_POOL_SIZE       4
+#define LOGIN_POOL_SIZE     0
+#define SESSION_CPU_WEIGHT  0
+#define SESSION_MEMORY_MAX_MB 0
+#define SESSION_PIDS_MAX    0
+#define LOG_LEVEL           LOG_INFO
+#define LOG_LIMIT_BURST     10
+#define LOG_LIMIT_SITE_BURST 100
+#define LOG_LIMIT_SECS      60
+#define RECORD_BUFFER_KB    1024
 
 #define FREE(M) if (M) free(M)
 
+/* For constant strings, they have to have their \r\n already */
+#define SOCKSTR(S) writeSock((u_char *)(S),sizeof(S) - 1)
+
 #ifdef __APPLE__
 #define LOGIN_PROG "/usr/bin/login"
 #else
@@ -103,7 +133,7 @@ enum
 	PWD_USER,
 	PWD_EPWD,
 	PWD_MAX_ATTEMPTS,
-	PWD_RESERVED,
+	PWD_LIMITS,
 	PWD_EXEC_STR,
 
 	NUM_PWD_FIELDS
@@ -116,6 +146,92 @@ enum
 	IP_BLACKLIST
 };
 
+enum
+{
+	RATE_IP,
+	RATE_SUBNET,
+	RATE_GLOBAL,
+
+	NUM_RATE_TYPES
+};
+
+enum
+{
+	MOTD_PRE,
+	MOTD_POST,
+
+	NUM_MOTDS
+};
+
+enum
+{
+	RECORD_ASCIICAST,
+	RECORD_TTYREC,
+
+	NUM_RECORD_FORMATS
+};
+
+/* The configured prompts and messages, rendered with their CRLFs by
+   renderMessages() */
+enum
+{
+	MSG_LOGIN_PROMPT,
+	MSG_PWD_PROMPT,
+	MSG_LOGIN_INCORRECT,
+	MSG_LOGIN_MAX_ATTEMPTS,
+	MSG_LOGIN_SVRERR,
+	MSG_LOGIN_TIMEOUT,
+	MSG_BANNED_USER,
+	MSG_BANNED_IP,
+	MSG_MAX_SESSIONS,
+
+	NUM_MSGS
+};
+
+/* logprintf() works out error and warn from the "ERROR:" or "WARNING:" in
+   the format, everything else it logs is info. Debug and trace are only
+   logged through LOGPRINTF(). */
+enum
+{
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+	LOG_TRACE,
+
+	NUM_LOG_LEVELS
+};
+
+/* Build with -DLOG_MAX_LEVEL=LOG_INFO to compile out debug and trace */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_TRACE
+#endif
+
+/* The arguments aren't evaluated unless the level is being logged so they
+   must never have side effects */
+#define LOGON(L) ((L) <= LOG_MAX_LEVEL && (L) <= log_level)
+#define LOGPRINTF(L,PID,...) \
+	do { if (LOGON(L)) logprintf(PID,__VA_ARGS__); } while(0)
+
+/* Filled in by the master for the slave to apply before it execs */
+struct st_limits
+{
+	int cgroup_fd;
+	int set_as;
+	int set_nproc;
+	int set_nice;
+	struct rlimit as;
+	struct rlimit nproc;
+	int nice;
+};
+
+/* Zero means an unused lockout entry */
+enum
+{
+	LOCKOUT_IP = 1,
+	LOCKOUT_USER
+};
+
 
 struct st_flags
 {
@@ -132,16 +248,40 @@ struct st_flags
 	unsigned store_host_in_utmp : 1;
 	unsigned show_term_resize   : 1;
 	unsigned ignore_sighup      : 1;
+	unsigned capture_traced_only: 1;
 	unsigned version            : 1;
 
 	/* Runtime */
 	unsigned echo      : 1;
+	unsigned capture   : 1;
+	unsigned record    : 1;
 	unsigned rx_sighup : 1;
 	unsigned rx_ttype  : 1;
 	unsigned rx_env    : 1;
 };
 
 
+struct st_wire_msg
+{
+	u_char *data;
+	int len;
+};
+
+
+struct st_pwd_entry
+{
+	char *field[NUM_PWD_FIELDS];
+	int linenum;
+};
+
+
+struct st_rate_limit
+{
+	int per_min;
+	int burst;
+};
+
+
 struct st_interface
 {
 	char *name;
@@ -150,6 +290,7 @@ struct st_interface
 };
 
 EXTERN struct st_interface iface[MAX_INTERFACES];
+EXTERN struct st_rate_limit rate_limit[NUM_RATE_TYPES];
 
 /* Config file */
 EXTERN char *config_file;
@@ -159,6 +300,7 @@ EXTERN char *pre_motd_file;
 EXTERN char *post_motd_file;
 EXTERN char *log_file;
 EXTERN char *pwd_file;
+EXTERN char *pwd_db_file;
 EXTERN char **banned_users;
 EXTERN char *banned_user_msg;
 EXTERN char *banned_ip_msg;
@@ -168,22 +310,61 @@ EXTERN char *login_incorrect_msg;
 EXTERN char *login_max_attempts_msg;
 EXTERN char *login_svrerr_msg;
 EXTERN char *login_timeout_msg;
+EXTERN char *max_sessions_msg;
+EXTERN char *login_pool_term;
+EXTERN char *cgroup_dir;
+EXTERN char *capture_dir;
+EXTERN char *control_socket;
+EXTERN char *record_dir;
+EXTERN char **record_users;
+EXTERN char **record_interfaces;
 EXTERN char **iplist;
+EXTERN char **iplist_files;
 EXTERN int shell_exec_argv_cnt;
 EXTERN int login_exec_argv_cnt;
 EXTERN int login_max_attempts;
 EXTERN int login_pause_secs;
 EXTERN int login_timeout_secs;
 EXTERN int banned_users_cnt;
+EXTERN int record_users_cnt;
+EXTERN int record_interfaces_cnt;
+EXTERN int record_format;
+EXTERN int record_buffer_kb;
 EXTERN int telopt_timeout_secs;
+EXTERN int telopt_env_max_vars;
+EXTERN int telopt_env_max_bytes;
+EXTERN int lockout_max_fails;
+EXTERN int lockout_decay_secs;
+EXTERN int lockout_table_size;
+EXTERN int max_sessions;
+EXTERN int max_iface_sessions;
+EXTERN int session_queue_size;
+EXTERN int session_queue_timeout_secs;
+EXTERN int dns_cache_size;
+EXTERN int dns_cache_ttl_secs;
+EXTERN int dns_cache_neg_ttl_secs;
+EXTERN int dns_timeout_secs;
+EXTERN int pty_pool_size;
+EXTERN int login_pool_size;
+EXTERN int log_level;
+EXTERN int log_limit_burst;
+EXTERN int log_limit_site_burst;
+EXTERN int log_limit_secs;
+EXTERN int session_cpu_weight;
+EXTERN int session_memory_max_mb;
+EXTERN int session_pids_max;
+EXTERN int *affinity_cpus;
+EXTERN int affinity_cpu_cnt;
 EXTERN int log_file_max_fails;
 EXTERN int port;
 EXTERN int iplist_cnt;
+EXTERN int iplist_files_cnt;
 EXTERN int iplist_type;
 EXTERN int num_interfaces;
 
 /* General */
 EXTERN struct st_flags flags;
+EXTERN struct st_wire_msg wire_msg[NUM_MSGS];
 EXTERN pid_t parent_pid;
 EXTERN u_char buff[BUFFSIZE+1];
 EXTERN u_char line[BUFFSIZE+1];
@@ -199,7 +380,6 @@ EXTERN int sock;
 
 /* Child */
 EXTERN struct passwd *userinfo;
-EXTERN sigset_t usr1_sigmask;
 EXTERN pid_t master_pid;
 EXTERN pid_t slave_pid;
 EXTERN char *telopt_username;
@@ -208,7 +388,6 @@ EXTERN int line_buffpos;
 EXTERN int attempts;
 EXTERN int state;
 EXTERN int ptym;
-EXTERN int ptys;
 
 /* config.c */
 void parseConfigFile(void);
@@ -223,24 +402,39 @@ void masterExit(int code);
 
 /* slave_child.c */
 void runSlave(void);
+void fillLoginPool(void);
+int  takePooledLogin(void);
+void forkedLoginPool(pid_t pid);
+void loginPoolExited(pid_t pid);
+void freeLoginPool(void);
 void notifyWinSize(void);
 
 /* pty.c */
+void fillPTYPool(void);
+void takePooledPTY(void);
+void forkedPTYPool(pid_t pid);
+void freePTYPool(void);
 int  openPTYMaster(void);
-int  openPTYSlave(void);
+int  deferPTY(void);
+int  newPTY(pid_t pid, char *func);
 char *getPTYName(void);
 
 /* network.c */
 void createListenSocket(int inum);
 void readSock(void);
 void writeSock(u_char *data, int len);
+void writeSockv(struct iovec *iov, int iov_cnt);
 
 /* validate.c */
 int validatePwd(char *password);
 
 /* printf.c */
 void sockprintf(char *fmt, ...);
+void renderMessages(void);
+void freeMessages(void);
+void sendMsg(int msg);
 void logprintf(pid_t pid, char *fmt, ...);
+void vlogprintf(pid_t pid, char *fmt, va_list args);
 
 /* telopt.c */
 void sendInitialTelopt(void);
@@ -254,12 +448,110 @@ char *splitPwdLine(char *line, char *map_end, char **field);
 
 /* iplist.c */
 void addToIPList(char *addrstr);
+void addToIPListFiles(char *path);
+void compileIPList(void);
+void freeIPList(void);
+void reloadIPFiles(void);
+int  iplistHasDNS(void);
 int  authorisedIP(char *addrstr);
 
+/* arena.c */
+void   initArena(void);
+char  *arenaSetEnv(char *name, char *value);
+char  *arenaGetEnv(char *name);
+void   arenaUnsetEnv(char *name);
+int    arenaEnvCount(void);
+char **arenaEnvArray(void);
+
+/* pwdb.c */
+int  loadPwdDB(void);
+void freePwdDB(void);
+void reloadPwdDB(void);
+int  pwdDBLoaded(void);
+struct st_pwd_entry *findPwdEntry(char *uname);
+
+/* watch.c */
+void addWatch(char *path, void (*func)(void));
+void clearWatches(void);
+void setWatchMask(fd_set *mask, struct timeval *tv, struct timeval **tvp);
+void checkWatches(fd_set *mask);
+
+/* lockout.c */
+void initLockout(void);
+int  lockedOut(int type, char *key);
+void addLoginFail(int type, char *key);
+void clearLoginFails(int type, char *key);
+
+/* ratelimit.c */
+void initRateLimits(void);
+int  rateLimited(struct in_addr addr, int exempt);
+
+/* session.c */
+void admitConnection(int inum, struct sockaddr_in *ip_addr);
+void setSessionMask(fd_set *mask, struct timeval *tv, struct timeval **tvp);
+void checkSessions(fd_set *mask);
+void pinSessionCPU(pid_t pid);
+void signalSessions(int sig);
+
+/* dns.c */
+void initDNSCache(void);
+int  getDNSCacheStats(u_long *hits, u_long *misses);
+void startDNSLookup(struct in_addr addr);
+void setDNSMask(fd_set *mask);
+void checkDNS(fd_set *mask);
+void waitDNS(void);
+
+/* logring.c */
+void startLogWriter(void);
+void stopLogWriter(void);
+int  logWriterExited(pid_t pid, int status);
+int  logRingWrite(pid_t pid, char *str, int len);
+
+/* loglimit.c */
+void logprintfLimit(char *key, pid_t pid, char *fmt, ...);
+void flushLogLimits(int force);
+void clearLogLimits(void);
+void setLogLimitTimeout(struct timeval *tv, struct timeval **tvp);
+
+/* capture.c */
+void startCapture(struct sockaddr_in *ip_addr);
+void captureData(u_char *data, int len, int type);
+void setCaptureTimeout(struct timeval *tv, struct timeval **tvp);
+void checkCapture(void);
+void endCapture(void);
+
+/* trace.c */
+void initTrace(void);
+void closeControlSocket(void);
+void setControlMask(fd_set *mask);
+void checkControl(fd_set *mask);
+void traceSigHandler(int sig);
+void startTrace(struct sockaddr_in *ip_addr);
+void recheckTrace(void);
+void checkTrace(void);
+
+/* record.c */
+void startRecording(void);
+void recordData(u_char *data, int len);
+void recordResize(void);
+void endRecording(void);
+
+/* cgroup.c */
+void initCgroups(void);
+int  parseUserLimits(char *str, int linenum);
+void prepareSessionLimits(struct st_limits *lim);
+void endSessionCgroup(void);
+
 /* motd.c */
-void sendMOTD(char *file);
+void loadMOTDs(void);
+void freeMOTDs(void);
+void sendMOTD(int which);
+int  motdUsesPTY(int which);
 
 /* misc.c */
-void setState(int st);
-void parsePath(char **path);
-void parentExit(int code);
+void  setState(int st);
+void  parsePath(char **path);
+void *mapSharedMem(size_t size);
+void  shmLock(volatile pid_t *lock);
+void  shmUnlock(volatile pid_t *lock);
+void  parentExit(int code);
@@ -1,21 +1,65 @@
+/*****************************************************************************
+ IP and DNS white/blacklists. Wildcard patterns are compiled into one
+ matcher. Plain IP addresses and CIDR blocks, from the config file or from
+ the list files, are stored as sorted arrays of merged address ranges so a
+ lookup is a binary search, ie at most 32 steps however big the lists are.
+ Each list file has its own array so when one changes only it is reloaded.
+ *****************************************************************************/
+
 #include "globals.h"
+#include "wildcard.h"
+
+struct st_ip_range
+{
+	uint32_t from;
+	uint32_t to;
+};
+
+/* Source 0 is the config file entries, the rest are the list files */
+struct st_ip_source
+{
+	char *path;
+	struct st_ip_range *ranges;
+	int range_cnt;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+};
+
+/* All the list patterns compiled into one matcher by compileIPList() */
+static struct st_wildcard *iplist_wc = NULL;
+static struct st_ip_source *sources = NULL;
+static int source_cnt = 0;
+static int dns_pattern_cnt = 0;
+
+static int  parseIPRange(char *str, char *end, struct st_ip_range *range);
+static void addRange(struct st_ip_source *src, struct st_ip_range *range, int *alloc);
+static void mergeRanges(struct st_ip_source *src);
+static int  loadIPFile(struct st_ip_source *src);
+static int  inRanges(struct st_ip_source *src, uint32_t ip);
+static int  cmpRange(const void *a, const void *b);
 
-static int wildMatch(const char *str, const char *pat);
 
 void addToIPList(char *addrstr)
 {
+	struct st_ip_range range;
 	char *ptr;
 	char *end;
 	char prev_c;
 	char c;
 	int cnt;
 
-	if ((int)inet_addr(addrstr) == -1)
+	if (strchr(addrstr,'/'))
+	{
+		if (!parseIPRange(addrstr,addrstr + strlen(addrstr),&range))
+			goto INVALID;
+	}
+	else if ((int)inet_addr(addrstr) == -1)
 	{
 		end = addrstr + strlen(addrstr) - 1;
 		prev_c = 0;
 
-		/* Check for invalid characters and some other errors. This 
+		/* Check for invalid characters and some other errors. This
 		   isn't a fullproof validator */
 		for(ptr=addrstr,cnt=0;*ptr;++ptr)
 		{
@@ -31,7 +75,7 @@ void addToIPList(char *addrstr)
 				    ptr == end || ++cnt > 3) goto INVALID;
 				break;
 			default:
-				if ((c < 'a' || c > 'z') && 
+				if ((c < 'a' || c > 'z') &&
 				    (c < '0' || c > '9') && c != '-')
 				{
 					goto INVALID;
@@ -40,7 +84,7 @@ void addToIPList(char *addrstr)
 			prev_c = c;
 		}
 	}
-	
+
 	/* There won't be many so don't need to preallocate for efficiency */
 	iplist = (char **)realloc(iplist,sizeof(char *) * ++iplist_cnt);
 	assert(iplist);
@@ -54,19 +98,139 @@ void addToIPList(char *addrstr)
 
 
 
+
+void addToIPListFiles(char *path)
+{
+	iplist_files = (char **)realloc(
+		iplist_files,sizeof(char *) * ++iplist_files_cnt);
+	assert(iplist_files);
+	iplist_files[iplist_files_cnt-1] = strdup(path);
+	parsePath(&iplist_files[iplist_files_cnt-1]);
+}
+
+
+
+
+/*** Called by the parent once the config has been read. Splits the config
+     entries into addresses and patterns, compiles the patterns and loads
+     the list files. The children inherit all of it. ***/
+void compileIPList(void)
+{
+	struct st_ip_range range;
+	char **pats;
+	int pat_cnt;
+	int alloc;
+	int i;
+
+	freeIPList();
+	if (!iplist_cnt && !iplist_files_cnt) return;
+
+	source_cnt = iplist_files_cnt + 1;
+	sources = (struct st_ip_source *)calloc(
+		source_cnt,sizeof(struct st_ip_source));
+	assert(sources);
+
+	pats = (char **)malloc(sizeof(char *) * (iplist_cnt + 1));
+	assert(pats);
+	for(i=pat_cnt=alloc=0;i < iplist_cnt;++i)
+	{
+		if (parseIPRange(iplist[i],iplist[i] + strlen(iplist[i]),&range))
+			addRange(&sources[0],&range,&alloc);
+		else
+		{
+			pats[pat_cnt++] = iplist[i];
+
+			/* Only a pattern with a letter or a wildcard in can
+			   match a DNS name, eg "1*" matches 1e100.net */
+			if (strpbrk(iplist[i],"abcdefghijklmnopqrstuvwxyz"
+			                      "ABCDEFGHIJKLMNOPQRSTUVWXYZ*?"))
+			{
+				++dns_pattern_cnt;
+			}
+		}
+	}
+	mergeRanges(&sources[0]);
+	iplist_wc = compileWildcards(pats,pat_cnt);
+	free(pats);
+
+	for(i=1;i < source_cnt;++i)
+	{
+		sources[i].path = iplist_files[i-1];
+		loadIPFile(&sources[i]);
+		addWatch(sources[i].path,reloadIPFiles);
+	}
+}
+
+
+
+
+void freeIPList(void)
+{
+	int i;
+
+	freeWildcards(iplist_wc);
+	iplist_wc = NULL;
+
+	for(i=0;i < source_cnt;++i) FREE(sources[i].ranges);
+	FREE(sources);
+	sources = NULL;
+	source_cnt = 0;
+	dns_pattern_cnt = 0;
+}
+
+
+
+
+/*** Returns 1 if a DNS name could match the list so it's worth looking it
+     up ***/
+int iplistHasDNS(void)
+{
+	return (dns_pattern_cnt > 0);
+}
+
+
+
+
+/*** Watch callback. Only reloads the files that have changed. ***/
+void reloadIPFiles(void)
+{
+	struct stat fs;
+	int i;
+
+	for(i=1;i < source_cnt;++i)
+	{
+		if (stat(sources[i].path,&fs) == -1 ||
+		    (fs.st_ino == sources[i].ino &&
+		     fs.st_size == sources[i].size &&
+		     fs.st_mtime == sources[i].mtime)) continue;
+		loadIPFile(&sources[i]);
+	}
+}
+
+
+
+
+/*** Checks the address against the ranges then the patterns ***/
 int authorisedIP(char *addrstr)
 {
+	struct in_addr addr;
+	uint32_t ip;
 	int i;
 
 	/* If no list then no restrictions */
-	if (!iplist_cnt) return 1;
+	if (!source_cnt) return 1;
 
-	/* Find match in list */
-	for(i=0;i < iplist_cnt;++i)
+	if (inet_aton(addrstr,&addr))
 	{
-		if (wildMatch(addrstr,iplist[i]))
-			return (iplist_type == IP_WHITELIST ? 1 : 0);
+		ip = ntohl(addr.s_addr);
+		for(i=0;i < source_cnt;++i)
+		{
+			if (inRanges(&sources[i],ip))
+				return (iplist_type == IP_WHITELIST ? 1 : 0);
+		}
 	}
+	if (matchWildcards(iplist_wc,addrstr))
+		return (iplist_type == IP_WHITELIST ? 1 : 0);
 
 	/* Not found */
 	return (iplist_type == IP_WHITELIST ? 0 : 1);
@@ -75,37 +239,205 @@ int authorisedIP(char *addrstr)
 
 
 
-/*** Returns 1 if the string matches the pattern, else 0. Supports wildcard 
-     patterns containing '*' and '?'. Case insensitive. ***/
-int wildMatch(const char *str, const char *pat)
+/*** Parses "a.b.c.d" or "a.b.c.d/bits". Returns 0 if it's not one of those
+     which in the config file means it's a wildcard pattern. ***/
+int parseIPRange(char *str, char *end, struct st_ip_range *range)
 {
-	char *s;
-	char *s2;
-	char *p;
+	uint32_t ip;
+	uint32_t mask;
+	char *ptr;
+	int octet;
+	int bits;
+	int val;
 
-	for(s=(char *)str,p=(char *)pat;*s && *p;++s,++p)
+	ptr = str;
+	for(octet=0,ip=0;octet < 4;++octet)
 	{
-		switch(*p)
+		if (octet)
 		{
-		case '?':
-			continue;
+			if (ptr == end || *ptr != '.') return 0;
+			++ptr;
+		}
+		if (ptr == end || !isdigit(*ptr)) return 0;
+		for(val=0;ptr < end && isdigit(*ptr) && val < 256;++ptr)
+			val = val * 10 + (*ptr - '0');
+		if (val > 255) return 0;
+		ip = (ip << 8) | val;
+	}
+
+	bits = 32;
+	if (ptr < end && *ptr == '/')
+	{
+		if (++ptr == end) return 0;
+		for(bits=0;ptr < end && isdigit(*ptr) && bits <= 32;++ptr)
+			bits = bits * 10 + (*ptr - '0');
+		if (bits > 32) return 0;
+	}
+	if (ptr != end) return 0;
+
+	mask = bits ? 0xFFFFFFFF << (32 - bits) : 0;
+	range->from = ip & mask;
+	range->to = range->from | ~mask;
+	return 1;
+}
+
+
+
+
+void addRange(struct st_ip_source *src, struct st_ip_range *range, int *alloc)
+{
+	if (src->range_cnt == *alloc)
+	{
+		*alloc = *alloc ? *alloc * 2 : 64;
+		src->ranges = (struct st_ip_range *)realloc(
+			src->ranges,sizeof(struct st_ip_range) * *alloc);
+		assert(src->ranges);
+	}
+	src->ranges[src->range_cnt++] = *range;
+}
+
+
+
 
-		case '*':
-			if (!*(p+1)) return 1;
+/*** Sort the ranges and merge any that overlap or touch so the binary
+     search only has to look at one ***/
+void mergeRanges(struct st_ip_source *src)
+{
+	struct st_ip_range *r;
+	int i;
 
-			for(s2=s;*s2;++s2) if (wildMatch(s2,p+1)) return 1;
-			return 0;
+	if (!src->range_cnt) return;
+
+	qsort(src->ranges,src->range_cnt,sizeof(struct st_ip_range),cmpRange);
+	for(i=1,r=src->ranges;i < src->range_cnt;++i)
+	{
+		if (src->ranges[i].from <= r->to ||
+		    (r->to != 0xFFFFFFFF && src->ranges[i].from == r->to + 1))
+		{
+			if (src->ranges[i].to > r->to) r->to = src->ranges[i].to;
 		}
-		if (toupper(*s) != toupper(*p)) return 0;
+		else *++r = src->ranges[i];
 	}
+	src->range_cnt = (int)(r - src->ranges) + 1;
+}
+
+
 
-	/* Could have '*' leftover in the pattern which can match nothing.
-	   eg: "abc*" should match "abc" and "*" should match "" */
-	if (!*s)
+
+/*** One IP address or CIDR block per line. Blank lines and anything after
+     a '#' are ignored. The new ranges replace the old ones only if the file
+     loads so a bad update doesn't empty the list. ***/
+int loadIPFile(struct st_ip_source *src)
+{
+	struct st_ip_source tmp;
+	struct st_ip_range range;
+	struct stat fs;
+	char *map_start;
+	char *map_end;
+	char *ptr;
+	char *start;
+	char *end;
+	int linenum;
+	int alloc;
+	int bad;
+	int fd;
+
+	if ((fd = open(src->path,O_RDONLY)) == -1)
+	{
+		logprintf(parent_pid,"ERROR: loadIPFile(): open(\"%s\"): %s\n",
+			src->path,strerror(errno));
+		return 0;
+	}
+	if (fstat(fd,&fs) == -1)
+	{
+		logprintf(parent_pid,"ERROR: loadIPFile(): fstat(): %s\n",
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+	bzero(&tmp,sizeof(tmp));
+	if (!fs.st_size) goto DONE;
+
+	if ((map_start = (char *)mmap(
+		NULL,fs.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+	{
+		logprintf(parent_pid,"ERROR: loadIPFile(): mmap(): %s\n",
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+	map_end = map_start + fs.st_size;
+
+	for(ptr=map_start,linenum=1,alloc=bad=0;ptr < map_end;++linenum)
+	{
+		/* Find the line and trim it */
+		for(start=ptr;ptr < map_end && *ptr != '\n';++ptr);
+		end = ptr++;
+		for(;start < end && isspace(*start);++start);
+		if ((char *)memchr(start,'#',end - start))
+			end = (char *)memchr(start,'#',end - start);
+		for(;end > start && isspace(*(end-1));--end);
+		if (start == end) continue;
+
+		if (parseIPRange(start,end,&range))
+			addRange(&tmp,&range,&alloc);
+		else if (++bad <= 10)
+		{
+			logprintf(parent_pid,"WARNING: Invalid entry \"%.*s\" in \"%s\" on line %d, ignoring.\n",
+				(int)(end - start),start,src->path,linenum);
+		}
+	}
+	munmap(map_start,fs.st_size);
+	if (bad > 10)
 	{
-		/* Could have multiple *'s on end which should all match "" */
-		for(;*p && *p == '*';++p);
-		if (!*p) return 1;
+		logprintf(parent_pid,"WARNING: %d invalid entries in \"%s\".\n",
+			bad,src->path);
+	}
+	mergeRanges(&tmp);
+
+	DONE:
+	close(fd);
+	FREE(src->ranges);
+	src->ranges = tmp.ranges;
+	src->range_cnt = tmp.range_cnt;
+	src->ino = fs.st_ino;
+	src->size = fs.st_size;
+	src->mtime = fs.st_mtime;
+
+	logprintf(parent_pid,"IP list file \"%s\" loaded, %d ranges.\n",
+		src->path,src->range_cnt);
+	return 1;
+}
+
+
+
+
+/*** Binary search for the last range starting at or before the ip ***/
+int inRanges(struct st_ip_source *src, uint32_t ip)
+{
+	int lo;
+	int hi;
+	int mid;
+
+	for(lo=0,hi=src->range_cnt-1;lo <= hi;)
+	{
+		mid = (lo + hi) / 2;
+		if (ip < src->ranges[mid].from)
+			hi = mid - 1;
+		else if (ip > src->ranges[mid].to)
+			lo = mid + 1;
+		else
+			return 1;
 	}
 	return 0;
 }
+
+
+
+
+int cmpRange(const void *a, const void *b)
+{
+	uint32_t from1 = ((const struct st_ip_range *)a)->from;
+	uint32_t from2 = ((const struct st_ip_range *)b)->from;
+	return (from1 < from2 ? -1 : (from1 > from2 ? 1 : 0));
+}
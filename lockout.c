@@ -0,0 +1,186 @@
+/*****************************************************************************
+ Failed login lockout table. This lives in shared memory created by the
+ parent so every master process sees the failures of every other session
+ and the parent can refuse a locked out IP before it bothers forking. Each
+ failure adds 1 to the score of the source IP and of the username and the
+ score decays by 1 every lockout_decay_secs. When a score reaches
+ lockout_max_fails the IP or username is locked out.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define LOCKOUT_KEY_LEN 64
+#define LOCKOUT_PROBES  8
+
+struct st_lockout_entry
+{
+	int type;
+	char key[LOCKOUT_KEY_LEN];
+	double score;
+	time_t updated;
+};
+
+struct st_lockout_table
+{
+	volatile pid_t lock;
+	int size;
+	struct st_lockout_entry entry[1];
+};
+
+static struct st_lockout_table *table = NULL;
+static size_t table_bytes = 0;
+
+static struct st_lockout_entry *findEntry(int type, char *key, int create);
+static double decayedScore(struct st_lockout_entry *entry, time_t now);
+
+
+/*** Called by the parent after the config has been read. If the table
+     already exists and is the same size it is kept so a restart doesn't
+     forget the failures. ***/
+void initLockout(void)
+{
+	size_t bytes;
+
+	if (!lockout_max_fails)
+	{
+		if (table)
+		{
+			munmap(table,table_bytes);
+			table = NULL;
+		}
+		return;
+	}
+	if (table && table->size == lockout_table_size) return;
+	if (table) munmap(table,table_bytes);
+
+	bytes = sizeof(struct st_lockout_table) +
+	        sizeof(struct st_lockout_entry) * (lockout_table_size - 1);
+	if (!(table = (struct st_lockout_table *)mapSharedMem(bytes)))
+	{
+		logprintf(0,"WARNING: Failed login lockout disabled.\n");
+		return;
+	}
+	table_bytes = bytes;
+	table->size = lockout_table_size;
+}
+
+
+
+
+/*** Returns 1 if the IP or username is locked out ***/
+int lockedOut(int type, char *key)
+{
+	struct st_lockout_entry *entry;
+	int locked = 0;
+
+	if (!table) return 0;
+
+	shmLock(&table->lock);
+	if ((entry = findEntry(type,key,0)))
+		locked = (decayedScore(entry,time(0)) >= lockout_max_fails);
+	shmUnlock(&table->lock);
+
+	return locked;
+}
+
+
+
+
+void addLoginFail(int type, char *key)
+{
+	struct st_lockout_entry *entry;
+	time_t now;
+	int locked = 0;
+
+	if (!table) return;
+
+	time(&now);
+	shmLock(&table->lock);
+	if ((entry = findEntry(type,key,1)))
+	{
+		entry->score = decayedScore(entry,now) + 1;
+		entry->updated = now;
+		locked = ((int)entry->score == lockout_max_fails);
+	}
+	shmUnlock(&table->lock);
+
+	/* Log outside the lock as it can be slow */
+	if (locked)
+	{
+		logprintf(getpid(),"LOCKOUT: %s \"%s\" locked out after %d failed logins.\n",
+			type == LOCKOUT_IP ? "IP" : "User",key,lockout_max_fails);
+	}
+}
+
+
+
+
+void clearLoginFails(int type, char *key)
+{
+	struct st_lockout_entry *entry;
+
+	if (!table) return;
+
+	shmLock(&table->lock);
+	if ((entry = findEntry(type,key,0))) entry->score = 0;
+	shmUnlock(&table->lock);
+}
+
+
+
+
+/*** Find the entry for the key. If create is set and it doesn't exist then
+     use a free slot or failing that evict the one with the lowest score.
+     Must be called with the lock held. ***/
+struct st_lockout_entry *findEntry(int type, char *key, int create)
+{
+	struct st_lockout_entry *entry;
+	struct st_lockout_entry *victim;
+	uint32_t h;
+	time_t now;
+	char *ptr;
+	int i;
+
+	/* FNV-1a */
+	h = 2166136261U ^ type;
+	for(ptr=key;*ptr && ptr < key + LOCKOUT_KEY_LEN - 1;++ptr)
+	{
+		h ^= (u_char)*ptr;
+		h *= 16777619U;
+	}
+
+	time(&now);
+	victim = NULL;
+	for(i=0;i < LOCKOUT_PROBES;++i,++h)
+	{
+		entry = &table->entry[h % table->size];
+		if (entry->type == type &&
+		    !strncmp(entry->key,key,LOCKOUT_KEY_LEN - 1)) return entry;
+
+		if (!victim ||
+		    decayedScore(entry,now) < decayedScore(victim,now))
+		{
+			victim = entry;
+		}
+	}
+	if (!create) return NULL;
+
+	victim->type = type;
+	snprintf(victim->key,LOCKOUT_KEY_LEN,"%s",key);
+	victim->score = 0;
+	victim->updated = now;
+	return victim;
+}
+
+
+
+
+double decayedScore(struct st_lockout_entry *entry, time_t now)
+{
+	double score;
+
+	if (!entry->type) return 0;
+	score = entry->score -
+	        (double)(now - entry->updated) / lockout_decay_secs;
+	return (score < 0 ? 0 : score);
+}
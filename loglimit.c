@@ -0,0 +1,226 @@
+/*****************************************************************************
+ Log storm suppression. Messages that can be triggered from outside, eg one
+ per connection, are logged with logprintfLimit() along with a key such as
+ the remote IP. Only log_limit_burst of them are logged for each call site
+ and key in log_limit_secs and only log_limit_site_burst for the call site
+ whatever the key, so a scan from many addresses is bounded as well. The
+ rest are counted and a single summary line is logged when the period ends.
+
+ The call site is the format string's address so there's nothing to
+ register. Each process has its own tables which are small and fixed size.
+ In the key table if two sites or keys collide the older one has its
+ summary logged and is replaced which only means something gets logged that
+ could have been suppressed. The call sites have a table of their own so a
+ flood of new keys can never reset a site's count, and as there are only a
+ handful of sites it's probed rather than replaced on a collision.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define LOG_LIMIT_SLOTS 256
+#define LOG_LIMIT_SITES 64
+#define LOG_LIMIT_KEY   40
+#define LOG_LABEL_LEN   50
+
+struct st_log_limit
+{
+	char *fmt;
+	char key[LOG_LIMIT_KEY];
+	pid_t pid;
+	time_t start;
+	int cnt;
+	int suppressed;
+};
+
+static struct st_log_limit key_table[LOG_LIMIT_SLOTS];
+static struct st_log_limit site_table[LOG_LIMIT_SITES];
+static int pending = 0;
+
+static int  checkLimit(
+	struct st_log_limit *ll,
+	char *fmt, char *key, pid_t pid, int burst, time_t now);
+static struct st_log_limit *findSite(char *fmt);
+static void flushTable(
+	struct st_log_limit *ll, int slots, int force, time_t now);
+static void logSummary(struct st_log_limit *ll, time_t now);
+static uint32_t hashSite(char *fmt, char *key);
+
+
+/*** As logprintf() but counts instead of logging if the call site has
+     logged too often for the key recently. A NULL key means the call site
+     alone is limited. ***/
+void logprintfLimit(char *key, pid_t pid, char *fmt, ...)
+{
+	va_list args;
+	time_t now;
+
+	if (log_limit_burst || log_limit_site_burst)
+	{
+		now = time(0);
+		if (!key) key = "";
+		if ((*key && log_limit_burst &&
+		     !checkLimit(
+			&key_table[hashSite(fmt,key) % LOG_LIMIT_SLOTS],
+			fmt,key,pid,log_limit_burst,now)) ||
+		    (log_limit_site_burst &&
+		     !checkLimit(
+			findSite(fmt),fmt,"",pid,log_limit_site_burst,now)))
+		{
+			return;
+		}
+	}
+	va_start(args,fmt);
+	vlogprintf(pid,fmt,args);
+	va_end(args);
+}
+
+
+
+
+/*** Log the summaries for periods that have ended. If force is set log
+     them all, eg because the process is exiting. ***/
+void flushLogLimits(int force)
+{
+	time_t now;
+
+	if (!pending) return;
+	now = time(0);
+	flushTable(key_table,LOG_LIMIT_SLOTS,force,now);
+	flushTable(site_table,LOG_LIMIT_SITES,force,now);
+}
+
+
+
+
+/*** Called in a new master so it doesn't log the parent's summaries too ***/
+void clearLogLimits(void)
+{
+	bzero(key_table,sizeof(key_table));
+	bzero(site_table,sizeof(site_table));
+	pending = 0;
+}
+
+
+
+
+/*** For the parent's select() so summaries get logged even if nothing
+     else happens ***/
+void setLogLimitTimeout(struct timeval *tv, struct timeval **tvp)
+{
+	if (!pending) return;
+	if (!*tvp || tv->tv_sec > log_limit_secs)
+	{
+		tv->tv_sec = log_limit_secs;
+		tv->tv_usec = 0;
+		*tvp = tv;
+	}
+}
+
+
+
+
+/*** Returns 1 if the message can be logged ***/
+int checkLimit(
+	struct st_log_limit *ll,
+	char *fmt, char *key, pid_t pid, int burst, time_t now)
+{
+	if (ll->fmt != fmt || strncmp(ll->key,key,LOG_LIMIT_KEY - 1))
+	{
+		if (ll->suppressed) logSummary(ll,now);
+		ll->fmt = fmt;
+		snprintf(ll->key,LOG_LIMIT_KEY,"%s",key);
+		ll->start = now;
+		ll->cnt = 0;
+	}
+	else if (now - ll->start >= log_limit_secs)
+	{
+		if (ll->suppressed) logSummary(ll,now);
+		ll->start = now;
+		ll->cnt = 0;
+	}
+	if (++ll->cnt <= burst) return 1;
+
+	if (!ll->suppressed++) ++pending;
+	ll->pid = pid;
+	return 0;
+}
+
+
+
+
+/*** Returns the site's own slot, a free one or if the table is full the
+     one it hashes to ***/
+struct st_log_limit *findSite(char *fmt)
+{
+	struct st_log_limit *ll;
+	uint32_t start;
+	uint32_t i;
+	int n;
+
+	start = hashSite(fmt,"") % LOG_LIMIT_SITES;
+	for(n=0,i=start;n < LOG_LIMIT_SITES;++n,i=(i + 1) % LOG_LIMIT_SITES)
+	{
+		ll = &site_table[i];
+		if (!ll->fmt || ll->fmt == fmt) return ll;
+	}
+	return &site_table[start];
+}
+
+
+
+
+void flushTable(struct st_log_limit *ll, int slots, int force, time_t now)
+{
+	int i;
+
+	for(i=0;i < slots;++i,++ll)
+	{
+		if (ll->suppressed && (force || now - ll->start >= log_limit_secs))
+			logSummary(ll,now);
+	}
+}
+
+
+
+
+/*** The label is the start of the format up to the first conversion ***/
+void logSummary(struct st_log_limit *ll, time_t now)
+{
+	char label[LOG_LABEL_LEN];
+	int len;
+
+	len = (int)strcspn(ll->fmt,"%\n");
+	if (len >= LOG_LABEL_LEN) len = LOG_LABEL_LEN - 1;
+	memcpy(label,ll->fmt,len);
+	label[len] = 0;
+
+	logprintf(ll->pid,"LOG: Suppressed %d similar messages%s%s in %d secs: \"%s\"\n",
+		ll->suppressed,
+		ll->key[0] ? " for " : "",ll->key,
+		(int)(now - ll->start),label);
+	ll->suppressed = 0;
+	--pending;
+}
+
+
+
+
+/*** FNV-1a over the site address and the key ***/
+uint32_t hashSite(char *fmt, char *key)
+{
+	uintptr_t site = (uintptr_t)fmt;
+	uint32_t h = 2166136261U;
+	u_int i;
+
+	for(i=0;i < sizeof(site);++i,site >>= 8)
+	{
+		h ^= (uint32_t)(site & 0xFF);
+		h *= 16777619U;
+	}
+	for(;*key;++key)
+	{
+		h ^= (u_char)*key;
+		h *= 16777619U;
+	}
+	return h;
+}
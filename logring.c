@@ -0,0 +1,394 @@
+/*****************************************************************************
+ Log ring. Once the parent has started up every process writes its log
+ lines into a ring of fixed size slots in shared memory instead of opening,
+ locking and appending to the log file itself. A slot is claimed with a
+ compare and swap on the head so there are no locks and a process never
+ waits for another. If the ring is full the line is dropped and counted
+ rather than blocking the session that's logging. A line too long for one
+ slot has all the slots it needs claimed with the one compare and swap so
+ nothing can get in between its pieces. Lines longer than LOG_LINE_SLOTS
+ slots are truncated.
+
+ The ring is drained by a log writer process forked by the parent which
+ adds the timestamps, from a string it only reformats once a second, and
+ writes everything it finds in one write(). If the writer isn't running,
+ eg during a restart, or a line is too early in startup logprintf() writes
+ directly as before.
+
+ Each slot has a sequence number as in Dmitry Vyukov's bounded queue: a
+ writer can claim slot N when its sequence is N, it sets it to N+1 when the
+ line is in it and the reader sets it to N+LOG_RING_SLOTS once it has been
+ written out.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define LOG_RING_SLOTS    4096   /* Must be a power of 2 */
+#define LOG_SLOT_SIZE     256
+#define LOG_LINE_SLOTS    16
+#define LOG_WRITER_USECS  10000
+#define LOG_WRITE_BUFF    65536
+#define LOG_STALL_SECS    2
+
+struct st_log_slot
+{
+	volatile uint32_t seq;
+	pid_t pid;
+	time_t when;
+	int len;
+	char data[LOG_SLOT_SIZE - sizeof(uint32_t) - sizeof(pid_t) -
+	          sizeof(time_t) - sizeof(int)];
+};
+
+struct st_log_ring
+{
+	volatile uint32_t head;
+	volatile uint32_t dropped;
+	volatile pid_t writer_pid;
+	volatile int stop;
+	uint32_t tail;
+	struct st_log_slot slot[LOG_RING_SLOTS];
+};
+
+static struct st_log_ring *ring = NULL;
+static char *out_buff = NULL;
+static int out_len;
+static int out_fd;
+static time_t reopen_time;
+
+static void runLogWriter(void);
+static int  drainRing(void);
+static void addOutput(char *data, int len);
+static void flushOutput(void);
+static void openLogFile(void);
+static void checkLogFile(time_t now);
+
+
+/*** Called by the parent once it's become a daemon. The ring is kept over
+     a restart so anything logged while the writer was stopped is written
+     by the next one. ***/
+void startLogWriter(void)
+{
+	pid_t pid;
+	int i;
+
+	if (!log_file && flags.daemon) return;
+	if (!ring)
+	{
+		/* Sequence numbers start as the slot index so slot N is free for
+		   line N */
+		if (!(ring = (struct st_log_ring *)mapSharedMem(
+			sizeof(struct st_log_ring)))) return;
+		for(i=0;i < LOG_RING_SLOTS;++i) ring->slot[i].seq = i;
+	}
+	ring->stop = 0;
+
+	switch((pid = fork()))
+	{
+	case -1:
+		logprintf(parent_pid,"ERROR: startLogWriter(): fork(): %s\n",
+			strerror(errno));
+		return;
+	case 0:
+		/* If it's being restarted the parent has these open */
+		for(i=0;i < num_interfaces;++i)
+		{
+			if (iface[i].sock) close(iface[i].sock);
+		}
+		forkedPTYPool(0);
+		forkedLoginPool(0);
+		closeControlSocket();
+		clearWatches();
+		signal(SIGHUP,SIG_IGN);
+		signal(SIGINT,SIG_IGN);
+		signal(SIGQUIT,SIG_IGN);
+		signal(SIGCHLD,SIG_DFL);
+		runLogWriter();
+		_exit(0);
+	}
+	ring->writer_pid = pid;
+	logprintf(parent_pid,"Log writer process = %d\n",pid);
+}
+
+
+
+
+/*** Called by the parent before a restart or exit. Waits for the writer to
+     empty the ring. ***/
+void stopLogWriter(void)
+{
+	pid_t pid;
+
+	if (!ring || !(pid = ring->writer_pid) || getpid() != parent_pid)
+		return;
+	ring->stop = 1;
+	waitpid(pid,NULL,0);
+	ring->writer_pid = 0;
+}
+
+
+
+
+/*** Called by the parent when a child it doesn't know about exits. Returns
+     1 if it was the writer, which is restarted. ***/
+int logWriterExited(pid_t pid, int status)
+{
+	if (!ring || pid != ring->writer_pid) return 0;
+	ring->writer_pid = 0;
+	logprintf(parent_pid,"ERROR: Log writer process %d exited with %s %d, restarting it.\n",
+		pid,
+		WIFSIGNALED(status) ? "signal" : "code",
+		WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+	startLogWriter();
+	return 1;
+}
+
+
+
+
+/*** Called by logprintf(). Returns 0 if the line has to be written
+     directly. Long lines are split over consecutive slots with the later
+     ones having no pid so they don't get a preamble. ***/
+int logRingWrite(pid_t pid, char *str, int len)
+{
+	struct st_log_slot *slot;
+	uint32_t pos;
+	time_t now;
+	int32_t dif;
+	int truncated;
+	int size;
+	int cnt;
+	int n;
+	int i;
+
+	if (!ring || !ring->writer_pid) return 0;
+
+	size = (int)sizeof(ring->slot[0].data);
+	if ((cnt = (len + size - 1) / size) > LOG_LINE_SLOTS)
+	{
+		cnt = LOG_LINE_SLOTS;
+		len = cnt * size;
+		truncated = 1;
+	}
+	else truncated = 0;
+	if (!cnt) cnt = 1;
+
+	/* All the slots from the head on have to be free */
+	for(pos=ring->head;;pos=ring->head)
+	{
+		for(i=dif=0;i < cnt && !dif;++i)
+		{
+			slot = &ring->slot[(pos + i) & (LOG_RING_SLOTS - 1)];
+			dif = (int32_t)(slot->seq - (pos + i));
+		}
+		if (dif < 0)
+		{
+			/* Full. The writer will log how many were lost. */
+			__sync_fetch_and_add(&ring->dropped,1);
+			return 1;
+		}
+		if (!dif &&
+		    __sync_bool_compare_and_swap(&ring->head,pos,pos + cnt)) break;
+	}
+
+	now = pid ? time(0) : 0;
+	for(i=0;i < cnt;++i,++pos)
+	{
+		slot = &ring->slot[pos & (LOG_RING_SLOTS - 1)];
+		slot->pid = pid;
+		slot->when = now;
+		slot->len = n = len < size ? len : size;
+		memcpy(slot->data,str,n);
+		if (truncated && i == cnt - 1)
+			memcpy(slot->data + size - 5," ...\n",5);
+
+		/* If the writer has given up on us it's moved the sequence on */
+		__sync_bool_compare_and_swap(&slot->seq,pos,pos+1);
+
+		str += n;
+		len -= n;
+		pid = 0;
+	}
+	return 1;
+}
+
+
+
+
+/*** In the writer process. Exits once told to stop or the parent has gone
+     away and the ring is empty. ***/
+void runLogWriter(void)
+{
+	int idle;
+
+	out_buff = (char *)malloc(LOG_WRITE_BUFF);
+	assert(out_buff);
+	out_len = 0;
+	out_fd = -1;
+	reopen_time = 0;
+	openLogFile();
+
+	for(idle=0;;)
+	{
+		if (drainRing())
+		{
+			idle = 0;
+			continue;
+		}
+		if (ring->stop || getppid() != parent_pid)
+		{
+			/* Let anyone still in logRingWrite() finish then go and
+			   let them write directly */
+			ring->writer_pid = 0;
+			usleep(LOG_WRITER_USECS);
+			drainRing();
+			break;
+		}
+		/* Only stall the ring on an unfinished slot for so long in case
+		   whoever claimed it was killed */
+		if (++idle >= LOG_STALL_SECS * 1000000 / LOG_WRITER_USECS &&
+		    ring->head != ring->tail)
+		{
+			if (__sync_bool_compare_and_swap(
+				&ring->slot[ring->tail & (LOG_RING_SLOTS - 1)].seq,
+				ring->tail,ring->tail + LOG_RING_SLOTS))
+			{
+				++ring->tail;
+				__sync_fetch_and_add(&ring->dropped,1);
+			}
+			idle = 0;
+			continue;
+		}
+		usleep(LOG_WRITER_USECS);
+	}
+	if (out_fd > STDOUT_FILENO) close(out_fd);
+}
+
+
+
+
+/*** Write out everything that's ready. Returns the number of slots. ***/
+int drainRing(void)
+{
+	static time_t tstr_time = 0;
+	static char tstr[30];
+	struct st_log_slot *slot;
+	uint32_t dropped;
+	char pre[60];
+	int cnt;
+	int len;
+
+	for(cnt=0;;++cnt,++ring->tail)
+	{
+		slot = &ring->slot[ring->tail & (LOG_RING_SLOTS - 1)];
+		if (slot->seq != ring->tail + 1) break;
+		__sync_synchronize();
+
+		if (slot->pid)
+		{
+			if (slot->when != tstr_time)
+			{
+				tstr_time = slot->when;
+				strftime(tstr,sizeof(tstr),"%F %T",localtime(&tstr_time));
+			}
+			len = snprintf(pre,sizeof(pre),"%s: %d: ",tstr,slot->pid);
+			addOutput(pre,len);
+		}
+		addOutput(slot->data,slot->len);
+		__sync_bool_compare_and_swap(
+			&slot->seq,ring->tail + 1,ring->tail + LOG_RING_SLOTS);
+	}
+
+	if ((dropped = ring->dropped))
+	{
+		__sync_fetch_and_sub(&ring->dropped,dropped);
+		len = snprintf(pre,sizeof(pre),"*** %u log lines dropped ***\n",dropped);
+		addOutput(pre,len);
+	}
+	flushOutput();
+	checkLogFile(time(0));
+	return cnt;
+}
+
+
+
+
+void addOutput(char *data, int len)
+{
+	if (out_len + len > LOG_WRITE_BUFF) flushOutput();
+	memcpy(out_buff + out_len,data,len);
+	out_len += len;
+}
+
+
+
+
+void flushOutput(void)
+{
+	int len;
+	int i;
+
+	for(i=0;i < out_len && out_fd != -1;i += len)
+	{
+		if ((len = write(out_fd,out_buff + i,out_len - i)) == -1)
+		{
+			if (errno == EINTR)
+			{
+				len = 0;
+				continue;
+			}
+			printf("ERROR: flushOutput(): write(): %s\n",strerror(errno));
+			break;
+		}
+	}
+	out_len = 0;
+}
+
+
+
+
+/*** Same fail handling as logprintf() ***/
+void openLogFile(void)
+{
+	if (out_fd > STDOUT_FILENO) close(out_fd);
+	if (!log_file)
+	{
+		out_fd = STDOUT_FILENO;
+		return;
+	}
+	if ((out_fd = open(
+		log_file,O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,0666)) != -1)
+	{
+		return;
+	}
+	printf("ERROR: openLogFile(): open(): %s\n",strerror(errno));
+	if (++log_file_fail_cnt == log_file_max_fails)
+	{
+		printf("WARNING: Log file max write fails (%d) reached.\n",log_file_max_fails);
+		puts(">>> Redirecting output to stdout...");
+		log_file = NULL;
+		out_fd = STDOUT_FILENO;
+	}
+}
+
+
+
+
+/*** Once a second reopen the log file if it's been moved or deleted, eg
+     by logrotate, as logprintf() used to open it for every line ***/
+void checkLogFile(time_t now)
+{
+	struct stat fs1;
+	struct stat fs2;
+
+	if (!log_file || now == reopen_time) return;
+	reopen_time = now;
+
+	if (out_fd == -1 ||
+	    stat(log_file,&fs1) == -1 ||
+	    fstat(out_fd,&fs2) == -1 ||
+	    fs1.st_ino != fs2.st_ino || fs1.st_dev != fs2.st_dev)
+	{
+		openLogFile();
+	}
+}
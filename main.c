@@ -21,6 +21,7 @@ static void setSignals(void);
 static void doChecks(void);
 static void mainloop(void);
 static void sigHUPHandler(int sig, siginfo_t *siginfo, void *pcontext);
+static void sigCHLDHandler(int sig);
 static void sigExitHandler(int sig, siginfo_t *siginfo, void *pcontext);
 
 
@@ -38,6 +39,18 @@ int main(int argc, char **argv)
 		version();
 		parseConfigFile();
 		doChecks();
+		compileIPList();
+		initLockout();
+		initRateLimits();
+		initDNSCache();
+		loadMOTDs();
+		initCgroups();
+		initTrace();
+		if (pwd_file && !pwd_db_file)
+		{
+			loadPwdDB();
+			addWatch(pwd_file,reloadPwdDB);
+		}
 		for(i=0;i < num_interfaces;++i)	createListenSocket(i);
 		if (flags.daemon_tmp)
 		{
@@ -45,11 +58,14 @@ int main(int argc, char **argv)
 			/* Set this late so logprintf() works during boot */
 			flags.daemon = 1;
 		}
+		startLogWriter();
 		setSignals();
 
 		/* mainloop() will only ever exit on a SIGHUP which means do a
 		   restart and re-read the config file */
 		mainloop();
+		flushLogLimits(1);
+		stopLogWriter();
 		clear();
 		logprintf(master_pid,"*** RESTART ***");
 		first = 0;
@@ -67,6 +83,7 @@ void init(int first)
 	   disappear into a black hole if we're running as a daemon */
 	if (first) log_file = NULL;
 	pwd_file = NULL;
+	pwd_db_file = NULL;
 	config_file = CONFIG_FILE;
 	port = PORT;
 	login_prompt = NULL;
@@ -77,17 +94,53 @@ void init(int first)
 	login_timeout_msg = NULL;
 	banned_user_msg = NULL;
 	banned_ip_msg = NULL;
+	max_sessions_msg = NULL;
+	login_pool_term = NULL;
+	cgroup_dir = NULL;
+	capture_dir = NULL;
+	control_socket = NULL;
+	record_dir = NULL;
+	record_format = RECORD_ASCIICAST;
+	record_buffer_kb = RECORD_BUFFER_KB;
+	affinity_cpus = NULL;
 	login_max_attempts = LOGIN_MAX_ATTEMPTS;
 	login_pause_secs = LOGIN_PAUSE_SECS;
 	login_timeout_secs = LOGIN_TIMEOUT_SECS;
 	telopt_timeout_secs = TELOPT_TIMEOUT_SECS;
+	telopt_env_max_vars = ENV_MAX_VARS;
+	telopt_env_max_bytes = ENV_MAX_BYTES;
+	lockout_max_fails = LOCKOUT_MAX_FAILS;
+	lockout_decay_secs = LOCKOUT_DECAY_SECS;
+	lockout_table_size = LOCKOUT_TABLE_SIZE;
+	max_sessions = MAX_SESSIONS;
+	max_iface_sessions = MAX_IFACE_SESSIONS;
+	session_queue_size = SESSION_QUEUE_SIZE;
+	session_queue_timeout_secs = SESSION_QUEUE_TIMEOUT_SECS;
+	dns_cache_size = DNS_CACHE_SIZE;
+	dns_cache_ttl_secs = DNS_CACHE_TTL_SECS;
+	dns_cache_neg_ttl_secs = DNS_CACHE_NEG_TTL_SECS;
+	dns_timeout_secs = DNS_TIMEOUT_SECS;
+	pty_pool_size = PTY_POOL_SIZE;
+	login_pool_size = LOGIN_POOL_SIZE;
+	session_cpu_weight = SESSION_CPU_WEIGHT;
+	session_memory_max_mb = SESSION_MEMORY_MAX_MB;
+	session_pids_max = SESSION_PIDS_MAX;
+	affinity_cpu_cnt = 0;
 	banned_users = NULL;
 	banned_users_cnt = 0;
+	record_users = NULL;
+	record_users_cnt = 0;
+	record_interfaces = NULL;
+	record_interfaces_cnt = 0;
 	shell_exec_argv = NULL;
 	shell_exec_argv_cnt = 0;
 	login_exec_argv = NULL;
 	login_exec_argv_cnt = 0;
 	log_file_max_fails = LOG_FILE_MAX_FAILS;
+	log_level = LOG_LEVEL;
+	log_limit_burst = LOG_LIMIT_BURST;
+	log_limit_site_burst = LOG_LIMIT_SITE_BURST;
+	log_limit_secs = LOG_LIMIT_SECS;
 	log_file_fail_cnt = 0;
 	pre_motd_file = NULL;
 	post_motd_file = NULL;
@@ -96,7 +149,10 @@ void init(int first)
 	username[0] = 0;
 	iplist = NULL;
 	iplist_cnt = 0;
+	iplist_files = NULL;
+	iplist_files_cnt = 0;
 	iplist_type = IP_NO_LIST;
+	bzero(rate_limit,sizeof(rate_limit));
 
 	for(i=0;i < MAX_INTERFACES;++i)
 	{
@@ -124,12 +180,22 @@ void clear(void)
 	FREE(login_timeout_msg);
 	FREE(banned_user_msg);
 	FREE(banned_ip_msg);
+	FREE(max_sessions_msg);
+	freeMessages();
+	FREE(login_pool_term);
+	FREE(cgroup_dir);
+	FREE(capture_dir);
+	FREE(control_socket);
+	FREE(record_dir);
+	FREE(affinity_cpus);
 	FREE(pre_motd_file);
 	FREE(post_motd_file);
+	freeMOTDs();
 
 	/* Only clear password file, not log file otherwise logging will
 	   suddenly stop */
 	FREE(pwd_file);
+	FREE(pwd_db_file);
 
 	for(i=0;i < shell_exec_argv_cnt;++i) free(shell_exec_argv[i]);
 	FREE(shell_exec_argv);
@@ -140,8 +206,24 @@ void clear(void)
 	for(i=0;i < banned_users_cnt;++i) free(banned_users[i]);
 	FREE(banned_users);
 
+	for(i=0;i < record_users_cnt;++i) free(record_users[i]);
+	FREE(record_users);
+
+	for(i=0;i < record_interfaces_cnt;++i) free(record_interfaces[i]);
+	FREE(record_interfaces);
+
 	for(i=0;i < iplist_cnt;++i) free(iplist[i]);
 	FREE(iplist);
+	freeIPList();
+
+	for(i=0;i < iplist_files_cnt;++i) free(iplist_files[i]);
+	FREE(iplist_files);
+
+	freePwdDB();
+	freePTYPool();
+	freeLoginPool();
+	clearWatches();
+	closeControlSocket();
 
 	for(i=0;i < num_interfaces;++i) close(iface[i].sock);
 }
@@ -333,15 +415,6 @@ void setSignals(void)
 	struct sigaction sa;
 	sigset_t sigmask;
 
-	/* Not going to bother to reap in the parent process */
-	signal(SIGCHLD,SIG_IGN);
-        
- 	/* Block SIGUSR1 so we can sigwait() on it. Set others to point at 
-	   handler */
-	sigemptyset(&usr1_sigmask);
-	sigaddset(&usr1_sigmask,SIGUSR1);
-	sigprocmask(SIG_BLOCK,&usr1_sigmask,NULL);
-
 	/* SIGHUP causes a restart. Using sigaction() instead of signal()
 	   because signal() sets SA_RESTART meaning the accept() call won't 
 	   exit when this signal is received. We want it to exit. */
@@ -352,11 +425,29 @@ void setSignals(void)
 	sa.sa_sigaction = sigHUPHandler;
 	sigaction(SIGHUP,&sa,NULL);
 
+	/* The parent reaps its children so it can count sessions. Again no
+	   SA_RESTART so select() wakes up to reap them. */
+	bzero(&sa,sizeof(sa));
+	sa.sa_mask = sigmask;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sa.sa_handler = sigCHLDHandler;
+	sigaction(SIGCHLD,&sa,NULL);
+	sa.sa_flags = SA_SIGINFO;
+
 	/* Exit handlers */
 	sa.sa_sigaction = sigExitHandler;
 	sigaction(SIGINT,&sa,NULL);
 	sigaction(SIGQUIT,&sa,NULL);
 	sigaction(SIGTERM,&sa,NULL);
+
+	/* Only does anything in the masters but set here so they have it
+	   from the start. SA_RESTART so only select() sees it. */
+	bzero(&sa,sizeof(sa));
+	sa.sa_mask = sigmask;
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = traceSigHandler;
+	sigaction(SIGUSR1,&sa,NULL);
+	sigaction(SIGUSR2,&sa,NULL);
 }       
 
 
@@ -369,6 +460,8 @@ void mainloop(void)
 {
 	struct sockaddr_in ip_addr;
 	struct linger lin;
+	struct timeval tv;
+	struct timeval *tvp;
 	socklen_t size;
 	fd_set mask;
 	int i;
@@ -382,20 +475,42 @@ void mainloop(void)
 	/* Sit in select and fork off a child when a connection happens */
 	while(1) 
 	{
+		fillPTYPool();
+		fillLoginPool();
+
 		FD_ZERO(&mask);
 		for(i=0;i < num_interfaces;++i)
 		{
 			if (iface[i].sock) FD_SET(iface[i].sock,&mask);
 		}
+		tvp = NULL;
+		setWatchMask(&mask,&tv,&tvp);
+		setSessionMask(&mask,&tv,&tvp);
+		setControlMask(&mask);
+		setLogLimitTimeout(&tv,&tvp);
 
 		/* Wait for one of the listen sockets to have a connection */
-		if (select(FD_SETSIZE,&mask,0,0,0) == -1)
+		if (select(FD_SETSIZE,&mask,0,0,tvp) == -1)
 		{
-			/* Shouldn't ever error */
-			logprintf(parent_pid,"ERROR: mainloop(): select(): %s\n",				strerror(errno));
-			sleep(10);
-			continue;
+			/* Signals interrupt it which is what we want */
+			if (errno == EINTR)
+			{
+				if (flags.rx_sighup) return;
+				FD_ZERO(&mask);
+			}
+			else
+			{
+				/* Shouldn't ever error */
+				logprintf(parent_pid,"ERROR: mainloop(): select(): %s\n",
+					strerror(errno));
+				sleep(10);
+				continue;
+			}
 		}
+		checkWatches(&mask);
+		checkSessions(&mask);
+		checkControl(&mask);
+		flushLogLimits(0);
 
 		/* Accept any connections on the sockets */
 		for(i=0;i < num_interfaces;++i)
@@ -406,12 +521,19 @@ void mainloop(void)
 				iface[i].sock,
 				(struct sockaddr *)&ip_addr,&size)) == -1)
 			{
+				/* SIGCHLD has no SA_RESTART so this can happen
+				   at any time */
 				if (errno == EINTR)
 				{
 					if (flags.rx_sighup) return;
-					if (flags.ignore_sighup) continue;
+					continue;
 				}
 
+				/* The client went away between the select()
+				   and the accept() */
+				if (errno == ECONNABORTED || errno == EAGAIN)
+					continue;
+
 				/* This should never happen but if it does
 				   just close the listen socket */
 				logprintf(parent_pid,"ERROR: mainloop(): accept(): %s\n",
@@ -420,10 +542,12 @@ void mainloop(void)
 				iface[i].sock = 0;
 				continue;
 			}
+			/* Don't let the slave inherit it */
+			fcntl(sock,F_SETFD,FD_CLOEXEC);
 
 			strcpy(ipaddrstr,inet_ntoa(ip_addr.sin_addr));
 
-			logprintf(parent_pid,"CONNECTION: Interface IP = %s, remote IP = %s, socket = %d\n",
+			logprintfLimit(ipaddrstr,parent_pid,"CONNECTION: Interface IP = %s, remote IP = %s, socket = %d\n",
 				inet_ntoa(iface[i].addr.sin_addr),
 				ipaddrstr,sock);
 
@@ -431,8 +555,28 @@ void mainloop(void)
 			   waste cycles doing a fork  */
 			if (!authorisedIP(ipaddrstr))
 			{
-				logprintf(parent_pid,"CONNECTION REFUSED: Banned IP address.\n");
-				if (banned_ip_msg) sockprintf("%s\r\n",banned_ip_msg);
+				logprintfLimit(ipaddrstr,parent_pid,"CONNECTION REFUSED: Banned IP address.\n");
+				sendMsg(MSG_BANNED_IP);
+				close(sock);
+				continue;
+			}
+
+			/* Whitelisted addresses only count towards the global
+			   limit. To be here the address has to be on the
+			   whitelist if there is one. */
+			if (rateLimited(
+				ip_addr.sin_addr,iplist_type == IP_WHITELIST))
+			{
+				close(sock);
+				continue;
+			}
+
+			/* Don't waste a fork on an IP that's been trying to
+			   brute force logins */
+			if (lockedOut(LOCKOUT_IP,ipaddrstr))
+			{
+				logprintfLimit(ipaddrstr,parent_pid,"CONNECTION REFUSED: IP address locked out after failed logins.\n");
+				sendMsg(MSG_BANNED_IP);
 				close(sock);
 				continue;
 			}
@@ -447,21 +591,9 @@ void mainloop(void)
 					strerror(errno));
 			}
 
-			switch(fork())
-			{
-			case -1:
-				logprintf(parent_pid,"ERROR: mainloop(): fork(): %s\n",
-					strerror(errno));
-				break;
-			case 0:
-				signal(SIGHUP,SIG_IGN);
-				close(iface[i].sock);
-				runMaster(&ip_addr);
-				break;
-			default:
-				break;
-			}
-			close(sock);
+			/* Forks, queues or rejects it. Closes sock in the
+			   parent. */
+			admitConnection(i,&ip_addr);
 		}
 	}
 }
@@ -485,6 +617,16 @@ void sigHUPHandler(int sig, siginfo_t *siginfo, void *pcontext)
 
 
 
+/*** Does nothing, it's just here to interrupt select() so that
+     checkSessions() reaps the child ***/
+void sigCHLDHandler(int sig)
+{
+	(void)sig;
+}
+
+
+
+
 void sigExitHandler(int sig, siginfo_t *siginfo, void *pcontext)
 {
 	logprintf(parent_pid,"SIGNAL %d (%s) from pid %d: Exiting...\n",
@@ -19,7 +19,6 @@ void runMaster(struct sockaddr_in *ip_addr)
 {
 	struct timeval tvs;
 	struct timeval *tvp;
-	struct hostent *host;
 	fd_set mask;
 
 	ptym = -1;
@@ -29,29 +28,15 @@ void runMaster(struct sockaddr_in *ip_addr)
 	attempts = 0;
 	prev_rx_c = 0;
 	telopt_username = NULL;
+	initArena();
 	telneg_start = time(0);
 	master_pid = getpid();
 	slave_pid = -1;
 	dnsaddr = NULL;
 
-	/* A host lookup can block for a while so we do it in this process 
-	   instead of in the main loop in the parent process */
-	if (flags.dns_lookup && (host = gethostbyaddr(
-		(char *)&(ip_addr->sin_addr.s_addr),
-		sizeof(ip_addr->sin_addr.s_addr),AF_INET)))
-	{
-		dnsaddr = strdup(host->h_name);
-	}
-
-	logprintf(master_pid,"STARTED: Master process, ppid = %d, DNS name = %s\n",
-		parent_pid,dnsaddr ? dnsaddr : "<not set>");
-
-	if (dnsaddr && !authorisedIP(dnsaddr))
-	{
-		logprintf(master_pid,"CONNECTION REFUSED: Banned DNS address.\n");
-		if (banned_ip_msg) sockprintf("%s\r\n",banned_ip_msg);
-		masterExit(1);
-	}
+	logprintf(master_pid,"STARTED: Master process, ppid = %d\n",parent_pid);
+	if (!flags.capture_traced_only) startCapture(ip_addr);
+	startTrace(ip_addr);
 
 	setState(STATE_TELOPT);
 
@@ -60,16 +45,30 @@ void runMaster(struct sockaddr_in *ip_addr)
 	   setsid() here because we want to printf messages to terminal. */
 	setpgrp();
 
-	if (!openPTYMaster()) masterExit(1);
-
-	logprintf(master_pid,"PTY = %s\n",getPTYName());
+	if (!deferPTY())
+	{
+		if (!openPTYMaster()) masterExit(1);
+		logprintf(master_pid,"PTY = %s\n",getPTYName());
+	}
 
 	signal(SIGCHLD,SIG_DFL);  /* Want to reap zombies */
 	signal(SIGINT,masterSigHandler);
 	signal(SIGQUIT,masterSigHandler);
 	signal(SIGTERM,masterSigHandler);
 
-	if (pre_motd_file) sendMOTD(pre_motd_file);
+	/* A host lookup can block for a while so it runs in its own process
+	   while we get on with the telopt negotiation and MOTD. Don't bother
+	   if nothing is going to use the name. The utmp entry is only added
+	   when we do the login and the shell can come from the password file
+	   so shell_exec_argv may not be set yet. */
+	if (flags.dns_lookup &&
+	    (iplistHasDNS() ||
+	     ((shell_exec_argv || pwd_file) && flags.store_host_in_utmp)))
+	{
+		startDNSLookup(ip_addr->sin_addr);
+	}
+
+	if (pre_motd_file) sendMOTD(MOTD_PRE);
 
 	sendInitialTelopt();
 
@@ -80,6 +79,7 @@ void runMaster(struct sockaddr_in *ip_addr)
 		FD_SET(sock,&mask);
 
 		if (ptym != -1) FD_SET(ptym,&mask);
+		setDNSMask(&mask);
 		tvp = NULL;
 
 		switch(state)
@@ -122,10 +122,17 @@ void runMaster(struct sockaddr_in *ip_addr)
 		default:
 			assert(0);
 		}
+		setCaptureTimeout(&tvs,&tvp);
 
 		switch(select(FD_SETSIZE,&mask,0,0,tvp))
 		{
 		case -1:
+			/* A trace signal */
+			if (errno == EINTR)
+			{
+				FD_ZERO(&mask);
+				break;
+			}
 			logprintf(master_pid,"ERROR: runMaster(): select(): %s\n",
 				strerror(errno));
 			masterExit(1);
@@ -133,11 +140,14 @@ void runMaster(struct sockaddr_in *ip_addr)
 		case 0:
 			if (state == STATE_LOGIN || state == STATE_PWD)
 			{
-				sockprintf("\r\n\r\n%s\r\n\r\n",login_timeout_msg);
+				sendMsg(MSG_LOGIN_TIMEOUT);
 				masterExit(0);
 			}
 		}
 
+		checkDNS(&mask);
+		checkCapture();
+		checkTrace();
 		if (FD_ISSET(sock,&mask)) readSock();
 		if (ptym != -1 && FD_ISSET(ptym,&mask)) readPTYMaster();
 	}
@@ -150,6 +160,20 @@ void runMaster(struct sockaddr_in *ip_addr)
      switching to a new state */
 void processStateTelopt(void)
 {
+	/* The IP list needs the name now so wait for the lookup if it's
+	   still going. If it's only for utmp it can carry on during the
+	   login. */
+	if (iplistHasDNS())
+	{
+		waitDNS();
+		if (dnsaddr && !authorisedIP(dnsaddr))
+		{
+			logprintf(master_pid,"CONNECTION REFUSED: Banned DNS address.\n");
+			sendMsg(MSG_BANNED_IP);
+			masterExit(1);
+		}
+	}
+
 	if (telopt_username)
 	{
 		logprintf(master_pid,"Auto setting username to \"%s\".\n",
@@ -163,11 +187,12 @@ void processStateTelopt(void)
 	{
 		setState(STATE_PIPE);
 		runSlave();
+		startRecording();
 		return;
 	}
 
 	/* Send our own login prompt */
-	sockprintf(login_prompt);
+	sendMsg(MSG_LOGIN_PROMPT);
 
 	/* If we got the username from the client then jump to password input */
 	if (telopt_username)
@@ -178,8 +203,6 @@ void processStateTelopt(void)
 			setUserNameAndPwdState(telopt_username);
 		else
 			setState(STATE_LOGIN);
-
-		free(telopt_username);
 	}
 	else setState(STATE_LOGIN);
 }
@@ -190,8 +213,9 @@ void processStateTelopt(void)
 void setUserNameAndPwdState(char *uname)
 {
 	strncpy(username,uname,sizeof(username));
+	recheckTrace();
 	flags.echo = 0;
-	sockprintf(pwd_prompt);
+	sendMsg(MSG_PWD_PROMPT);
 	setState(STATE_PWD);
 }
 
@@ -206,7 +230,7 @@ int loginAllowed(char *uname)
 		if (!strcmp(banned_users[i],uname)) 
 		{
 			checkLoginAttempts();
-			sockprintf("%s\r\n%s",banned_user_msg,login_prompt);
+			sendMsg(MSG_BANNED_USER);
 			logprintf(master_pid,"WARNING: Attempted login of banned user \"%s\"\n",uname);
 			return 0;
 		}
@@ -221,7 +245,7 @@ void checkLoginAttempts(void)
 {
 	if (++attempts >= login_max_attempts)
 	{
-		sockprintf("\r\n%s\r\n\r\n",login_max_attempts_msg);
+		sendMsg(MSG_LOGIN_MAX_ATTEMPTS);
 		/* login_max_attempts could have been changed in pwd file so
 		   print it out */
 		logprintf(master_pid,"Maximum login attempts (%d) reached.\n",
@@ -256,6 +280,7 @@ void readPTYMaster(void)
 		break;
 	default:
 		writeSock((u_char *)ptybuff,len);
+		if (flags.record) recordData((u_char *)ptybuff,len);
 	}
 }
 
@@ -275,6 +300,9 @@ void masterExit(int code)
 {
 	int status;
 
+	flushLogLimits(1);
+	endCapture();
+	endRecording();
 	if (ptym != -1) close(ptym);
 	close(sock);
 
@@ -283,9 +311,18 @@ void masterExit(int code)
 		/* Reap slave process */
 		if (waitpid(slave_pid,&status,WNOHANG) == -1)
 		{
-			logprintf(master_pid,
-				"ERROR: masterExit(): waitpid(): Can't reap slave process %d: %s.\n",
-				slave_pid,strerror(errno));
+			/* A pooled login process is the parent's child */
+			if (errno == ECHILD)
+			{
+				logprintf(master_pid,"EXIT: Slave process %d will be reaped by the parent.\n",
+					slave_pid);
+			}
+			else
+			{
+				logprintf(master_pid,
+					"ERROR: masterExit(): waitpid(): Can't reap slave process %d: %s.\n",
+					slave_pid,strerror(errno));
+			}
 		}
 		else if (WIFEXITED(status))
 		{
@@ -302,6 +339,7 @@ void masterExit(int code)
 		else logprintf(master_pid,"EXIT: Slave process %d, state unknown.\n",slave_pid);
 	}
 	else logprintf(master_pid,"No slave process to reap.\n");
+	endSessionCgroup();
 
 	logprintf(master_pid,"EXIT: Master process with code %d.\n",code);
 	exit(code);
@@ -7,9 +7,9 @@ void setState(int st)
 		"NOTSET","TELOPT","LOGIN","PWD","PIPE"
 	};
 	if (st == state) assert(0);
-	logprintf(getpid(),"Setting state to %s (%d)\n",name[st],st);
+	LOGPRINTF(LOG_DEBUG,getpid(),"Setting state to %s (%d)\n",name[st],st);
 	if (state == STATE_TELOPT)
-		logprintf(getpid(),"Further telopt codes will be ignored.\n");
+		LOGPRINTF(LOG_DEBUG,getpid(),"Further telopt codes will be ignored.\n");
 	state = st;
 }
 
@@ -83,6 +83,60 @@ void parsePath(char **path)
 
 
 
+/*** Create an anonymous shared memory area which is inherited by forked
+     children. Returns NULL on failure. ***/
+void *mapSharedMem(size_t size)
+{
+	void *mem;
+
+	if ((mem = mmap(
+		NULL,size,
+		PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANON,-1,0)) == MAP_FAILED)
+	{
+		logprintf(getpid(),"ERROR: mapSharedMem(): mmap(): %s\n",
+			strerror(errno));
+		return NULL;
+	}
+	bzero(mem,size);
+	return mem;
+}
+
+
+
+
+/*** Simple spin lock for shared memory. The lock holds the pid of the
+     holder so if a process dies while holding it (eg killed by a signal)
+     it can be taken over instead of everyone else spinning forever. ***/
+void shmLock(volatile pid_t *lock)
+{
+	pid_t pid = getpid();
+	pid_t holder;
+	int i;
+
+	for(i=1;!__sync_bool_compare_and_swap(lock,0,pid);++i)
+	{
+		if (i % 1000)
+		{
+			sched_yield();
+			continue;
+		}
+		holder = *lock;
+		if (holder && kill(holder,0) == -1 && errno == ESRCH &&
+		    __sync_bool_compare_and_swap(lock,holder,pid)) break;
+	}
+}
+
+
+
+
+void shmUnlock(volatile pid_t *lock)
+{
+	__sync_lock_release(lock);
+}
+
+
+
+
 void parentExit(int code)
 {
 	if (code > 0)
@@ -92,5 +146,7 @@ void parentExit(int code)
 		code = -code;
 		logprintf(parent_pid,"EXIT: Parent process with code %d.\n",code);
 	}
+	flushLogLimits(1);
+	stopLogWriter();
 	exit(code);
 }
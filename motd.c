@@ -1,187 +1,434 @@
+/*****************************************************************************
+ Message of the day. The pre and post login files are parsed once by the
+ parent into a list of tokens: spans of text, with \n already turned into
+ \r\n and the escape codes that can't change (uname etc) already filled in,
+ and the escape codes that have to be worked out per connection. Sending a
+ MOTD is then just filling in those few values and one writev().
+
+ The user counts are kept in shared memory for MOTD_USERS_TTL_SECS so a
+ burst of connections doesn't mean a burst of utmp scans.
+ *****************************************************************************/
+
 #include "globals.h"
 
-static char **user_list;
-static int unique_cnt;
+#define MOTD_USERS_TTL_SECS 5
+#define MOTD_VALUE_LEN      100
+
+/* type is 0 for text, else the escape code character */
+struct st_motd_token
+{
+	char type;
+	char *text;
+	int len;
+};
+
+struct st_motd
+{
+	struct st_motd_token *tokens;
+	int token_cnt;
+	int has_users;
+	int has_pty;
+};
+
+struct st_user_counts
+{
+	volatile pid_t lock;
+	time_t expires;
+	int logins;
+	int users;
+};
+
+static struct st_motd motd[NUM_MOTDS];
+static struct st_user_counts *user_counts = NULL;
+
+static void loadMOTD(int which);
+static void reloadMOTDs(void);
+static void addText(struct st_motd *m, char *text, int len, int *alloc);
+static void addEscape(struct st_motd *m, char type, int *alloc);
+static void freeMOTD(struct st_motd *m);
+static void getUserCounts(int *logins, int *users);
+static void countUsers(int *logins, int *users);
+static int  cmpName(const void *a, const void *b);
+
+
+/*** Called by the parent once the config has been read ***/
+void loadMOTDs(void)
+{
+	reloadMOTDs();
+	if (pre_motd_file) addWatch(pre_motd_file,reloadMOTDs);
+	if (post_motd_file) addWatch(post_motd_file,reloadMOTDs);
+}
+
 
-static int getUserCount(int unique);
-static void addUserToUniqueList(char *username);
 
 
-/*** Send the message of the day file translating any codes as we go ***/
-void sendMOTD(char *file)
+void freeMOTDs(void)
 {
-	FILE *fp;
+	freeMOTD(&motd[MOTD_PRE]);
+	freeMOTD(&motd[MOTD_POST]);
+}
+
+
+
+
+/*** Send the message of the day filling in the per connection escape
+     codes ***/
+void sendMOTD(int which)
+{
+	struct st_motd *m = &motd[which];
+	struct iovec *iov;
 	struct tm *tms;
-	struct utsname uts;	
 	time_t now;
-	u_char out[BUFFSIZE+1];
-	char str[100];
-	char c;
+	char *values;
+	char *val;
+	int logins;
+	int users;
+	int i;
+
+	if (!m->token_cnt) return;
+
+	iov = (struct iovec *)malloc(sizeof(struct iovec) * m->token_cnt);
+	values = (char *)malloc(MOTD_VALUE_LEN * m->token_cnt);
+	assert(iov && values);
+
+	time(&now);
+	tms = localtime(&now);
+	if (m->has_users) getUserCounts(&logins,&users);
+
+	for(i=0;i < m->token_cnt;++i)
+	{
+		if (!m->tokens[i].type)
+		{
+			iov[i].iov_base = m->tokens[i].text;
+			iov[i].iov_len = m->tokens[i].len;
+			continue;
+		}
+
+		val = values + i * MOTD_VALUE_LEN;
+		switch(m->tokens[i].type)
+		{
+		case 'd':
+			strftime(val,MOTD_VALUE_LEN,"%F",tms);
+			break;
+		case 'l':
+			snprintf(val,MOTD_VALUE_LEN,"%s",getPTYName());
+			break;
+		case 't':
+			strftime(val,MOTD_VALUE_LEN,"%T",tms);
+			break;
+		case 'u':
+			snprintf(val,MOTD_VALUE_LEN,"%d",users);
+			break;
+		case 'U':
+			snprintf(val,MOTD_VALUE_LEN,"%d",logins);
+			break;
+		default:
+			assert(0);
+		}
+		iov[i].iov_base = val;
+		iov[i].iov_len = strlen(val);
+	}
+	writeSockv(iov,m->token_cnt);
+
+	free(iov);
+	free(values);
+}
+
+
+
+
+/*** Parse the file into tokens. Same escape options as /etc/issue except
+     for 'x', 'y' and 'z' which are my own. ***/
+void loadMOTD(int which)
+{
+	struct st_motd *m = &motd[which];
+	struct utsname uts;
+	struct stat fs;
+	char *file;
+	char *data;
+	char *ptr;
+	char *end;
+	char *start;
+	int alloc;
 	int len;
-	int esc;
+	int fd;
 	int i;
 
-	if (!(fp = fopen(file,"r")))
+	freeMOTD(m);
+	if (!(file = (which == MOTD_PRE ? pre_motd_file : post_motd_file)))
+		return;
+
+	if ((fd = open(file,O_RDONLY)) == -1)
 	{
-		logprintf(master_pid,"ERROR: sendMOTD(): fopen(\"%s\"): %s\n",
+		logprintf(parent_pid,"ERROR: loadMOTD(): open(\"%s\"): %s\n",
 			file,strerror(errno));
 		return;
 	}
+	if (fstat(fd,&fs) == -1)
+	{
+		logprintf(parent_pid,"ERROR: loadMOTD(): fstat(): %s\n",
+			strerror(errno));
+		close(fd);
+		return;
+	}
+	data = (char *)malloc(fs.st_size + 1);
+	assert(data);
+	for(i=0;i < fs.st_size;i += len)
+	{
+		if ((len = read(fd,data + i,fs.st_size - i)) < 1)
+		{
+			logprintf(parent_pid,"ERROR: loadMOTD(): read(): %s\n",
+				len ? strerror(errno) : "Unexpected end of file");
+			close(fd);
+			free(data);
+			return;
+		}
+	}
+	close(fd);
 
-	/* Get data for escape codes. Might not be used but keeps code tidier */
-	time(&now);
-	tms = localtime(&now);
 	uname(&uts);
+	end = data + fs.st_size;
+	alloc = 0;
 
-	/* Read in the file a character at a time in order to find the escape
-	   codes easily */
-	for(esc=len=0;(i=getc(fp)) != EOF;)
+	for(ptr=start=data;ptr < end;++ptr)
 	{
-		c = (char)i;
 		/* Convert \n to \r\n */
-		if (c == '\n')
+		if (*ptr == '\n')
 		{
-			writeSock(out,len);
-			len = 0;
-			out[len++] = '\r';
-			out[len++] = '\n';
+			addText(m,start,(int)(ptr - start),&alloc);
+			addText(m,"\r\n",2,&alloc);
+			start = ptr + 1;
 			continue;
 		}
+		if (*ptr != '\\') continue;
 
-		if (c == '\\')
-		{
-			if (esc)
-			{
-				out[len++] = '\\';
-				esc = 0;
-			}
-			else esc = 1;
-		}
-		else if (esc)
+		addText(m,start,(int)(ptr - start),&alloc);
+
+		/* A newline still goes out and the escape applies to the
+		   character after it */
+		for(++ptr;ptr < end && *ptr == '\n';++ptr)
+			addText(m,"\r\n",2,&alloc);
+		if (ptr == end)
 		{
-			writeSock(out,len);
-			len = 0;
-
-			/* Same escape options as /etc/issue except for 'x', 
-			   'y' and 'z' which are my own */
-			switch(c)
-			{
-			case 'b':
-				/* Can't get baud rate for a pty so just 
-				   return zero */
-				sockprintf("0");
-				break;
-			case 'd':
-				strftime(str,sizeof(str),"%F",tms);
-				sockprintf(str);
-				break;
-			case 'l':
-				sockprintf(getPTYName());
-				break;
-			case 'm':
-				sockprintf(uts.machine);
-				break;
-			case 'n':
-				sockprintf(uts.nodename);
-				break;
-			case 'r':
-				sockprintf(uts.release);
-				break;
-			case 's':
-				sockprintf(uts.sysname);
-				break;
-			case 't':
-				strftime(str,sizeof(str),"%T",tms);
-				sockprintf(str);
-				break;
-			case 'u':
-				sprintf(str,"%d",getUserCount(1));
-				sockprintf(str);
-				break;
-			case 'U':
-				sprintf(str,"%d",getUserCount(0));
-				sockprintf(str);
-				break;
-			case 'v':
-				sockprintf(uts.version);
-				break;
-			case 'x':
-				sockprintf(SVR_NAME);
-				break;
-			case 'y':
-				sockprintf(SVR_VERSION);
-				break;
-			case 'z':
-				sockprintf(BUILD_DATE);
-				break;
-			default:	
-				sockprintf("??");
-			}
-			esc = 0;
+			addText(m,"\\",1,&alloc);
+			start = ptr;
+			break;
 		}
-		else out[len++] = c;
-		
-		if (len == BUFFSIZE)
+		start = ptr + 1;
+
+		switch(*ptr)
 		{
-			writeSock(out,len);
-			len = 0;
+		case '\\':
+			addText(m,"\\",1,&alloc);
+			break;
+		case 'b':
+			/* Can't get baud rate for a pty so just return zero */
+			addText(m,"0",1,&alloc);
+			break;
+		case 'm':
+			addText(m,uts.machine,strlen(uts.machine),&alloc);
+			break;
+		case 'n':
+			addText(m,uts.nodename,strlen(uts.nodename),&alloc);
+			break;
+		case 'r':
+			addText(m,uts.release,strlen(uts.release),&alloc);
+			break;
+		case 's':
+			addText(m,uts.sysname,strlen(uts.sysname),&alloc);
+			break;
+		case 'v':
+			addText(m,uts.version,strlen(uts.version),&alloc);
+			break;
+		case 'x':
+			addText(m,SVR_NAME,strlen(SVR_NAME),&alloc);
+			break;
+		case 'y':
+			addText(m,SVR_VERSION,strlen(SVR_VERSION),&alloc);
+			break;
+		case 'z':
+			addText(m,BUILD_DATE,strlen(BUILD_DATE),&alloc);
+			break;
+		case 'u':
+		case 'U':
+			m->has_users = 1;
+			addEscape(m,*ptr,&alloc);
+			break;
+		case 'l':
+			m->has_pty = 1;
+			/* Fall through */
+		case 'd':
+		case 't':
+			addEscape(m,*ptr,&alloc);
+			break;
+		default:
+			addText(m,"??",2,&alloc);
 		}
 	}
-	if (esc) out[len++] = '\\';
-	if (len) writeSock(out,len);
-	fclose(fp);
+	addText(m,start,(int)(ptr - start),&alloc);
+	free(data);
+}
+
+
+
+
+/*** Returns 1 if the MOTD shows the PTY name so it has to exist before
+     it's sent ***/
+int motdUsesPTY(int which)
+{
+	return motd[which].has_pty;
+}
+
+
+
+
+/*** Also the watch callback ***/
+void reloadMOTDs(void)
+{
+	loadMOTD(MOTD_PRE);
+	loadMOTD(MOTD_POST);
+
+	/* Kept over a restart as it's only a cache */
+	if (!user_counts &&
+	    (motd[MOTD_PRE].has_users || motd[MOTD_POST].has_users))
+	{
+		user_counts = (struct st_user_counts *)mapSharedMem(
+			sizeof(struct st_user_counts));
+	}
+}
+
+
+
+
+/*** Append to the previous text token if there is one so adjacent spans
+     and filled in values become one iovec ***/
+void addText(struct st_motd *m, char *text, int len, int *alloc)
+{
+	struct st_motd_token *tok;
+
+	if (!len) return;
+	if (m->token_cnt && !m->tokens[m->token_cnt-1].type)
+	{
+		tok = &m->tokens[m->token_cnt-1];
+		tok->text = (char *)realloc(tok->text,tok->len + len);
+		assert(tok->text);
+		memcpy(tok->text + tok->len,text,len);
+		tok->len += len;
+		return;
+	}
+	addEscape(m,0,alloc);
+	tok = &m->tokens[m->token_cnt-1];
+	tok->text = (char *)malloc(len);
+	assert(tok->text);
+	memcpy(tok->text,text,len);
+	tok->len = len;
+}
+
+
+
+
+void addEscape(struct st_motd *m, char type, int *alloc)
+{
+	if (m->token_cnt == *alloc)
+	{
+		*alloc = *alloc ? *alloc * 2 : 16;
+		m->tokens = (struct st_motd_token *)realloc(
+			m->tokens,sizeof(struct st_motd_token) * *alloc);
+		assert(m->tokens);
+	}
+	m->tokens[m->token_cnt].type = type;
+	m->tokens[m->token_cnt].text = NULL;
+	m->tokens[m->token_cnt].len = 0;
+	++m->token_cnt;
 }
 
 
 
 
-/*** Get the number of users/logins on the system for MOTD ***/
-int getUserCount(int unique)
+void freeMOTD(struct st_motd *m)
+{
+	int i;
+
+	for(i=0;i < m->token_cnt;++i) FREE(m->tokens[i].text);
+	FREE(m->tokens);
+	bzero(m,sizeof(struct st_motd));
+}
+
+
+
+
+/*** Use the shared counts if they're recent enough else rescan utmp ***/
+void getUserCounts(int *logins, int *users)
+{
+	time_t now;
+
+	if (!user_counts)
+	{
+		countUsers(logins,users);
+		return;
+	}
+
+	time(&now);
+	shmLock(&user_counts->lock);
+	if (user_counts->expires <= now)
+	{
+		countUsers(&user_counts->logins,&user_counts->users);
+		user_counts->expires = now + MOTD_USERS_TTL_SECS;
+	}
+	*logins = user_counts->logins;
+	*users = user_counts->users;
+	shmUnlock(&user_counts->lock);
+}
+
+
+
+
+/*** Get the number of logins and unique users on the system. The names
+     are sorted so the unique count is one pass. ***/
+void countUsers(int *logins, int *users)
 {
 	struct utmpx *ux;
+	char *names = NULL;
+	int alloc = 0;
 	int cnt;
 	int i;
 
-	user_list = NULL;
-	unique_cnt = 0;
-
 	setutxent();
 	for(cnt=0;(ux = getutxent());)
 	{
-		if (ux->ut_type == USER_PROCESS)
+		if (ux->ut_type != USER_PROCESS) continue;
+		if (cnt == alloc)
 		{
-			if (unique)
-				addUserToUniqueList(ux->ut_user);
-			else
-				++cnt;
+			alloc = alloc ? alloc * 2 : 64;
+			names = (char *)realloc(names,alloc * sizeof(ux->ut_user));
+			assert(names);
 		}
+		memcpy(names + cnt * sizeof(ux->ut_user),
+			ux->ut_user,sizeof(ux->ut_user));
+		++cnt;
 	}
 	endutxent();
 
-	if (unique)
+	*logins = cnt;
+	if (!cnt)
+	{
+		*users = 0;
+		return;
+	}
+	qsort(names,cnt,sizeof(ux->ut_user),cmpName);
+	for(i=1,*users=1;i < cnt;++i)
 	{
-		/* Free the list */
-		for(i=0;i < unique_cnt;++i) free(user_list[i]);
-		free(user_list);
-		return unique_cnt;
+		if (cmpName(names + (i-1) * sizeof(ux->ut_user),
+		            names + i * sizeof(ux->ut_user))) ++*users;
 	}
-	return cnt;
+	free(names);
 }
 
 
 
 
-/*** Add a username to the unique list if not there ***/
-void addUserToUniqueList(char *username)
-{       
-	int i;
-	for(i=0;i < unique_cnt;++i) if (!strcmp(user_list[i],username)) return;
-	
-	user_list = (char **)realloc(user_list,(unique_cnt + 1) * sizeof(char **));     
-	assert(user_list);
-	
-	user_list[unique_cnt] = strdup(username);
-	assert(user_list[unique_cnt]);
-	
-	++unique_cnt;
-}      
+int cmpName(const void *a, const void *b)
+{
+	return strncmp((const char *)a,(const char *)b,
+		sizeof(((struct utmpx *)0)->ut_user));
+}
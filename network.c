@@ -1,8 +1,10 @@
 #include "globals.h"
+#include "capture.h"
 
 #define HEXDUMP_CHARS 10
 #define DELETE_KEY    127
 
+static void traceData(u_char *start, u_char *end, int rx);
 static void hexdump(u_char *start, u_char *end, int rx);
 static void processChar(u_char c);
 static void processLine(void);
@@ -20,6 +22,7 @@ void createListenSocket(int inum)
 			strerror(errno));
 		exit(1);
 	}
+	fcntl(iface[inum].sock,F_SETFD,FD_CLOEXEC);
 
 	on = 1;
 	if (setsockopt(
@@ -74,7 +77,7 @@ void readSock(void)
 
 	if (buffpos >= BUFFSIZE)
 	{
-		sockprintf("ERROR: Buffer overrun.\n");
+		SOCKSTR("ERROR: Buffer overrun.\r\n");
 		logprintf(master_pid,"ERROR: readSock(): Buffer overrun.");
 		masterExit(1);
 	}
@@ -94,7 +97,7 @@ void readSock(void)
 	end = buff + buffpos + len;
 	buff[buffpos+len] = 0;
 
-	if (flags.hexdump) hexdump(buff+buffpos,end,1);
+	if (flags.hexdump || flags.capture) traceData(buff+buffpos,end,1);
 
 	/*** Loop through whats currently in the buffer ***/
 	for(p1=buff;p1 < end;++p1)
@@ -139,6 +142,17 @@ void readSock(void)
 
 
 
+/*** Hexdump and/or capture what's gone through the socket ***/
+void traceData(u_char *start, u_char *end, int rx)
+{
+	if (flags.hexdump) hexdump(start,end,rx);
+	if (flags.capture)
+		captureData(start,(int)(end - start),rx ? CAPTURE_RX : CAPTURE_TX);
+}
+
+
+
+
 /*** Hexdump to the log file ***/
 void hexdump(u_char *start, u_char *end, int rx)
 {
@@ -226,7 +240,7 @@ void processChar(u_char c)
 	{
 	case '\r':
 	case '\n':
-		if (print_char && state != STATE_PWD) sockprintf("\r\n");
+		if (print_char && state != STATE_PWD) SOCKSTR("\r\n");
 		processLine();
 		return;
 
@@ -234,7 +248,7 @@ void processChar(u_char c)
 		if (line_buffpos)
 		{
 			line_buffpos--;
-			if (print_char) sockprintf("\b \b");
+			if (print_char) SOCKSTR("\b \b");
 		}
 		return;
 	default:
@@ -254,6 +268,9 @@ void processChar(u_char c)
 /*** Do something with the line in the buffer ***/
 void processLine(void)
 {
+	int locked = 0;
+	int ret;
+
 	line[line_buffpos] = 0;
 	line_buffpos = 0;
 
@@ -262,7 +279,7 @@ void processLine(void)
 	case STATE_LOGIN:
 		if (!line[0])
 		{
-			sockprintf(login_prompt);
+			sendMsg(MSG_LOGIN_PROMPT);
 			return;
 		}
 		if (loginAllowed((char *)line))
@@ -274,29 +291,51 @@ void processLine(void)
 		   the username may have been auto filled in but the user wants
 		   to use a different one and pressing return on the password 
 		   is the easiest way to get back to the login prompt */
-		sockprintf("\r\n");
+		SOCKSTR("\r\n");
 		flags.echo = 1;
-		switch(validatePwd((char *)line))
+
+		/* If locked out don't even bother checking the password */
+		if (lockedOut(LOCKOUT_IP,ipaddrstr) ||
+		    lockedOut(LOCKOUT_USER,username))
+		{
+			logprintf(master_pid,"LOCKOUT: Login of user \"%s\" refused, locked out.\n",
+				username);
+			locked = 1;
+			ret = 0;
+		}
+		else ret = validatePwd((char *)line);
+
+		switch(ret)
 		{
 		case -1:
-			sockprintf("\r\n%s\r\n\r\n",login_svrerr_msg);
+			sendMsg(MSG_LOGIN_SVRERR);
 			logprintf(master_pid,"ERROR: User \"%s\": processLine(): validatePwd() returned -1.\n",username);
 			masterExit(0);
 			/* Won't get here */
 			break;
 		case 0:
+			/* A refused attempt isn't scored or anyone could keep
+			   a username locked out forever by trying it before
+			   the score decays */
+			if (!locked)
+			{
+				addLoginFail(LOCKOUT_IP,ipaddrstr);
+				addLoginFail(LOCKOUT_USER,username);
+			}
 			checkLoginAttempts();
-			sockprintf("%s\r\n",login_incorrect_msg);
+			sendMsg(MSG_LOGIN_INCORRECT);
 
 			if (login_pause_secs) sleep(login_pause_secs);
-			sockprintf(login_prompt);
+			sendMsg(MSG_LOGIN_PROMPT);
 			setState(STATE_LOGIN);
 			break;
 		case 1:
 			logprintf(master_pid,"User \"%s\" validated.\n",username);
-			if (post_motd_file) sendMOTD(post_motd_file);
+			clearLoginFails(LOCKOUT_USER,username);
+			if (post_motd_file) sendMOTD(MOTD_POST);
 			setState(STATE_PIPE);
 			runSlave();
+			startRecording();
 			break;
 		default:
 			assert(0);
@@ -324,12 +363,12 @@ void writeSock(u_char *data, int len)
 		/* Retry 3 times */
 		for(i=0;i < 3;++i)
 		{
-			if (i) logprintf(master_pid,"Write retry #%d\n",i);
+			if (i) LOGPRINTF(LOG_DEBUG,master_pid,"Write retry #%d\n",i);
 			if ((l = write(sock,data + bytes,len - bytes)) == -1)
 			{
 				if (errno == EINTR) 
 				{
-					logprintf(master_pid,"ERROR: writeSock(): write(): Interrupted");
+					LOGPRINTF(LOG_DEBUG,master_pid,"writeSock(): write(): Interrupted.\n");
 					continue;
 				}
 				logprintf(master_pid,"ERROR: writeSock(): write(): %s\n",strerror(errno));
@@ -343,5 +382,49 @@ void writeSock(u_char *data, int len)
 		}
 		bytes += l;
 	}
-	if (flags.hexdump) hexdump(data,data+len,0);
+	if (flags.hexdump || flags.capture) traceData(data,data+len,0);
+}
+
+
+
+
+/*** As writeSock() but gathers the buffers into one write. Falls back to
+     writeSock() for whatever is left after a partial write. ***/
+void writeSockv(struct iovec *iov, int iov_cnt)
+{
+	int bytes;
+	int i;
+
+	do
+	{
+		bytes = writev(sock,iov,iov_cnt);
+	} while(bytes == -1 && errno == EINTR);
+
+	if (bytes == -1)
+	{
+		logprintf(master_pid,"ERROR: writeSockv(): writev(): %s\n",strerror(errno));
+		bytes = 0;
+	}
+	for(i=0;i < iov_cnt;++i)
+	{
+		if ((size_t)bytes >= iov[i].iov_len)
+		{
+			bytes -= iov[i].iov_len;
+			if (flags.hexdump || flags.capture)
+			{
+				traceData((u_char *)iov[i].iov_base,
+					(u_char *)iov[i].iov_base + iov[i].iov_len,0);
+			}
+			continue;
+		}
+		/* Trace the part that went first so the trace stays in order as
+		   writeSock() traces the rest itself */
+		if ((flags.hexdump || flags.capture) && bytes)
+		{
+			traceData((u_char *)iov[i].iov_base,
+				(u_char *)iov[i].iov_base + bytes,0);
+		}
+		writeSock((u_char *)iov[i].iov_base + bytes,iov[i].iov_len - bytes);
+		bytes = 0;
+	}
 }
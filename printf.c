@@ -1,53 +1,178 @@
 #include "globals.h"
 
+#define LOG_LINE_LEN 1000
 
-/*** Do a printf down the socket ***/
+static void renderMsg(int msg, char *fmt, ...);
+static int  addCRs(u_char *str, int len);
+
+
+/*** Do a printf down the socket. Only for text that changes, the
+     configured messages are sent with sendMsg() and constant strings with
+     SOCKSTR(). ***/
 void sockprintf(char *fmt, ...)
 {
 	va_list args;
-	u_char out1[BUFFSIZE];
-	u_char out2[BUFFSIZE*2];
-	u_char *s1;
-	u_char *s2;
+	u_char out[BUFFSIZE*2];
 	int len;
 
 	va_start(args,fmt);
-	vsnprintf((char *)out1,BUFFSIZE,fmt,args);
+	len = vsnprintf((char *)out,BUFFSIZE,fmt,args);
 	va_end(args);
 
-	/* Convert \n to \r\n */
-	for(s1=out1,s2=out2,len=0;*s1;++s1,++s2,++len)
+	if (len < 1) return;
+	if (len >= BUFFSIZE) len = BUFFSIZE - 1;
+	writeSock(out,addCRs(out,len));
+}
+
+
+
+
+/*** Called once the config has been read. Puts the prompts and messages
+     together with the line breaks that go around them into what's sent
+     down the wire so nothing has to be formatted to send them. ***/
+void renderMessages(void)
+{
+	freeMessages();
+	renderMsg(MSG_LOGIN_PROMPT,"%s",login_prompt);
+	renderMsg(MSG_PWD_PROMPT,"%s",pwd_prompt);
+	renderMsg(MSG_LOGIN_INCORRECT,"%s\r\n",login_incorrect_msg);
+	renderMsg(MSG_LOGIN_MAX_ATTEMPTS,"\r\n%s\r\n\r\n",login_max_attempts_msg);
+	renderMsg(MSG_LOGIN_SVRERR,"\r\n%s\r\n\r\n",login_svrerr_msg);
+	renderMsg(MSG_LOGIN_TIMEOUT,"\r\n\r\n%s\r\n\r\n",login_timeout_msg);
+	renderMsg(MSG_BANNED_USER,"%s\r\n%s",banned_user_msg,login_prompt);
+	if (banned_ip_msg) renderMsg(MSG_BANNED_IP,"%s\r\n",banned_ip_msg);
+	renderMsg(MSG_MAX_SESSIONS,"%s\r\n",max_sessions_msg);
+}
+
+
+
+
+void freeMessages(void)
+{
+	int i;
+
+	for(i=0;i < NUM_MSGS;++i)
 	{
-		if (*s1 == '\n')
-		{
-			*s2++ = '\r';
-			++len;
-		}
-		*s2 = *s1;
+		FREE(wire_msg[i].data);
+		wire_msg[i].data = NULL;
+		wire_msg[i].len = 0;
 	}
-	*s2 = 0;
+}
+
+
+
 
-	if (len) writeSock(out2,len);
+/*** Does nothing if the message isn't set ***/
+void sendMsg(int msg)
+{
+	if (wire_msg[msg].len) writeSock(wire_msg[msg].data,wire_msg[msg].len);
 }
 
 
 
 
+void renderMsg(int msg, char *fmt, ...)
+{
+	va_list args;
+	char *str;
+	int len;
+
+	va_start(args,fmt);
+	len = vasprintf(&str,fmt,args);
+	va_end(args);
+	assert(len != -1);
+
+	/* Room for a \r before every \n */
+	str = (char *)realloc(str,len * 2 + 1);
+	assert(str);
+	wire_msg[msg].data = (u_char *)str;
+	wire_msg[msg].len = addCRs((u_char *)str,len);
+}
+
+
+
+
+/*** Turns \n into \r\n in place, leaving any that already have the \r
+     alone. The buffer must have room for the extra characters. Returns
+     the new length. ***/
+int addCRs(u_char *str, int len)
+{
+	u_char *s1;
+	u_char *s2;
+	int cnt;
+	int i;
+
+	for(i=cnt=0;i < len;++i)
+		if (str[i] == '\n' && (!i || str[i-1] != '\r')) ++cnt;
+	if (!cnt) return len;
+
+	/* Work back from the end so nothing is overwritten before it's been
+	   moved */
+	for(s1=str+len-1,s2=s1+cnt;s1 >= str;--s1)
+	{
+		*s2-- = *s1;
+		if (*s1 == '\n' && (s1 == str || s1[-1] != '\r')) *s2-- = '\r';
+	}
+	return len + cnt;
+}
+
+
+
+
+/*** Use LOGPRINTF() for debug and trace and logprintfLimit() for anything
+     that can be triggered from outside ***/
 void logprintf(pid_t pid, char *fmt, ...)
 {
-	struct tm *tms;
 	va_list args;
+
+	va_start(args,fmt);
+	vlogprintf(pid,fmt,args);
+	va_end(args);
+}
+
+
+
+
+/*** Once the log writer is running the line goes into the log ring and
+     it does the rest ***/
+void vlogprintf(pid_t pid, char *fmt, va_list args)
+{
+	struct tm *tms;
+	va_list args2;
 	FILE *fp;
 	time_t now;
 	char tstr[30];
 	char pre[40];
+	char line[LOG_LINE_LEN];
 	char *fstr;
+	int len;
 	int fd;
 	int i;
 
 	/* Don't print to stdout if we're a daemon */
 	if (!log_file && flags.daemon) return;
 
+	/* Only need to look at the format if info is being filtered */
+	if (log_level < LOG_INFO &&
+	    (strstr(fmt,"ERROR:") ? LOG_ERROR :
+	     strstr(fmt,"WARNING:") ? LOG_WARN : LOG_INFO) > log_level) return;
+
+	/* Most lines fit on the stack */
+	va_copy(args2,args);
+	len = vsnprintf(line,sizeof(line),fmt,args2);
+	va_end(args2);
+	if (len < 0) return;
+	if (len < (int)sizeof(line))
+		fstr = line;
+	else if ((len = vasprintf(&fstr,fmt,args)) == -1)
+		return;
+
+	if (logRingWrite(pid,fstr,len))
+	{
+		if (fstr != line) free(fstr);
+		return;
+	}
+
 	/* Only do the preamble if we have a pid */
 	if (pid)
 	{
@@ -58,14 +183,6 @@ void logprintf(pid_t pid, char *fmt, ...)
 	}
 	else pre[0] = 0;
 
-	va_start(args,fmt);
-	if (vasprintf(&fstr,fmt,args) == -1)
-	{
-		va_end(args);
-		return;
-	}
-	va_end(args);
-
 	if (log_file)
 	{
 		if ((fp = fopen(log_file,"a")))
@@ -101,5 +218,5 @@ void logprintf(pid_t pid, char *fmt, ...)
 		printf("%s%s",pre,fstr);
 		fflush(stdout);
 	}
-	free(fstr);
+	if (fstr != line) free(fstr);
 }
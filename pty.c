@@ -1,54 +1,175 @@
+/*****************************************************************************
+ PTY master handling. With a shell_program a master doesn't open its PTY
+ until it's about to start the slave so a connection that never logs in
+ doesn't use one. The exception is when the pre login MOTD shows the PTY
+ name.
+
+ grantpt() can be slow and serialises on devpts so the parent keeps a pool
+ of up to pty_pool_size ready PTY masters which it tops up while it's idle.
+ When the PTY is opened as the master starts the one for a new session is
+ picked before the fork so the master inherits it and the parent closes
+ its copy. PTYs aren't put back in the pool after a
+ session as something the user left running could still have the slave
+ side open.
+ *****************************************************************************/
+
 #include "globals.h"
 
+static int *pool = NULL;
+static int pool_cnt = 0;
+static int pool_alloc = 0;
+static int pooled_ptym = -1;
+static u_long pool_hits = 0;
+static u_long pool_misses = 0;
 
-/*** Open and set up the pty master. This is the network side of the PTY so
-     data read from the socket get written to this and data from this gets
-     sent down the socket. ***/
-int openPTYMaster(void)
+static int  poolSize(void);
+
+
+/*** Called in the parent's main loop ***/
+void fillPTYPool(void)
 {
-	if ((ptym = posix_openpt(O_RDWR | O_NOCTTY)) == -1)
+	int size = poolSize();
+	int fd;
+
+	if (pool_alloc != size)
+	{
+		for(;pool_cnt > size;--pool_cnt) close(pool[pool_cnt-1]);
+		pool_alloc = size;
+		pool = (int *)realloc(pool,sizeof(int) * (pool_alloc ? pool_alloc : 1));
+		assert(pool);
+	}
+	while(pool_cnt < size)
 	{
-		logprintf(master_pid,"ERROR: openPTYMaster(): posix_openpt(): %s\n",
-			strerror(errno));
-		goto ERROR;
+		if ((fd = newPTY(parent_pid,"fillPTYPool")) == -1) break;
+		pool[pool_cnt++] = fd;
 	}
+}
 
-	if (grantpt(ptym) == -1)
+
+
+
+/*** Called in the parent before forking a master ***/
+void takePooledPTY(void)
+{
+	if (!poolSize()) return;
+	if (pool_cnt)
 	{
-		logprintf(master_pid,"ERROR: openPTYMaster(): grantpt(): %s\n",
-			strerror(errno));
-		close(ptym);
-		goto ERROR;
+		pooled_ptym = pool[--pool_cnt];
+		++pool_hits;
 	}
+	else ++pool_misses;
+}
+
+
+
+
+/*** Called by both sides after the fork. The master keeps the PTY it was
+     given and closes the rest, the parent closes the one given away. ***/
+void forkedPTYPool(pid_t pid)
+{
+	int i;
+
+	if (pid)
+	{
+		if (pooled_ptym != -1) close(pooled_ptym);
+		pooled_ptym = -1;
+		return;
+	}
+	for(i=0;i < pool_cnt;++i) close(pool[i]);
+	pool_cnt = 0;
+}
+
+
+
+
+/*** Called by the parent on restart ***/
+void freePTYPool(void)
+{
+	for(;pool_cnt;--pool_cnt) close(pool[pool_cnt-1]);
+	FREE(pool);
+	pool = NULL;
+	pool_alloc = 0;
+}
+
+
+
 
-	if (unlockpt(ptym) == -1)
+/*** Open and set up the pty master. This is the network side of the PTY so
+     data read from the socket get written to this and data from this gets
+     sent down the socket. ***/
+int openPTYMaster(void)
+{
+	if (poolSize())
+	{
+		LOGPRINTF(LOG_DEBUG,master_pid,"PTY pool %s. Hits = %lu, misses = %lu\n",
+			pooled_ptym == -1 ? "miss" : "hit",pool_hits,pool_misses);
+	}
+	if (pooled_ptym != -1)
 	{
-		logprintf(master_pid,"ERROR: openPTYMaster(): unlockpt(): %s\n",
-			strerror(errno));
-		close(ptym);
+		ptym = pooled_ptym;
+		pooled_ptym = -1;
+		return 1;
 	}
-	else return 1;
+	if ((ptym = newPTY(master_pid,"openPTYMaster")) != -1) return 1;
 
-	ERROR:
-	sockprintf("ERROR: Open PTY master failed, can't continue.\n");
+	SOCKSTR("ERROR: Open PTY master failed, can't continue.\r\n");
 	return 0;
 }
 
 
 
 
-/*** Open the PTY slave which is the other end of the PTY pipe and is the
-     controlling terminal of login/shell which read and write to this. ***/
-int openPTYSlave(void)
+/*** With a shell program we do the login ourselves and the PTY isn't
+     wanted until it has succeeded, unless the pre login MOTD shows its
+     name with \l. A login program is started straight away so there's
+     nothing to be saved by waiting. ***/
+int deferPTY(void)
 {
-	if ((ptys = open((char *)ptsname(ptym),O_RDWR)) == -1)
+	return shell_exec_argv && !motdUsesPTY(MOTD_PRE);
+}
+
+
+
+
+/*** The pool is only used if the PTY is opened when the master starts ***/
+int poolSize(void)
+{
+	return deferPTY() ? 0 : pty_pool_size;
+}
+
+
+
+
+/*** Returns the unlocked PTY master or -1. Also used for the login
+     pool. ***/
+int newPTY(pid_t pid, char *func)
+{
+	int fd;
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1)
+	{
+		logprintf(pid,"ERROR: %s(): posix_openpt(): %s\n",
+			func,strerror(errno));
+		return -1;
+	}
+
+	/* The parent spawns pooled logins while holding every pool PTY */
+	fcntl(fd,F_SETFD,FD_CLOEXEC);
+
+	if (grantpt(fd) == -1)
+	{
+		logprintf(pid,"ERROR: %s(): grantpt(): %s\n",func,strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (unlockpt(fd) == -1)
 	{
-		sockprintf("ERROR: Open PTY slave failed, can't continue.\n");
-		logprintf(slave_pid,"ERROR: openPTYSlave(): open(): %s\n",
-			strerror(errno));
-		return 0;
+		logprintf(pid,"ERROR: %s(): unlockpt(): %s\n",func,strerror(errno));
+		close(fd);
+		return -1;
 	}
-	return 1;
+	return fd;
 }
 
 
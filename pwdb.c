@@ -0,0 +1,197 @@
+/*****************************************************************************
+ In memory copy of the telnetd password file. The parent loads it once and
+ indexes it in a hash table keyed on username and the forked children get it
+ for free via copy on write. It is reloaded by the parent when the file
+ changes. The new copy is fully built before it replaces the old one so a
+ child forked at any point sees either the old or the new file, never a
+ partial one.
+ *****************************************************************************/
+
+#include "globals.h"
+
+struct st_pwdb
+{
+	char *data;
+	struct st_pwd_entry *entries;
+	int entry_cnt;
+	int *table;
+	int table_size;
+};
+
+static struct st_pwdb *pwdb = NULL;
+
+static void     freeDB(struct st_pwdb *db);
+static uint32_t hashUser(char *uname);
+
+
+/*** Read and index the file. If this fails any current copy is kept. ***/
+int loadPwdDB(void)
+{
+	struct st_pwdb *db;
+	struct st_pwd_entry *entry;
+	struct stat fs;
+	char *field[NUM_PWD_FIELDS];
+	char *ptr;
+	char *end;
+	uint32_t h;
+	int linenum;
+	int fd;
+	int len;
+	int i;
+
+	if ((fd = open(pwd_file,O_RDONLY)) == -1)
+	{
+		logprintf(parent_pid,"ERROR: loadPwdDB(): open(\"%s\"): %s\n",
+			pwd_file,strerror(errno));
+		return 0;
+	}
+	if (fstat(fd,&fs) == -1)
+	{
+		logprintf(parent_pid,"ERROR: loadPwdDB(): fstat(): %s\n",
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	db = (struct st_pwdb *)calloc(1,sizeof(struct st_pwdb));
+	assert(db);
+	db->data = (char *)malloc(fs.st_size + 1);
+	assert(db->data);
+
+	for(i=0;i < fs.st_size;i += len)
+	{
+		if ((len = read(fd,db->data + i,fs.st_size - i)) < 1)
+		{
+			logprintf(parent_pid,"ERROR: loadPwdDB(): read(): %s\n",
+				len ? strerror(errno) : "Unexpected end of file");
+			close(fd);
+			freeDB(db);
+			return 0;
+		}
+	}
+	close(fd);
+	end = db->data + fs.st_size;
+	*end = 0;
+
+	/* Split the lines in place. splitPwdLine() null terminates the
+	   fields so they can be pointed to directly. */
+	for(ptr=db->data,linenum=1;ptr < end;++linenum)
+	{
+		ptr = splitPwdLine(ptr,end,field);
+		if (!field[PWD_USER] || !field[PWD_USER][0]) continue;
+
+		db->entries = (struct st_pwd_entry *)realloc(
+			db->entries,
+			sizeof(struct st_pwd_entry) * (db->entry_cnt + 1));
+		assert(db->entries);
+		entry = &db->entries[db->entry_cnt++];
+		memcpy(entry->field,field,sizeof(field));
+		entry->linenum = linenum;
+	}
+
+	/* Power of 2 and at most half full */
+	for(db->table_size=16;
+	    db->table_size < db->entry_cnt * 2;db->table_size <<= 1);
+	db->table = (int *)malloc(sizeof(int) * db->table_size);
+	assert(db->table);
+	for(i=0;i < db->table_size;++i) db->table[i] = -1;
+
+	for(i=0;i < db->entry_cnt;++i)
+	{
+		h = hashUser(db->entries[i].field[PWD_USER]);
+		for(;;h++)
+		{
+			h &= (db->table_size - 1);
+			if (db->table[h] == -1) break;
+
+			/* First entry wins as it would when scanning the file */
+			if (!strcmp(db->entries[db->table[h]].field[PWD_USER],
+			            db->entries[i].field[PWD_USER])) goto NEXT;
+		}
+		db->table[h] = i;
+		NEXT:
+		continue;
+	}
+
+	/* Swap it in */
+	freeDB(pwdb);
+	pwdb = db;
+
+	logprintf(parent_pid,"Password file \"%s\" loaded, %d users.\n",
+		pwd_file,pwdb->entry_cnt);
+	return 1;
+}
+
+
+
+
+void freePwdDB(void)
+{
+	freeDB(pwdb);
+	pwdb = NULL;
+}
+
+
+
+
+/*** Watch callback ***/
+void reloadPwdDB(void)
+{
+	loadPwdDB();
+}
+
+
+
+
+int pwdDBLoaded(void)
+{
+	return (pwdb != NULL);
+}
+
+
+
+
+/*** Returns NULL if not found ***/
+struct st_pwd_entry *findPwdEntry(char *uname)
+{
+	uint32_t h;
+	int i;
+
+	if (!pwdb) return NULL;
+
+	for(h=hashUser(uname);;h++)
+	{
+		h &= (pwdb->table_size - 1);
+		if ((i = pwdb->table[h]) == -1) return NULL;
+		if (!strcmp(pwdb->entries[i].field[PWD_USER],uname))
+			return &pwdb->entries[i];
+	}
+	return NULL;
+}
+
+
+
+
+void freeDB(struct st_pwdb *db)
+{
+	if (!db) return;
+	FREE(db->data);
+	FREE(db->entries);
+	FREE(db->table);
+	free(db);
+}
+
+
+
+
+/*** FNV-1a ***/
+uint32_t hashUser(char *uname)
+{
+	uint32_t h = 2166136261U;
+	for(;*uname;++uname)
+	{
+		h ^= (u_char)*uname;
+		h *= 16777619U;
+	}
+	return h;
+}
@@ -0,0 +1,155 @@
+/*****************************************************************************
+ Connection rate limiting done by the parent straight after accept() so a
+ flood of connections doesn't cost a fork each. There are token buckets per
+ source IP, per /24 subnet and one global one. Each bucket holds up to
+ "burst" tokens and refills at "per minute" tokens a minute. A connection
+ needs a token from every enabled bucket.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define RATE_TABLE_BITS 12
+#define RATE_TABLE_SIZE (1 << RATE_TABLE_BITS)
+#define RATE_PROBES     8
+
+struct st_bucket
+{
+	uint32_t key;
+	double tokens;
+	double updated;
+	int used;
+};
+
+static struct st_bucket ip_table[RATE_TABLE_SIZE];
+static struct st_bucket subnet_table[RATE_TABLE_SIZE];
+static struct st_bucket global_bucket;
+static u_long rejects[NUM_RATE_TYPES];
+static char *rate_name[NUM_RATE_TYPES] = { "IP", "Subnet", "Global" };
+
+static struct st_bucket *findBucket(struct st_bucket *table, uint32_t key, int type, double now);
+static void   refill(struct st_bucket *bucket, int type, double now);
+static double getTime(void);
+
+
+void initRateLimits(void)
+{
+	bzero(ip_table,sizeof(ip_table));
+	bzero(subnet_table,sizeof(subnet_table));
+	bzero(&global_bucket,sizeof(global_bucket));
+}
+
+
+
+
+/*** Returns 1 if the connection should be refused. If exempt is set only
+     the global bucket applies. ***/
+int rateLimited(struct in_addr addr, int exempt)
+{
+	struct st_bucket *bucket[NUM_RATE_TYPES];
+	uint32_t ip;
+	double now;
+	int type;
+
+	ip = ntohl(addr.s_addr);
+	now = getTime();
+
+	if (!exempt)
+	{
+		bucket[RATE_IP] = findBucket(ip_table,ip,RATE_IP,now);
+		bucket[RATE_SUBNET] = findBucket(subnet_table,ip & 0xFFFFFF00,RATE_SUBNET,now);
+	}
+	bucket[RATE_GLOBAL] = &global_bucket;
+
+	/* Check them all before taking any tokens so a connection refused by
+	   one bucket doesn't use up the others */
+	for(type=exempt ? RATE_GLOBAL : 0;type < NUM_RATE_TYPES;++type)
+	{
+		if (!rate_limit[type].per_min) continue;
+		refill(bucket[type],type,now);
+		if (bucket[type]->tokens < 1)
+		{
+			++rejects[type];
+			logprintfLimit(ipaddrstr,parent_pid,"CONNECTION REFUSED: %s rate limit exceeded. Total rejects: IP = %lu, subnet = %lu, global = %lu\n",
+				rate_name[type],
+				rejects[RATE_IP],
+				rejects[RATE_SUBNET],
+				rejects[RATE_GLOBAL]);
+			return 1;
+		}
+	}
+	for(type=exempt ? RATE_GLOBAL : 0;type < NUM_RATE_TYPES;++type)
+	{
+		if (rate_limit[type].per_min) bucket[type]->tokens -= 1;
+	}
+	return 0;
+}
+
+
+
+
+/*** Find the bucket for the key. If it's not in the table then reuse the
+     fullest bucket in the probe range as that's the one that's been idle
+     the longest relative to its rate ***/
+struct st_bucket *findBucket(
+	struct st_bucket *table, uint32_t key, int type, double now)
+{
+	struct st_bucket *bucket;
+	struct st_bucket *victim;
+	uint32_t h;
+	int i;
+
+	/* Knuth's multiplicative hash. The top bits are the well mixed ones,
+	   the bottom ones only depend on the bottom of the key which is
+	   always zero for a subnet. */
+	h = (key * 2654435761U) >> (32 - RATE_TABLE_BITS);
+	victim = NULL;
+
+	for(i=0;i < RATE_PROBES;++i)
+	{
+		bucket = &table[(h + i) % RATE_TABLE_SIZE];
+		if (bucket->used && bucket->key == key) return bucket;
+		if (!bucket->used)
+		{
+			victim = bucket;
+			break;
+		}
+		refill(bucket,type,now);
+		if (!victim || bucket->tokens > victim->tokens) victim = bucket;
+	}
+	victim->key = key;
+	victim->tokens = rate_limit[type].burst;
+	victim->updated = now;
+	victim->used = 1;
+	return victim;
+}
+
+
+
+
+void refill(struct st_bucket *bucket, int type, double now)
+{
+	if (!bucket->used)
+	{
+		/* Only the global bucket gets here */
+		bucket->tokens = rate_limit[type].burst;
+		bucket->used = 1;
+	}
+	else
+	{
+		bucket->tokens += (now - bucket->updated) *
+		                  rate_limit[type].per_min / 60;
+		if (bucket->tokens > rate_limit[type].burst)
+			bucket->tokens = rate_limit[type].burst;
+	}
+	bucket->updated = now;
+}
+
+
+
+
+double getTime(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
@@ -0,0 +1,554 @@
+/*****************************************************************************
+ Session recording for auditing. If record_dir is set what the shell sends
+ to the user is saved with its timing in asciicast v2 (asciinema) or ttyrec
+ format so it can be played back. It can be limited to some users with
+ record_users or to some listeners with record_interfaces.
+
+ The master never writes the file itself. It starts a recorder process
+ when the session goes into pipe mode and sends it the raw PTY output down
+ a non-blocking pipe with a buffer of record_buffer_kb, the recorder does
+ the formatting and the file writes. If the disk stalls and the pipe fills
+ the master drops the output rather than wait, counts it and tells the
+ recorder how much was lost when there's room again. Each message is no
+ bigger than PIPE_BUF so it is written whole or not at all.
+ *****************************************************************************/
+
+#include "globals.h"
+#include <limits.h>
+
+#define RECORD_READ_BUFF  65536
+#define RECORD_WRITE_BUFF 65536
+#define RECORD_USER_LEN   32
+
+enum
+{
+	RECORD_OUTPUT,
+	RECORD_RESIZE,
+	RECORD_DROPPED
+};
+
+struct st_rec_msg
+{
+	uint32_t secs;
+	uint32_t usecs;
+	uint16_t type;
+	uint16_t len;
+};
+
+#define RECORD_MAX_DATA (PIPE_BUF - sizeof(struct st_rec_msg))
+
+static int rec_pipe = -1;
+static uint32_t rec_dropped = 0;
+static uint64_t rec_dropped_total = 0;
+
+/* Recorder process */
+static int rec_fd;
+static char *out_buff;
+static int out_len;
+static struct timeval rec_start;
+static u_char utf8_carry[4];
+static int utf8_carry_len;
+
+static int  recordSession(void);
+static int  openRecordFile(void);
+static int  sendMessage(int type, void *data, int len);
+static void runRecorder(int fd);
+static void writeHeader(void);
+static void writeMessage(struct st_rec_msg *msg, u_char *data);
+static void writeJSONString(u_char *data, int len);
+static void putLE32(u_char *p, uint32_t val);
+static void addOutput(void *data, int len);
+static void flushOutput(void);
+
+
+/*** Called after runSlave(). Forks off the recorder if this session is to
+     be recorded. ***/
+void startRecording(void)
+{
+	int pfd[2];
+	pid_t pid;
+	int fd;
+
+	if (!record_dir || flags.record || !recordSession()) return;
+	if ((fd = openRecordFile()) == -1) return;
+
+	if (pipe(pfd) == -1)
+	{
+		logprintf(master_pid,"ERROR: startRecording(): pipe(): %s\n",
+			strerror(errno));
+		close(fd);
+		return;
+	}
+#ifdef F_SETPIPE_SZ
+	if (fcntl(pfd[1],F_SETPIPE_SZ,record_buffer_kb * 1024) == -1)
+	{
+		logprintf(master_pid,"WARNING: startRecording(): fcntl(F_SETPIPE_SZ,%dK): %s\n",
+			record_buffer_kb,strerror(errno));
+	}
+#endif
+	switch((pid = fork()))
+	{
+	case -1:
+		logprintf(master_pid,"ERROR: startRecording(): fork(): %s\n",
+			strerror(errno));
+		close(pfd[0]);
+		close(pfd[1]);
+		close(fd);
+		return;
+	case 0:
+		/* Don't keep the connection open after the master has gone */
+		close(pfd[1]);
+		close(sock);
+		if (ptym != -1) close(ptym);
+		signal(SIGINT,SIG_IGN);
+		signal(SIGQUIT,SIG_IGN);
+		signal(SIGTERM,SIG_IGN);
+		rec_fd = fd;
+		runRecorder(pfd[0]);
+		_exit(0);
+	}
+	close(pfd[0]);
+	close(fd);
+	rec_pipe = pfd[1];
+	fcntl(rec_pipe,F_SETFL,fcntl(rec_pipe,F_GETFL) | O_NONBLOCK);
+	fcntl(rec_pipe,F_SETFD,FD_CLOEXEC);
+
+	/* So a dead recorder is a write error instead of killing us. The
+	   slave has already been started so it doesn't inherit this. */
+	signal(SIGPIPE,SIG_IGN);
+	rec_dropped = 0;
+	rec_dropped_total = 0;
+	flags.record = 1;
+	logprintf(master_pid,"Recorder process = %d\n",pid);
+}
+
+
+
+
+/*** Called from readPTYMaster() ***/
+void recordData(u_char *data, int len)
+{
+	int cnt;
+
+	/* Tell the recorder what was lost before sending anything else */
+	if (rec_dropped &&
+	    sendMessage(RECORD_DROPPED,&rec_dropped,sizeof(rec_dropped)))
+	{
+		rec_dropped = 0;
+	}
+	/* Stop as soon as sendMessage() finds the recorder has gone */
+	for(;len && rec_pipe != -1;data += cnt,len -= cnt)
+	{
+		cnt = len < (int)RECORD_MAX_DATA ? len : (int)RECORD_MAX_DATA;
+		if (rec_dropped || !sendMessage(RECORD_OUTPUT,data,cnt))
+		{
+			if (!rec_dropped && !rec_dropped_total)
+			{
+				logprintf(master_pid,"WARNING: Recording buffer full, dropping output.\n");
+			}
+			rec_dropped += cnt;
+			rec_dropped_total += cnt;
+		}
+	}
+}
+
+
+
+
+/*** Called when the client sends a new terminal size ***/
+void recordResize(void)
+{
+	char str[20];
+
+	snprintf(str,sizeof(str),"%dx%d",term_width,term_height);
+	sendMessage(RECORD_RESIZE,str,strlen(str));
+}
+
+
+
+
+/*** The recorder gets EOF and exits once it's written everything ***/
+void endRecording(void)
+{
+	if (rec_pipe == -1) return;
+	close(rec_pipe);
+	rec_pipe = -1;
+	flags.record = 0;
+	if (rec_dropped_total)
+	{
+		logprintf(master_pid,"WARNING: Recording dropped %llu bytes.\n",
+			(unsigned long long)rec_dropped_total);
+	}
+}
+
+
+
+
+/*** If neither list is set everyone is recorded. The interface is matched
+     against the address the connection came in on so it works when
+     listening on all of them too. ***/
+int recordSession(void)
+{
+	struct sockaddr_in addr;
+	struct in_addr in;
+	socklen_t size;
+	int i;
+	int j;
+
+	if (!record_users_cnt && !record_interfaces_cnt) return 1;
+
+	/* config.c doesn't allow record_users without a shell_program so this
+	   is always the user who logged in, never what the client sent */
+	for(i=0;i < record_users_cnt;++i)
+		if (!strcmp(record_users[i],username)) return 1;
+
+	size = sizeof(addr);
+	if (record_interfaces_cnt &&
+	    getsockname(sock,(struct sockaddr *)&addr,&size) != -1)
+	{
+		for(i=0;i < record_interfaces_cnt;++i)
+		{
+			if (inet_aton(record_interfaces[i],&in))
+			{
+				if (in.s_addr == addr.sin_addr.s_addr) return 1;
+				continue;
+			}
+			for(j=0;j < num_interfaces;++j)
+			{
+				if (iface[j].name &&
+				    !strcmp(iface[j].name,record_interfaces[i]) &&
+				    iface[j].addr.sin_addr.s_addr == addr.sin_addr.s_addr)
+				{
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+
+
+
+/*** <date>-<pid>-<user>.cast or .ttyrec. The user can come from the client
+     so only safe characters go in the name. ***/
+int openRecordFile(void)
+{
+	char user[RECORD_USER_LEN];
+	char tstr[20];
+	char *uname;
+	char *path;
+	time_t now;
+	int fd;
+	int i;
+
+	uname = username[0] ? username : telopt_username;
+	if (!uname || !*uname) uname = "unknown";
+	for(i=0;uname[i] && i < RECORD_USER_LEN - 1;++i)
+	{
+		user[i] = (isalnum((u_char)uname[i]) ||
+		           strchr("._-",uname[i])) ? uname[i] : '_';
+	}
+	user[i] = 0;
+
+	now = time(0);
+	strftime(tstr,sizeof(tstr),"%Y%m%d-%H%M%S",localtime(&now));
+	asprintf(&path,"%s/%s-%d-%s.%s",
+		record_dir,tstr,master_pid,user,
+		record_format == RECORD_ASCIICAST ? "cast" : "ttyrec");
+
+	/* Can contain anything the user sees so owner only */
+	if ((fd = open(
+		path,O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,0600)) == -1)
+	{
+		logprintf(master_pid,"ERROR: startRecording(): open(\"%s\"): %s\n",
+			path,strerror(errno));
+	}
+	else logprintf(master_pid,"Recording file = %s\n",path);
+	free(path);
+	return fd;
+}
+
+
+
+
+/*** Returns 0 if the pipe is full ***/
+int sendMessage(int type, void *data, int len)
+{
+	struct st_rec_msg msg;
+	struct timeval tv;
+	struct iovec iov[2];
+
+	/* Recorder has gone, nothing to do */
+	if (rec_pipe == -1) return 1;
+
+	gettimeofday(&tv,NULL);
+	msg.secs = (uint32_t)tv.tv_sec;
+	msg.usecs = (uint32_t)tv.tv_usec;
+	msg.type = type;
+	msg.len = len;
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = sizeof(msg);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+
+	while(writev(rec_pipe,iov,2) == -1)
+	{
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN)
+		{
+			/* Recorder has died. Stop rather than count it all as
+			   dropped. */
+			logprintf(master_pid,"ERROR: Recorder write(): %s\n",
+				strerror(errno));
+			endRecording();
+			return 1;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+
+
+/********************************* RECORDER *********************************/
+
+/*** Runs until the master closes the pipe ***/
+void runRecorder(int fd)
+{
+	struct st_rec_msg msg;
+	u_char *in_buff;
+	int in_len;
+	int len;
+	int pos;
+
+	in_buff = (u_char *)malloc(RECORD_READ_BUFF);
+	out_buff = (char *)malloc(RECORD_WRITE_BUFF);
+	assert(in_buff && out_buff);
+	out_len = 0;
+	utf8_carry_len = 0;
+	gettimeofday(&rec_start,NULL);
+	writeHeader();
+
+	for(in_len=0;;)
+	{
+		if ((len = read(fd,in_buff + in_len,RECORD_READ_BUFF - in_len)) < 1)
+		{
+			if (len == -1 && errno == EINTR) continue;
+			break;
+		}
+		in_len += len;
+
+		/* Messages can be split over reads */
+		for(pos=0;in_len - pos >= (int)sizeof(msg);pos += sizeof(msg) + msg.len)
+		{
+			memcpy(&msg,in_buff + pos,sizeof(msg));
+			if (in_len - pos < (int)sizeof(msg) + msg.len) break;
+			writeMessage(&msg,in_buff + pos + sizeof(msg));
+		}
+		in_len -= pos;
+		memmove(in_buff,in_buff + pos,in_len);
+		flushOutput();
+	}
+	flushOutput();
+	close(rec_fd);
+}
+
+
+
+
+/*** ttyrec has no header ***/
+void writeHeader(void)
+{
+	char *term;
+	char *str;
+	int len;
+
+	if (record_format != RECORD_ASCIICAST) return;
+	len = asprintf(&str,
+		"{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld, \"env\": {\"TERM\": ",
+		term_width,term_height,(long)rec_start.tv_sec);
+	addOutput(str,len);
+	free(str);
+	/* What the client sent, not ours */
+	if (!(term = arenaGetEnv("TERM"))) term = "";
+	writeJSONString((u_char *)term,strlen(term));
+	addOutput("}}\n",3);
+}
+
+
+
+
+void writeMessage(struct st_rec_msg *msg, u_char *data)
+{
+	u_char hdr[12];
+	uint32_t dropped;
+	char str[100];
+	double secs;
+	int len;
+
+	if (record_format == RECORD_TTYREC)
+	{
+		/* Only the output goes in, in little endian */
+		if (msg->type != RECORD_OUTPUT) return;
+		putLE32(hdr,msg->secs);
+		putLE32(hdr + 4,msg->usecs);
+		putLE32(hdr + 8,msg->len);
+		addOutput(hdr,sizeof(hdr));
+		addOutput(data,msg->len);
+		return;
+	}
+
+	secs = (double)msg->secs - rec_start.tv_sec +
+	       ((double)msg->usecs - rec_start.tv_usec) / 1000000;
+	if (secs < 0) secs = 0;
+
+	switch(msg->type)
+	{
+	case RECORD_OUTPUT:
+		len = snprintf(str,sizeof(str),"[%.6f, \"o\", ",secs);
+		addOutput(str,len);
+		writeJSONString(data,msg->len);
+		addOutput("]\n",2);
+		break;
+	case RECORD_RESIZE:
+		len = snprintf(str,sizeof(str),"[%.6f, \"r\", \"%.*s\"]\n",
+			secs,msg->len,data);
+		addOutput(str,len);
+		break;
+	case RECORD_DROPPED:
+		/* A marker so a player shows where the gap is */
+		memcpy(&dropped,data,sizeof(dropped));
+		len = snprintf(str,sizeof(str),
+			"[%.6f, \"m\", \"%u bytes dropped\"]\n",secs,dropped);
+		addOutput(str,len);
+	}
+}
+
+
+
+
+/*** asciicast strings have to be valid UTF-8. A character split between
+     two reads is kept until the next one and invalid bytes are replaced. ***/
+void writeJSONString(u_char *data, int len)
+{
+	u_char *end = data + len;
+	u_char seq[4];
+	char esc[7];
+	int need;
+	int have;
+	u_char c;
+	int i;
+
+	addOutput("\"",1);
+	while(data < end || utf8_carry_len)
+	{
+		if (utf8_carry_len)
+		{
+			/* Finish off the one from the last output */
+			memcpy(seq,utf8_carry,utf8_carry_len);
+			have = utf8_carry_len;
+			utf8_carry_len = 0;
+		}
+		else
+		{
+			c = *data++;
+			if (c < 0x80)
+			{
+				switch(c)
+				{
+				case '"' : addOutput("\\\"",2); break;
+				case '\\': addOutput("\\\\",2); break;
+				case '\n': addOutput("\\n",2); break;
+				case '\r': addOutput("\\r",2); break;
+				case '\t': addOutput("\\t",2); break;
+				default:
+					if (c < 0x20 || c == 0x7F)
+					{
+						snprintf(esc,sizeof(esc),"\\u%04x",c);
+						addOutput(esc,6);
+					}
+					else addOutput(&c,1);
+				}
+				continue;
+			}
+			seq[0] = c;
+			have = 1;
+		}
+
+		if ((seq[0] & 0xE0) == 0xC0 && seq[0] >= 0xC2) need = 2;
+		else if ((seq[0] & 0xF0) == 0xE0) need = 3;
+		else if ((seq[0] & 0xF8) == 0xF0 && seq[0] <= 0xF4) need = 4;
+		else need = 0;
+
+		for(;need && have < need && data < end;++have)
+		{
+			if ((*data & 0xC0) != 0x80) break;
+			seq[have] = *data++;
+		}
+		if (need && have == need)
+			addOutput(seq,need);
+		else if (need && data == end && len)
+		{
+			/* Ran out, keep it for next time */
+			memcpy(utf8_carry,seq,have);
+			utf8_carry_len = have;
+			break;
+		}
+		else
+		{
+			/* Invalid. Continuation bytes taken so far are
+			   replaced too. */
+			for(i=0;i < have;++i) addOutput("\\ufffd",6);
+		}
+	}
+	addOutput("\"",1);
+}
+
+
+
+
+void addOutput(void *data, int len)
+{
+	if (out_len + len > RECORD_WRITE_BUFF) flushOutput();
+	memcpy(out_buff + out_len,data,len);
+	out_len += len;
+}
+
+
+
+
+/*** If the write fails keep reading so the master isn't held up ***/
+void flushOutput(void)
+{
+	int len;
+	int i;
+
+	for(i=0;i < out_len && rec_fd != -1;i += len)
+	{
+		if ((len = write(rec_fd,out_buff + i,out_len - i)) == -1)
+		{
+			if (errno == EINTR)
+			{
+				len = 0;
+				continue;
+			}
+			logprintf(getpid(),"ERROR: Recorder write(): %s\n",
+				strerror(errno));
+			close(rec_fd);
+			rec_fd = -1;
+		}
+	}
+	out_len = 0;
+}
+
+
+
+
+void putLE32(u_char *p, uint32_t val)
+{
+	p[0] = val & 0xFF;
+	p[1] = (val >> 8) & 0xFF;
+	p[2] = (val >> 16) & 0xFF;
+	p[3] = (val >> 24) & 0xFF;
+}
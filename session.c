@@ -0,0 +1,350 @@
+/*****************************************************************************
+ Session admission control for the parent process. The parent reaps its
+ children so it knows how many sessions are running in total and on each
+ listening interface. When max_sessions or max_iface_sessions is reached new
+ connections are either held in a bounded queue, where they are told their
+ position without a process being forked for them, or are rejected.
+
+ If cpu_affinity is set each session's master and slave are pinned to the
+ same CPU, taken round robin from the list, so a keystroke going through
+ the PTY doesn't have to wake a process on another core.
+ *****************************************************************************/
+
+#include "globals.h"
+
+#define QUEUE_TICK_SECS 1
+
+struct st_session
+{
+	pid_t pid;
+	in_addr_t iface_addr;
+};
+
+struct st_queued
+{
+	int sock;
+	int pos_sent;
+	in_addr_t iface_addr;
+	struct sockaddr_in ip_addr;
+	struct timeval queued;
+};
+
+static struct st_session *sessions = NULL;
+static struct st_queued *queue = NULL;
+static int session_cnt = 0;
+static int queue_cnt = 0;
+static int next_cpu = 0;
+static int session_cpu = -1;
+
+static int  canStart(in_addr_t iface_addr);
+static void startSession(int csock, in_addr_t iface_addr, struct sockaddr_in *ip_addr);
+static void queueConnection(int csock, in_addr_t iface_addr, struct sockaddr_in *ip_addr);
+static void removeQueued(int qnum);
+static void rejectConnection(int csock, char *reason);
+static void sendQueuePositions(void);
+static double secsSince(struct timeval *tv);
+
+
+/*** Called with a new connection that has passed all the other checks.
+     Either forks off a master process for it, queues it or rejects it. ***/
+void admitConnection(int inum, struct sockaddr_in *ip_addr)
+{
+	in_addr_t iface_addr = iface[inum].addr.sin_addr.s_addr;
+
+	/* Anything still queued after checkSessions() is waiting on a limit
+	   that this connection would also hit so it can't jump the queue */
+	if (canStart(iface_addr))
+	{
+		startSession(sock,iface_addr,ip_addr);
+		return;
+	}
+	if (queue_cnt < session_queue_size)
+	{
+		queueConnection(sock,iface_addr,ip_addr);
+		sendQueuePositions();
+		return;
+	}
+	rejectConnection(sock,"Session limit reached and queue full");
+}
+
+
+
+
+/*** Add the queued sockets to the select() mask and make sure we wake up
+     often enough to time them out ***/
+void setSessionMask(fd_set *mask, struct timeval *tv, struct timeval **tvp)
+{
+	int i;
+
+	if (!queue_cnt) return;
+	for(i=0;i < queue_cnt;++i) FD_SET(queue[i].sock,mask);
+
+	if (!*tvp || tv->tv_sec > QUEUE_TICK_SECS)
+	{
+		tv->tv_sec = QUEUE_TICK_SECS;
+		tv->tv_usec = 0;
+		*tvp = tv;
+	}
+}
+
+
+
+
+/*** Call after select() returns in the parent. Reaps finished sessions,
+     drops queued connections that have closed or timed out and then starts
+     as many queued ones as the limits allow. ***/
+void checkSessions(fd_set *mask)
+{
+	struct st_queued *q;
+	char dummy[100];
+	pid_t pid;
+	int status;
+	int len;
+	int i;
+
+	while((pid = waitpid(-1,&status,WNOHANG)) > 0)
+	{
+		for(i=0;i < session_cnt;++i)
+		{
+			if (sessions[i].pid == pid)
+			{
+				sessions[i] = sessions[--session_cnt];
+				break;
+			}
+		}
+		if (i == session_cnt && !logWriterExited(pid,status))
+			loginPoolExited(pid);
+	}
+	if (!queue_cnt) return;
+
+	for(i=0;i < queue_cnt;)
+	{
+		q = &queue[i];
+
+		/* Throw away anything the client sends while it waits but
+		   spot if it has gone */
+		if (FD_ISSET(q->sock,mask) &&
+		    ((len = read(q->sock,dummy,sizeof(dummy))) == 0 ||
+		     (len == -1 && errno != EAGAIN && errno != EINTR)))
+		{
+			logprintf(parent_pid,"QUEUE: Remote IP = %s closed connection after waiting %.1f secs.\n",
+				inet_ntoa(q->ip_addr.sin_addr),secsSince(&q->queued));
+			close(q->sock);
+			removeQueued(i);
+			continue;
+		}
+		if (session_queue_timeout_secs &&
+		    secsSince(&q->queued) >= session_queue_timeout_secs)
+		{
+			logprintf(parent_pid,"QUEUE: Remote IP = %s timed out after waiting %.1f secs.\n",
+				inet_ntoa(q->ip_addr.sin_addr),secsSince(&q->queued));
+			rejectConnection(q->sock,"Timed out in queue");
+			removeQueued(i);
+			continue;
+		}
+		++i;
+	}
+
+	/* Start whatever we can. Connections on an interface that is at its
+	   own limit don't hold up ones on other interfaces. */
+	for(i=0;i < queue_cnt;)
+	{
+		q = &queue[i];
+		if (!canStart(q->iface_addr))
+		{
+			++i;
+			continue;
+		}
+		logprintf(parent_pid,"QUEUE: Remote IP = %s admitted after waiting %.1f secs.\n",
+			inet_ntoa(q->ip_addr.sin_addr),secsSince(&q->queued));
+		fcntl(q->sock,F_SETFL,fcntl(q->sock,F_GETFL) & ~O_NONBLOCK);
+		startSession(q->sock,q->iface_addr,&q->ip_addr);
+		removeQueued(i);
+	}
+	sendQueuePositions();
+}
+
+
+
+
+int canStart(in_addr_t iface_addr)
+{
+	int cnt;
+	int i;
+
+	if (max_sessions && session_cnt >= max_sessions) return 0;
+	if (!max_iface_sessions) return 1;
+
+	for(i=cnt=0;i < session_cnt;++i)
+		if (sessions[i].iface_addr == iface_addr) ++cnt;
+	return (cnt < max_iface_sessions);
+}
+
+
+
+
+/*** Fork off the master process. The socket is closed in the parent. ***/
+void startSession(int csock, in_addr_t iface_addr, struct sockaddr_in *ip_addr)
+{
+	pid_t pid;
+	int i;
+
+	sock = csock;
+	if (affinity_cpu_cnt)
+	{
+		next_cpu %= affinity_cpu_cnt;
+		session_cpu = affinity_cpus[next_cpu++];
+	}
+	else session_cpu = -1;
+	if (!takePooledLogin()) takePooledPTY();
+	pid = fork();
+	forkedPTYPool(pid);
+	forkedLoginPool(pid);
+
+	switch(pid)
+	{
+	case -1:
+		logprintf(parent_pid,"ERROR: startSession(): fork(): %s\n",
+			strerror(errno));
+		break;
+	case 0:
+		signal(SIGHUP,SIG_IGN);
+		for(i=0;i < num_interfaces;++i)
+		{
+			if (iface[i].sock) close(iface[i].sock);
+		}
+		for(i=0;i < queue_cnt;++i)
+		{
+			if (queue[i].sock != sock) close(queue[i].sock);
+		}
+		closeControlSocket();
+		clearLogLimits();
+
+		/* The slave inherits this */
+		pinSessionCPU(0);
+		runMaster(ip_addr);
+		break;
+	default:
+		sessions = (struct st_session *)realloc(
+			sessions,sizeof(struct st_session) * (session_cnt + 1));
+		assert(sessions);
+		sessions[session_cnt].pid = pid;
+		sessions[session_cnt].iface_addr = iface_addr;
+		++session_cnt;
+	}
+	close(csock);
+}
+
+
+
+
+/*** Pin the process to the session's CPU. A pid of 0 is ourselves. ***/
+void pinSessionCPU(pid_t pid)
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (session_cpu == -1) return;
+	CPU_ZERO(&set);
+	CPU_SET(session_cpu,&set);
+	if (sched_setaffinity(pid,sizeof(set),&set) == -1)
+	{
+		logprintf(getpid(),"WARNING: pinSessionCPU(): sched_setaffinity(%d,CPU %d): %s\n",
+			pid,session_cpu,strerror(errno));
+	}
+	else if (!pid) LOGPRINTF(LOG_DEBUG,getpid(),"Session CPU = %d\n",session_cpu);
+#else
+	(void)pid;
+#endif
+}
+
+
+
+
+/*** Used to tell the masters the trace rules have changed ***/
+void signalSessions(int sig)
+{
+	int i;
+
+	for(i=0;i < session_cnt;++i) kill(sessions[i].pid,sig);
+}
+
+
+
+
+void queueConnection(int csock, in_addr_t iface_addr, struct sockaddr_in *ip_addr)
+{
+	struct st_queued *q;
+
+	queue = (struct st_queued *)realloc(
+		queue,sizeof(struct st_queued) * (queue_cnt + 1));
+	assert(queue);
+	q = &queue[queue_cnt++];
+	q->sock = csock;
+	q->pos_sent = 0;
+	q->iface_addr = iface_addr;
+	memcpy(&q->ip_addr,ip_addr,sizeof(q->ip_addr));
+	gettimeofday(&q->queued,NULL);
+
+	/* The parent mustn't block on a client that isn't reading */
+	fcntl(csock,F_SETFL,fcntl(csock,F_GETFL) | O_NONBLOCK);
+
+	logprintf(parent_pid,"QUEUE: Remote IP = %s queued at position %d. Sessions = %d\n",
+		inet_ntoa(ip_addr->sin_addr),queue_cnt,session_cnt);
+}
+
+
+
+
+void removeQueued(int qnum)
+{
+	--queue_cnt;
+	memmove(&queue[qnum],&queue[qnum+1],
+		sizeof(struct st_queued) * (queue_cnt - qnum));
+}
+
+
+
+
+void rejectConnection(int csock, char *reason)
+{
+	logprintfLimit(NULL,parent_pid,"CONNECTION REFUSED: %s. Sessions = %d, queued = %d\n",
+		reason,session_cnt,queue_cnt);
+	if (wire_msg[MSG_MAX_SESSIONS].len)
+	{
+		write(csock,
+			wire_msg[MSG_MAX_SESSIONS].data,wire_msg[MSG_MAX_SESSIONS].len);
+	}
+	close(csock);
+}
+
+
+
+
+/*** Only send to those whose position has changed ***/
+void sendQueuePositions(void)
+{
+	char msg[100];
+	int len;
+	int i;
+
+	for(i=0;i < queue_cnt;++i)
+	{
+		if (queue[i].pos_sent == i + 1) continue;
+		queue[i].pos_sent = i + 1;
+		len = snprintf(msg,sizeof(msg),
+			"Server busy. You are number %d in the queue.\r\n",i + 1);
+		write(queue[i].sock,msg,len);
+	}
+}
+
+
+
+
+double secsSince(struct timeval *tv)
+{
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	return (now.tv_sec - tv->tv_sec) +
+	       (double)(now.tv_usec - tv->tv_usec) / 1000000;
+}
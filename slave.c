@@ -6,163 +6,574 @@
  
 #include "globals.h"
 
-extern char **environ;
-
-static void addUtmpEntry(void);
-
+/* Everything the slave needs is worked out by the master before the vfork()
+   as the child shares the master's memory until it execs so mustn't malloc,
+   log or touch any globals */
+struct st_slave_exec
+{
+	char *prog;
+	char **argv;
+	char **envp;
+	char *pty_name;
+	int set_user;
+	uid_t uid;
+	gid_t gid;
+	char *dir;
+	struct st_limits *limits;
+	sigset_t sigmask;
+	int err_fd;
+};
+
+/* Sent back down the error pipe by the child. Fatal ones are followed by
+   the child exiting. */
+struct st_slave_err
+{
+	int step;
+	int err;
+	int fatal;
+};
 
-/*** Fork off slave child process that will run bash/login ***/
+enum
+{
+	SLAVE_SETSID,
+	SLAVE_OPEN_PTY,
+	SLAVE_CGROUP,
+	SLAVE_RLIMIT,
+	SLAVE_SETGID,
+	SLAVE_SETUID,
+	SLAVE_CHDIR,
+	SLAVE_EXEC
+};
+
+static char *slave_step_name[] =
+{
+	"setsid()",
+	"open() PTY slave",
+	"cgroup.procs write()",
+	"setrlimit()",
+	"setgid()",
+	"setuid()",
+	"chdir()",
+	"execve()"
+};
+
+/* A login process started by the parent ready for a connection */
+struct st_login_proc
+{
+	pid_t pid;
+	int ptym;
+};
+
+static struct st_login_proc *login_pool = NULL;
+static int login_pool_cnt = 0;
+static int login_pool_alloc = 0;
+static int login_pool_failed = 0;
+static struct st_login_proc pooled_login = { -1, -1 };
+
+static void  setLoginArgs(struct st_slave_exec *se, char *user, char **def_exec_argv);
+static pid_t spawnSlave(struct st_slave_exec *se, pid_t pid, struct st_slave_err *err);
+static void  execSlave(struct st_slave_exec *se);
+static void  applyLimits(struct st_slave_exec *se);
+static void  slaveError(struct st_slave_exec *se, int step, int fatal);
+static int   attachPooledLogin(void);
+static int   spawnPooledLogin(void);
+static void  removePooledLogin(int num);
+static int   loginPoolSize(void);
+static void  addUtmpEntry(void);
+
+
+/*** Start the slave process that will run bash/login. The master sets up
+     the arguments and enviroment then does a vfork() so there is no copy of
+     its page tables and it resumes as soon as the child has exec'd. ***/
 void runSlave(void)
 {
-	char **exec_argv;
+	struct st_slave_exec se;
+	struct st_slave_err err;
+	struct st_limits lim;
 	char *def_exec_argv[4];
-	char *prog;
-	int sig;
+	char pty_name[100];
+
+	if (pooled_login.pid != -1 && attachPooledLogin()) return;
 
-	/* Execute sub child to run the shell process */
-	switch((slave_pid = fork()))
+	/* The PTY isn't allocated until now so connections that never log
+	   in don't use one up */
+	if (ptym == -1)
 	{
-	case -1:
-		logprintf(master_pid,"ERROR: execSlave(): fork(): %s\n",
-			strerror(errno));
-		sockprintf("ERROR: Can't fork slave process.\n");
-		return;
+		if (!openPTYMaster()) masterExit(1);
+		logprintf(master_pid,"PTY = %s\n",getPTYName());
+	}
 
-	case 0:
-		/* In slave child process here */
-		slave_pid = getpid();
-		logprintf(slave_pid,"STARTED: Slave process, ppid = %d.\n",master_pid);
+	bzero(&se,sizeof(se));
+	snprintf(pty_name,sizeof(pty_name),"%s",ptsname(ptym));
+	se.pty_name = pty_name;
+	notifyWinSize();
+
+	if (shell_exec_argv)
+	{
+		logprintf(master_pid,"Setting up enviroment for user \"%s\", uid %d...\n",
+			username,userinfo->pw_uid);
+
+		se.set_user = 1;
+		se.uid = userinfo->pw_uid;
+		se.gid = userinfo->pw_gid;
+		se.dir = userinfo->pw_dir;
+
+		/* Override anything the client sent */
+		arenaUnsetEnv("HOME");
+		setenv("HOME",userinfo->pw_dir,1);
+
+		se.prog = shell_exec_argv[0];
+		se.argv = shell_exec_argv;
+	}
+	else
+	{
+		if (!flags.append_user) telopt_username = NULL;
+		setLoginArgs(&se,telopt_username,def_exec_argv);
+	}
 
-		/* Use setsid() so that when we open the pty slave it
-		   becomes the controlling tty */
-		if (setsid() == -1)
-			logprintf(slave_pid,"ERROR: setsid(): %s\n",strerror(errno));
+	/* Exec logon/shell with the inherited enviroment plus the telopt
+	   variables stored in the arena */
+	se.envp = arenaEnvArray();
 
-		if (!openPTYSlave()) exit(1);
-		notifyWinSize();
+	prepareSessionLimits(&lim);
+	se.limits = &lim;
 
-		/* Tell parent we're running */
-		kill(getppid(),SIGUSR1);
+	logprintf(master_pid,"Executing %s program \"%s\"...\n",
+		shell_exec_argv ? "shell" : "login",se.prog);
 
-		/* Reset signals back to their default except for handled ones
-		   which gets done automatically by exec() */
-		signal(SIGCHLD,SIG_DFL);
-		signal(SIGHUP,SIG_DFL);
-		sigprocmask(SIG_UNBLOCK,&usr1_sigmask,NULL);
+	slave_pid = spawnSlave(&se,master_pid,&err);
+	free(se.envp);
+	if (lim.cgroup_fd != -1) close(lim.cgroup_fd);
+	if (slave_pid == -1)
+	{
+		SOCKSTR("ERROR: Can't fork slave process.\r\n");
+		return;
+	}
+	logprintf(master_pid,"STARTED: Slave process %d.\n",slave_pid);
 
-		if (shell_exec_argv)
+	if (err.fatal)
+	{
+		switch(err.step)
 		{
-			logprintf(slave_pid,"Setting up enviroment for user \"%s\", uid %d...\n",
-				username,userinfo->pw_uid);
-
-			/* Add manually if exec'ing shell. /bin/login does it
-			   itself. Do it before we setuid as must be root. */
-			addUtmpEntry();
-
-			/* Do this before we switch user */
-			if (setgid(userinfo->pw_gid) == -1)
-			{
-				logprintf(slave_pid,"ERROR: setgid(%d): %s\n",
-					userinfo->pw_gid,strerror(errno));
-			}
-
-			/* Switch to login user id */
-			if (setuid(userinfo->pw_uid) == -1)
-			{
-				logprintf(slave_pid,"ERROR: setuid(%d): %s\n",
-					userinfo->pw_uid,strerror(errno));
-			}
-			if (chdir(userinfo->pw_dir) == -1)
-			{
-				logprintf(slave_pid,"ERROR: chdir(\"%s\"): %s\n",
-					userinfo->pw_dir,strerror(errno));
-			}
-			setenv("HOME",userinfo->pw_dir,1);
-
-			prog = shell_exec_argv[0];
-			exec_argv = shell_exec_argv;
-
-			logprintf(slave_pid,"Executing shell program \"%s\"...\n",prog);
+		case SLAVE_OPEN_PTY:
+			SOCKSTR("ERROR: Open PTY slave failed, can't continue.\r\n");
+			break;
+		case SLAVE_EXEC:
+			sockprintf("ERROR: Exec of \"%s\" failed: %s\n",
+				se.argv[0],strerror(err.err));
+			break;
+		default:
+			SOCKSTR("ERROR: Can't set up slave process.\r\n");
 		}
-		else
+		masterExit(1);
+	}
+
+	/* Add manually if exec'ing shell. /bin/login does it itself. */
+	if (shell_exec_argv) addUtmpEntry();
+}
+
+
+
+
+/*** Login program and args given in .cfg or the default system one ***/
+void setLoginArgs(struct st_slave_exec *se, char *user, char **def_exec_argv)
+{
+	if (login_exec_argv)
+	{
+		if (user) 
 		{
-			if (!flags.append_user) telopt_username = NULL;
-
-			/* Login program and args given in .cfg */
-			if (login_exec_argv)
-			{
-				if (telopt_username) 
-				{
-					addWordToArray(
-						&login_exec_argv,
-						telopt_username,
-						NULL,&login_exec_argv_cnt);
-				}
-				prog = login_exec_argv[0];
-				exec_argv = login_exec_argv;
-			}
-			else
-			{
-				/* No login or shell program given in config 
-				   so use default system one. */
-				prog = LOGIN_PROG;
-				exec_argv = def_exec_argv;
-				exec_argv[0] = prog;
-				if (flags.preserve_env)
-				{
-					exec_argv[1] = "-p"; 
-					exec_argv[2] = telopt_username;
-					exec_argv[3] = NULL;
-				}
-				else
-				{
-					exec_argv[1] = telopt_username;
-					exec_argv[2] = NULL;
-				}
-			}
-
-			logprintf(slave_pid,"Executing login program \"%s\"...\n",prog);
+			addWordToArray(
+				&login_exec_argv,user,NULL,&login_exec_argv_cnt);
 		}
+		se->prog = login_exec_argv[0];
+		se->argv = login_exec_argv;
+		return;
+	}
+	se->prog = LOGIN_PROG;
+	se->argv = def_exec_argv;
+	se->argv[0] = se->prog;
+	if (flags.preserve_env)
+	{
+		se->argv[1] = "-p"; 
+		se->argv[2] = user;
+		se->argv[3] = NULL;
+	}
+	else
+	{
+		se->argv[1] = user;
+		se->argv[2] = NULL;
+	}
+}
 
-		/* Redirect I/O to pty slave */
-		dup2(ptys,STDIN);
-		dup2(ptys,STDOUT);
-		dup2(ptys,STDERR);
 
-		/* Exec logon/shell */
-		execve(prog,exec_argv,environ);
 
-		/* Don't write if the log goes to stdout as I/O has been
-		   redirected to the shell/login process and will be seen by
-		   the user so they'll get 2 error messages */
-		if (log_file)
+
+/*** Does the vfork() and exec. The child reports any failure down a
+     close-on-exec pipe so EOF on it means the exec worked, else err.fatal
+     is set. Returns the child's pid or -1 if it couldn't be started. ***/
+pid_t spawnSlave(struct st_slave_exec *se, pid_t pid, struct st_slave_err *err)
+{
+	struct st_slave_err rx;
+	sigset_t block_mask;
+	pid_t child_pid;
+	int fd[2];
+	int len;
+
+	bzero(err,sizeof(struct st_slave_err));
+	if (pipe(fd) == -1)
+	{
+		logprintf(pid,"ERROR: spawnSlave(): pipe(): %s\n",strerror(errno));
+		return -1;
+	}
+	fcntl(fd[0],F_SETFD,FD_CLOEXEC);
+	fcntl(fd[1],F_SETFD,FD_CLOEXEC);
+	se->err_fd = fd[1];
+
+	/* Block everything so none of our handlers run in the child while
+	   it's sharing our memory. It resets them before unblocking. */
+	sigfillset(&block_mask);
+	sigprocmask(SIG_BLOCK,&block_mask,&se->sigmask);
+
+	switch((child_pid = vfork()))
+	{
+	case -1:
+		sigprocmask(SIG_SETMASK,&se->sigmask,NULL);
+		logprintf(pid,"ERROR: spawnSlave(): vfork(): %s\n",strerror(errno));
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+
+	case 0:
+		execSlave(se);
+		_exit(1);
+	}
+	sigprocmask(SIG_SETMASK,&se->sigmask,NULL);
+	close(fd[1]);
+
+	while((len = read(fd[0],&rx,sizeof(rx))) == sizeof(rx) ||
+	      (len == -1 && errno == EINTR))
+	{
+		if (len == -1) continue;
+		logprintf(pid,"ERROR: Slave %s: %s\n",
+			slave_step_name[rx.step],strerror(rx.err));
+		if (rx.fatal) *err = rx;
+	}
+	close(fd[0]);
+	return child_pid;
+}
+
+
+
+
+/*** In the vfork()ed child. Only system calls from here on. ***/
+void execSlave(struct st_slave_exec *se)
+{
+	struct sigaction sa;
+	int fd;
+	int sig;
+
+	/* Reset any signals we handle back to their default. exec() would do
+	   it anyway but a signal before then would run our handler in the
+	   master's memory. */
+	for(sig=1;sig < NSIG;++sig)
+	{
+		if (sigaction(sig,NULL,&sa) == -1 ||
+		    sa.sa_handler == SIG_DFL || sa.sa_handler == SIG_IGN) continue;
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		sigaction(sig,&sa,NULL);
+	}
+	signal(SIGCHLD,SIG_DFL);
+	signal(SIGHUP,SIG_DFL);
+	sigprocmask(SIG_SETMASK,&se->sigmask,NULL);
+
+	/* Use setsid() so that when we open the pty slave it becomes the
+	   controlling tty */
+	if (setsid() == -1) slaveError(se,SLAVE_SETSID,0);
+
+	if ((fd = open(se->pty_name,O_RDWR)) == -1)
+		slaveError(se,SLAVE_OPEN_PTY,1);
+
+	/* Limits have to be set while we're still root */
+	if (se->limits) applyLimits(se);
+
+	if (se->set_user)
+	{
+		/* Do this before we switch user */
+		if (setgid(se->gid) == -1) slaveError(se,SLAVE_SETGID,1);
+
+		/* Switch to login user id */
+		if (setuid(se->uid) == -1) slaveError(se,SLAVE_SETUID,1);
+		if (chdir(se->dir) == -1) slaveError(se,SLAVE_CHDIR,0);
+	}
+
+	/* Redirect I/O to pty slave */
+	dup2(fd,STDIN);
+	dup2(fd,STDOUT);
+	dup2(fd,STDERR);
+	if (fd > STDERR) close(fd);
+
+	execve(se->prog,se->argv,se->envp);
+	slaveError(se,SLAVE_EXEC,1);
+}
+
+
+
+
+/*** In the vfork()ed child. Moves us into the session's cgroup, else sets
+     the fallback limits. ***/
+void applyLimits(struct st_slave_exec *se)
+{
+	struct st_limits *lim = se->limits;
+
+	if (lim->cgroup_fd != -1)
+	{
+		if (write(lim->cgroup_fd,"0",1) != 1)
+			slaveError(se,SLAVE_CGROUP,1);
+		return;
+	}
+	if (lim->set_as && setrlimit(RLIMIT_AS,&lim->as) == -1)
+		slaveError(se,SLAVE_RLIMIT,0);
+	if (lim->set_nproc && setrlimit(RLIMIT_NPROC,&lim->nproc) == -1)
+		slaveError(se,SLAVE_RLIMIT,0);
+	if (lim->set_nice) setpriority(PRIO_PROCESS,0,lim->nice);
+}
+
+
+
+
+void slaveError(struct st_slave_exec *se, int step, int fatal)
+{
+	struct st_slave_err err;
+
+	err.step = step;
+	err.err = errno;
+	err.fatal = fatal;
+	write(se->err_fd,&err,sizeof(err));
+	if (fatal) _exit(1);
+}
+
+
+
+
+/*** Called in the parent's main loop to keep login_pool_size login
+     processes waiting on their own PTYs ***/
+void fillLoginPool(void)
+{
+	int size = loginPoolSize();
+
+	if (login_pool_alloc != size)
+	{
+		while(login_pool_cnt > size) removePooledLogin(login_pool_cnt - 1);
+		login_pool_alloc = size;
+		login_pool = (struct st_login_proc *)realloc(
+			login_pool,
+			sizeof(struct st_login_proc) * (size ? size : 1));
+		assert(login_pool);
+	}
+	while(login_pool_cnt < size && spawnPooledLogin());
+}
+
+
+
+
+/*** Called in the parent before forking a master. Returns 1 if it'll be
+     given a login process. ***/
+int takePooledLogin(void)
+{
+	if (!login_pool_cnt) return 0;
+	pooled_login = login_pool[--login_pool_cnt];
+	return 1;
+}
+
+
+
+
+/*** Called by both sides after the fork. The master keeps the login
+     process it was given, if any, and closes the rest of the pool. ***/
+void forkedLoginPool(pid_t pid)
+{
+	int i;
+
+	if (pid)
+	{
+		if (pooled_login.ptym != -1) close(pooled_login.ptym);
+		pooled_login.pid = -1;
+		pooled_login.ptym = -1;
+		return;
+	}
+	for(i=0;i < login_pool_cnt;++i) close(login_pool[i].ptym);
+	login_pool_cnt = 0;
+}
+
+
+
+
+/*** Called by the parent when it reaps a child. Login programs time out so
+     they'll be replaced on the next fillLoginPool(). ***/
+void loginPoolExited(pid_t pid)
+{
+	int i;
+
+	for(i=0;i < login_pool_cnt;++i)
+	{
+		if (login_pool[i].pid == pid)
 		{
-			logprintf(slave_pid,"ERROR: Exec failed: %s\n",
-				strerror(errno));
+			login_pool[i].pid = -1;
+			removePooledLogin(i);
+			return;
 		}
-		sockprintf("ERROR: Exec of \"%s\" failed: %s\n",
-			exec_argv[0],strerror(errno));
-		exit(1);
+	}
+}
 
-	default:
-		/* Wait for child to tell us its ready. Signal sent above. */
-		do
-		{
-			/* If it errors just exit , who cares */
-			if (sigwait(&usr1_sigmask,&sig) == -1) break;
-		} while(sig != SIGUSR1);
+
+
+
+/*** Called by the parent on restart ***/
+void freeLoginPool(void)
+{
+	while(login_pool_cnt) removePooledLogin(login_pool_cnt - 1);
+	FREE(login_pool);
+	login_pool = NULL;
+	login_pool_alloc = 0;
+	login_pool_failed = 0;
+}
+
+
+
+
+/*** In the master. The pooled process was exec'd before the client
+     connected so it can only be used if it would have been given the same
+     arguments and enviroment. If not it's thrown away. ***/
+int attachPooledLogin(void)
+{
+	char *term = arenaGetEnv("TERM");
+	char *reason = NULL;
+
+	if (flags.append_user && telopt_username)
+		reason = "username to append";
+	else if (term && strcasecmp(term,login_pool_term))
+		reason = "different terminal type";
+	else if (login_exec_argv && arenaEnvCount() > (term ? 1 : 0))
+		reason = "enviroment variables to pass";
+
+	if (reason)
+	{
+		logprintf(master_pid,"Not using pooled login process %d: %s.\n",
+			pooled_login.pid,reason);
+		kill(pooled_login.pid,SIGKILL);
+		close(pooled_login.ptym);
+		pooled_login.pid = -1;
+		pooled_login.ptym = -1;
+		return 0;
+	}
+
+	ptym = pooled_login.ptym;
+	slave_pid = pooled_login.pid;
+	pooled_login.pid = -1;
+	pooled_login.ptym = -1;
+	logprintf(master_pid,"Using pooled login process %d, PTY = %s\n",
+		slave_pid,getPTYName());
+
+	/* It was started by the parent so isn't on our CPU yet */
+	pinSessionCPU(slave_pid);
+
+	/* It's already sitting at its prompt so just needs the window size */
+	notifyWinSize();
+	return 1;
+}
+
+
+
+
+/*** In the parent. Returns 0 if it failed. ***/
+int spawnPooledLogin(void)
+{
+	extern char **environ;
+	struct st_login_proc *lp;
+	struct st_slave_exec se;
+	struct st_slave_err err;
+	char *def_exec_argv[4];
+	char pty_name[100];
+	char *term;
+	int cnt;
+	int i;
+
+	lp = &login_pool[login_pool_cnt];
+	if ((lp->ptym = newPTY(parent_pid,"spawnPooledLogin")) == -1) return 0;
+
+	bzero(&se,sizeof(se));
+	snprintf(pty_name,sizeof(pty_name),"%s",ptsname(lp->ptym));
+	se.pty_name = pty_name;
+	setLoginArgs(&se,NULL,def_exec_argv);
+
+	/* Our enviroment with TERM set to what we expect clients to send */
+	for(cnt=0;environ[cnt];++cnt);
+	se.envp = (char **)malloc(sizeof(char *) * (cnt + 2));
+	assert(se.envp);
+	for(i=cnt=0;environ[i];++i)
+	{
+		if (strncmp(environ[i],"TERM=",5)) se.envp[cnt++] = environ[i];
+	}
+	asprintf(&term,"TERM=%s",login_pool_term);
+	se.envp[cnt++] = term;
+	se.envp[cnt] = NULL;
+
+	lp->pid = spawnSlave(&se,parent_pid,&err);
+	free(se.envp);
+	free(term);
+
+	if (lp->pid == -1 || err.fatal)
+	{
+		/* Don't keep trying every time round the main loop */
+		logprintf(parent_pid,"ERROR: Can't start pooled login process, login pool disabled.\n");
+		login_pool_failed = 1;
+		close(lp->ptym);
+		return 0;
+	}
+	++login_pool_cnt;
+	LOGPRINTF(LOG_DEBUG,parent_pid,"Login pool: Started process %d on %s. Pool = %d\n",
+		lp->pid,pty_name,login_pool_cnt);
+	return 1;
+}
+
+
+
+
+/*** In the parent. Closing the PTY master hangs up the login process. ***/
+void removePooledLogin(int num)
+{
+	if (login_pool[num].pid != -1) kill(login_pool[num].pid,SIGHUP);
+	close(login_pool[num].ptym);
+	login_pool[num] = login_pool[--login_pool_cnt];
+}
+
+
+
+
+/*** The pool is only for when we're not doing the login ourselves and the
+     login program is started with no client specific arguments. Pooled
+     logins are started by the parent so they'd escape the session limits. ***/
+int loginPoolSize(void)
+{
+	if (shell_exec_argv || flags.preserve_env || login_pool_failed ||
+	    session_cpu_weight || session_memory_max_mb || session_pids_max)
+	{
+		return 0;
 	}
+	return login_pool_size;
 }
 
 
 
 
-/*** Send the window size to the pty master and notify the child ***/
+/*** Send the window size to the pty master and notify the child. If
+     there's no PTY yet it gets sent when there is. ***/
 void notifyWinSize(void)
 {
 	struct winsize ws;
 
-	assert(ptym != -1);
+	if (ptym == -1) return;
 
 	bzero(&ws,sizeof(ws));
 	ws.ws_row = term_height;
@@ -185,13 +596,14 @@ void addUtmpEntry(void)
 
 	bzero(&entry,sizeof(entry));
 	entry.ut_type = USER_PROCESS;
-	entry.ut_pid = getpid();
+	entry.ut_pid = slave_pid;
 
 	/* Using the min lengths I found for these fields */
 	snprintf(entry.ut_user,32,"%s",userinfo->pw_name);
 	snprintf(entry.ut_line,32,"%s",getPTYName());
 	if (flags.store_host_in_utmp)
 	{
+		waitDNS();
 		if (dnsaddr)
 			snprintf(entry.ut_host,256,"%s - %s",ipaddrstr,dnsaddr);
 		else
@@ -203,5 +615,6 @@ void addUtmpEntry(void)
 	/* Move to start of utmp file */
 	setutxent();
 	if (!pututxline(&entry))
-		logprintf(slave_pid,"ERROR: addUtmpEntry(): pututxline(): %s\n",strerror(errno));
+		logprintf(master_pid,"ERROR: addUtmpEntry(): pututxline(): %s\n",strerror(errno));
+	endutxent();
 }
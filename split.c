@@ -73,6 +73,7 @@ void addWordToArray(char ***words, char *word, char *end, int *word_cnt)
 	*words = (char **)realloc(*words,sizeof(char *) * (*word_cnt+2));
 	assert(*words);
 	(*words)[*word_cnt] = strdup(word);
+	(*words)[*word_cnt+1] = NULL;
 
 	++*word_cnt;
 	if (end) *end = c;
@@ -96,7 +97,7 @@ void freeWordArray(char **words, int word_cnt)
 
  #<comment>
  or
- <username>:<encrypted password>:<max attempts>:<reserved>[:<exec line>]
+ <username>:<encrypted password>:<max attempts>:<limits>[:<exec line>]
 
  The fields don't need to be alloced as "line" stays in scope while the
  fields are parsed in validate.c
@@ -0,0 +1,152 @@
+/*****************************************************************************
+ TDCAP
+ Prints telnetd wire capture files, as written when the capture_dir config
+ option is set, in the same format as the hexdump option writes to the log
+ so the two can be compared or fed to the same tools.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "build_date.h"
+#include "capture.h"
+
+#define VERSION       "20261019"
+#define HEXDUMP_CHARS 10
+
+static int  dumpFile(char *path);
+static void hexdump(char *pre, u_char *start, u_char *end, int rx);
+
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	int i;
+
+	if (argc < 2)
+	{
+		printf("TDCAP version %s, build date %s\n",VERSION,BUILD_DATE);
+		printf("Usage: %s <capture file> [<capture file>...]\n",argv[0]);
+		return 1;
+	}
+	for(i=1;i < argc;++i)
+		if (!dumpFile(argv[i])) ret = 1;
+	return ret;
+}
+
+
+
+
+/*** Returns 0 on error ***/
+int dumpFile(char *path)
+{
+	struct st_cap_header hdr;
+	struct st_cap_record rec;
+	struct in_addr addr;
+	time_t secs;
+	u_char *data = NULL;
+	uint32_t alloc = 0;
+	uint32_t len;
+	size_t cnt;
+	FILE *fp;
+	char tstr[30];
+	char pre[50];
+	int ok = 0;
+	int pid;
+
+	if (!(fp = fopen(path,"r")))
+	{
+		fprintf(stderr,"ERROR: Can't open \"%s\": %s\n",path,strerror(errno));
+		return 0;
+	}
+	if (fread(&hdr,sizeof(hdr),1,fp) != 1 ||
+	    memcmp(hdr.magic,CAPTURE_MAGIC,CAPTURE_MAGIC_LEN))
+	{
+		fprintf(stderr,"ERROR: \"%s\" is not a capture file.\n",path);
+		fclose(fp);
+		return 0;
+	}
+	pid = (int)ntohl(hdr.pid);
+	secs = (time_t)ntohl(hdr.secs);
+	addr.s_addr = hdr.addr;
+	strftime(tstr,sizeof(tstr),"%F %T",localtime(&secs));
+	printf("%s: %d: CAPTURE: Remote IP = %s, port = %u\n",
+		tstr,pid,inet_ntoa(addr),ntohl(hdr.port));
+
+	while((cnt = fread(&rec,1,sizeof(rec),fp)) == sizeof(rec))
+	{
+		if ((len = ntohl(rec.len)) > alloc)
+		{
+			alloc = len;
+			if (!(data = (u_char *)realloc(data,alloc)))
+			{
+				fprintf(stderr,"ERROR: Out of memory.\n");
+				goto DONE;
+			}
+		}
+		if (len && fread(data,len,1,fp) != 1)
+		{
+			cnt = 1;
+			break;
+		}
+
+		secs = (time_t)ntohl(rec.secs);
+		strftime(tstr,sizeof(tstr),"%F %T",localtime(&secs));
+		snprintf(pre,sizeof(pre),"%s: %d: ",tstr,pid);
+		hexdump(pre,data,data + len,ntohl(rec.type) == CAPTURE_RX);
+	}
+	if (ferror(fp))
+		fprintf(stderr,"ERROR: Reading \"%s\": %s\n",path,strerror(errno));
+	else
+	{
+		/* A master that was killed can leave half a record at the end */
+		if (cnt) fprintf(stderr,"WARNING: \"%s\" is truncated.\n",path);
+		ok = 1;
+	}
+
+	DONE:
+	free(data);
+	fclose(fp);
+	return ok;
+}
+
+
+
+
+/*** Same output as hexdump() in network.c ***/
+void hexdump(char *pre, u_char *start, u_char *end, int rx)
+{
+	u_char *linestart;
+	u_char *ptr;
+	u_char c;
+	int i;
+
+	for(ptr=linestart=start;ptr < end;linestart=ptr)
+	{
+		printf("%s%s",pre,rx ? "RX: | " : "TX: | ");
+		for(i=0;i < HEXDUMP_CHARS;++i)
+		{
+			if (ptr < end)
+				printf("%02X ",*ptr++);
+			else
+				printf("   ");
+		}
+		printf("| ");
+
+		for(i=0,ptr=linestart;i < HEXDUMP_CHARS;++i)
+		{
+			if (ptr < end)
+			{
+				c = *ptr++;
+				putchar((c > 31 && c < 128) ? (char)c : '.');
+			}
+			else putchar(' ');
+		}
+		putchar('\n');
+	}
+}
@@ -4,7 +4,10 @@
  login and also will converted old password format files (pre telnetd version 
  20240906) to the current one. Password line format is now:
 
- <username>:<encrypted pwd>:<max attempts>:<reserved>:<shell string>
+ <username>:<encrypted pwd>:<max attempts>:<limits>:<shell string>
+
+ It can also compile the password file into a cdb constant database which
+ telnetd can use instead of the text file via the pwd_db_file config option.
  *****************************************************************************/
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -23,9 +26,11 @@
 #include <sys/types.h>
 
 #include "build_date.h"
+#include "cdb.h"
 
-#define VERSION       "20240906"
+#define VERSION       "20261019"
 #define FILENAME      "telnetd.pwd"
+#define DB_EXTENSION  ".cdb"
 #define MIN_USER_LEN  2
 #define MAX_USER_LEN  32 /* Seems to be a general unix limit */
 #define MIN_PWD_LEN   3  
@@ -72,12 +77,14 @@ struct termios saved_tio;
 char *username;
 char *password;
 char *filename;
+char *db_filename;
 char *shell_str;
 char *map_start;
 char *map_end;
 int kbraw;
 int attempts;
 int convert;
+int build_db;
 
 void  init(void);
 void  parseConfigFile(int argc, char **argv);
@@ -91,6 +98,7 @@ void  mapFile(void);
 void  convertFile(void);
 void  checkNewUser(void);
 void  writeEntry(void);
+void  buildDB(void);
 void  sigHandler(int sig);
 
 
@@ -104,6 +112,11 @@ int main(int argc, char **argv)
 		convertFile();
 		return 0;
 	}
+	if (build_db)
+	{
+		buildDB();
+		return 0;
+	}
 	if (!username) getUsername();
 	if (!password) getPassword();
 	checkValidUsername();
@@ -115,6 +128,9 @@ int main(int argc, char **argv)
 		checkNewUser();
 	}
 	writeEntry();
+
+	/* Keep the compiled version up to date if there is one */
+	if (!access(db_filename,F_OK)) buildDB();
 	return 0;
 }
 
@@ -140,9 +156,11 @@ void parseConfigFile(int argc, char **argv)
 	password = NULL;
 	shell_str = NULL;
 	filename = NULL;
+	db_filename = NULL;
 	enc_type = ENC_DES;
 	attempts = 0;
 	convert = 0;
+	build_db = 0;
 
 	for(i=1;i < argc;++i)
 	{
@@ -153,6 +171,9 @@ void parseConfigFile(int argc, char **argv)
 		c = argv[i][1];
 		switch(c)
 		{
+		case 'b':
+			build_db = 1;
+			continue;
 		case 'c':
 			convert = 1;
 			continue;
@@ -178,6 +199,9 @@ void parseConfigFile(int argc, char **argv)
 		case 'f':
 			filename = argv[++i];
 			break;
+		case 'd':
+			db_filename = argv[++i];
+			break;
 		case 'm':
 			attempts = atoi(argv[++i]);
 			break;
@@ -200,6 +224,8 @@ void parseConfigFile(int argc, char **argv)
 		}
 	}
 	if (!filename) filename = FILENAME;
+	if (!db_filename)
+		assert(asprintf(&db_filename,"%s%s",filename,DB_EXTENSION) != -1);
 	if (attempts >= 0) return;
 
 	USAGE:
@@ -210,6 +236,9 @@ void parseConfigFile(int argc, char **argv)
 	       "                                 default system wide field in telnetd.cfg.\n"
 	       "                                 Default = none\n"
 	       "       -f <password file>      : Default = \"%s\"\n"
+	       "       -d <database file>      : Compiled password database. If it exists it\n"
+	       "                                 is rebuilt after a user is added.\n"
+	       "                                 Default = \"<password file>%s\"\n"
 	       "       -m <max login attempts> : Max login attempts for user at login prompt.\n"
 	       "                                 Must be >= 0. Zero means user system default.\n"
 	       "                                 Default = 0.\n"
@@ -220,12 +249,15 @@ void parseConfigFile(int argc, char **argv)
 #endif
 	       "       -c                      : Convert an old format password file into the\n"
 	       "                                 new format and write it to stdout.\n"
+	       "       -b                      : Build the compiled password database from\n"
+	       "                                 the password file then exit.\n"
 	       "       -v                      : Print version and build date then exit.\n"
 	       "\nNote: All arguments are optional. If username and/or password are not provided\n"
 	       "      you will be prompted for them unless -c given. This means they will not\n"
 	       "      get stored in the shell history as they would using the command line\n"
-	       "      arguments. The -c option only uses -f and -m.\n",
-		argv[0],FILENAME);
+	       "      arguments. The -c option only uses -f and -m and the -b option only\n"
+	       "      uses -f and -d.\n",
+		argv[0],FILENAME,DB_EXTENSION);
 	exit(1);
 }
 
@@ -483,7 +515,7 @@ void convertFile(void)
 	int linenum = 1;
 
 	/* Old format: <username>:<encrypted pwd>:<shell string> 
-	   New format: <username>:<encrypted pwd>:<max attempts>:<reserved>:<shell string>
+	   New format: <username>:<encrypted pwd>:<max attempts>:<limits>:<shell string>
 	*/
 	for(ptr=map_start;ptr < map_end;++ptr)
 	{
@@ -625,6 +657,80 @@ void writeEntry(void)
 
 
 
+/*** Compile the password file into a cdb database in a single pass. The
+     key is the username and the data is the line number as 4 bytes little
+     endian followed by the line itself. The database is built in a temporary
+     file which is then renamed over the old one so telnetd never sees a
+     half written file. ***/
+void buildDB(void)
+{
+	struct st_cdb_make cm;
+	char *ptr;
+	char *end;
+	char *colon;
+	char *data = NULL;
+	int data_size = 0;
+	int linenum;
+	int users;
+	int len;
+
+	/* Map first as it exits on failure and would leave the temporary
+	   file behind */
+	mapFile();
+	if (!cdbMakeStart(&cm,db_filename))
+	{
+		perror("ERROR: cdbMakeStart()");
+		exit(1);
+	}
+
+	for(ptr=map_start,linenum=1,users=0;ptr < map_end;ptr=end+1,++linenum)
+	{
+		for(end=ptr;end < map_end && *end != '\n';++end);
+		if (ptr == end || *ptr == '#') continue;
+
+		for(colon=ptr;colon < end && *colon != ':';++colon);
+		if (colon == end || colon == ptr)
+		{
+			fprintf(stderr,"WARNING: Line %d corrupted.\n",linenum);
+			continue;
+		}
+
+		len = (int)(end - ptr);
+		if (len + 4 > data_size)
+		{
+			data_size = len + 4;
+			data = (char *)realloc(data,data_size);
+			assert(data);
+		}
+		data[0] = linenum & 0xFF;
+		data[1] = (linenum >> 8) & 0xFF;
+		data[2] = (linenum >> 16) & 0xFF;
+		data[3] = (linenum >> 24) & 0xFF;
+		memcpy(data+4,ptr,len);
+
+		if (!cdbMakeAdd(&cm,ptr,(int)(colon - ptr),data,len + 4))
+		{
+			perror("ERROR: cdbMakeAdd()");
+			cdbMakeAbort(&cm);
+			exit(1);
+		}
+		++users;
+	}
+	free(data);
+	munmap(map_start,fs.st_size);
+
+	if (!cdbMakeFinish(&cm))
+	{
+		perror("ERROR: cdbMakeFinish()");
+		exit(1);
+	}
+	printf("Database \"%s\" built from \"%s\" with %d users.\n",
+		db_filename,filename,users);
+}
+
+
+
+
 void sigHandler(int sig)
 {
 	putchar('\n');
@@ -69,7 +69,7 @@ u_char *parseTelopt(u_char *p, u_char *end)
 		if (len < 3) return NULL;
 		if (state != STATE_TELOPT && opt != TELOPT_NAWS)
 		{
-			logprintf(master_pid,"TELOPT: Ignoring SB option %d, wrong state.\n",opt);
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Ignoring SB option %d, wrong state.\n",opt);
 			return findSubOptEnd(p+3,end);
 		}
 		switch(opt)
@@ -84,14 +84,14 @@ u_char *parseTelopt(u_char *p, u_char *end)
 		case TELOPT_NEW_ENVIRON:
 			return getEnviroment(p+3,end);
 		}
-		logprintf(master_pid,"TELOPT: Unexpected SB option %u\n",(u_char)opt);
+		LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Unexpected SB option %u\n",(u_char)opt);
 		return findSubOptEnd(p+3,end);
 
 	case TELNET_WILL:
 		if (len < 3) return NULL;
 		if (state != STATE_TELOPT)
 		{
-			logprintf(master_pid,"TELOPT: Ignoring WILL option %d, wrong state.\n",opt);
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Ignoring WILL option %d, wrong state.\n",opt);
 			return findSubOptEnd(p+3,end);
 		}
 		switch(opt)
@@ -109,7 +109,7 @@ u_char *parseTelopt(u_char *p, u_char *end)
 			break;
 		
 		default:
-			logprintf(master_pid,"TELOPT: Refusing WILL option %u\n",
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Refusing WILL option %u\n",
 				(u_char)opt);
 			sendResponse(TELNET_DONT,opt);
 			break;
@@ -120,31 +120,31 @@ u_char *parseTelopt(u_char *p, u_char *end)
 		if (len < 3) return NULL;
 		if (state != STATE_TELOPT)
 		{
-			logprintf(master_pid,"TELOPT: Ignoring WONT option %d, wrong state.\n",opt);
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Ignoring WONT option %d, wrong state.\n",opt);
 			return findSubOptEnd(p+3,end);
 		}
 		switch(opt)
 		{
 		case TELOPT_NAWS:
-			logprintf(master_pid,"TELOPT: Client WONT terminal size.\n");
-			sockprintf("Your client refused to send terminal size.\n");
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Client WONT terminal size.\n");
+			SOCKSTR("Your client refused to send terminal size.\r\n");
 			break;
 
 		case TELOPT_TTYPE:
-			logprintf(master_pid,"TELOPT: Client WONT terminal type.\n");
-			sockprintf("Your client refused to send terminal type.\n");
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Client WONT terminal type.\n");
+			SOCKSTR("Your client refused to send terminal type.\r\n");
 			/* So we don't keep waiting for it */
 			flags.rx_ttype = 1;
 			break;
 
 		case TELOPT_NEW_ENVIRON:
-			logprintf(master_pid,"TELOPT: Client WONT enviroment vars.\n");
-			sockprintf("Your client refused to send enviroment variables.\n");
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Client WONT enviroment vars.\n");
+			SOCKSTR("Your client refused to send enviroment variables.\r\n");
 			flags.rx_env = 1;
 			break;
 
 		default:
-			logprintf(master_pid,"TELOPT: Unexpected WONT option %u\n",
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Unexpected WONT option %u\n",
 				(u_char)opt);
 			break;
 		}
@@ -153,7 +153,7 @@ u_char *parseTelopt(u_char *p, u_char *end)
 	case TELNET_DO:
 		if (state != STATE_TELOPT)
 		{
-			logprintf(master_pid,"TELOPT: Ignoring DO option %d, wrong state.\n",opt);
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Ignoring DO option %d, wrong state.\n",opt);
 			return findSubOptEnd(p+3,end);
 		}
 		switch(opt)
@@ -168,7 +168,7 @@ u_char *parseTelopt(u_char *p, u_char *end)
 			break;
 
 		default:
-			logprintf(master_pid,"TELOPT: Refusing DO option %u\n",
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Refusing DO option %u\n",
 				(u_char)opt);
 			sendResponse(TELNET_WONT,opt);
 			break;
@@ -179,7 +179,7 @@ u_char *parseTelopt(u_char *p, u_char *end)
 		if (len < 3) return NULL;
 		if (state != STATE_TELOPT)
 		{
-			logprintf(master_pid,"TELOPT: Ignoring DONT option %d, wrong state.\n",opt);
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Ignoring DONT option %d, wrong state.\n",opt);
 			return findSubOptEnd(p+3,end);
 		}
 
@@ -187,20 +187,20 @@ u_char *parseTelopt(u_char *p, u_char *end)
 		{
 		case TELOPT_SGA:
 			logprintf(master_pid,"TELOPT: Client does not support character mode, exiting.\n");
-			sockprintf("ERROR: Your client does not support character mode, cannot continue.\n");
+			SOCKSTR("ERROR: Your client does not support character mode, cannot continue.\r\n");
 			masterExit(1);
 		case TELOPT_ECHO:
 			break;
 
 		default:
-			logprintf(master_pid,"TELOPT: Unexpected DONT option %u\n",
+			LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Unexpected DONT option %u\n",
 				(u_char)opt);
 			break;
 		}
 		return p+2;
 
 	default:
-		logprintf(master_pid,"TELOPT: Unexpected command/option %d\n",com);
+		LOGPRINTF(LOG_DEBUG,master_pid,"TELOPT: Unexpected command/option %d\n",com);
 		break;
 	}
 
@@ -276,6 +276,7 @@ u_char *getTermSize(u_char *p, u_char *end)
 	/* Have to do this to keep shell updated as client will send NAWS
 	   when the xterm is resized */
 	notifyWinSize();
+	if (flags.record) recordResize();
 	return end;
 }
 
@@ -305,7 +306,7 @@ u_char *getTermType(u_char *p, u_char *end)
 
 	/* Want it passed down to slave child processes. If there's a way to
 	   do it using ioctl() as per terminal size I can't find it. */
-	setenv("TERM",(char *)p,1);
+	arenaSetEnv("TERM",(char *)p);
 	flags.rx_ttype = 1;
 
 	return end;
@@ -322,6 +323,7 @@ u_char *getEnviroment(u_char *p, u_char *end)
 {
 	u_char *e;
 	char *varname;
+	char *value;
 	int get_var_name;
 	int len;
 	
@@ -347,7 +349,7 @@ u_char *getEnviroment(u_char *p, u_char *end)
 				if (!len)
 				{
 					/* Bail out if there's corruption */
-					logprintf(master_pid,"TELOPT: WARNING: Zero length env var name.\n");
+					logprintfLimit(NULL,master_pid,"TELOPT: WARNING: Zero length env var name.\n");
 					return end;
 				}
 				*e = 0;
@@ -362,19 +364,19 @@ u_char *getEnviroment(u_char *p, u_char *end)
 			if (len)
 			{
 				*e = 0;
-				setenv(varname,(char *)p,1);
-				logprintf(master_pid,
+				logprintfLimit(NULL,master_pid,
 					"TELOPT: Env var = \"%s\", value = \"%s\"\n",
 					varname,p);
+				value = arenaSetEnv(varname,(char *)p);
 
 				/* Store username for login program */
-				if (!telopt_username &&
+				if (value && !telopt_username &&
 				    !strcmp(varname,"USER"))
 				{
-					telopt_username = strdup((char *)p);
+					telopt_username = value;
 				}
 			}
-			else setenv(varname,"",1);
+			else arenaSetEnv(varname,"");
 			get_var_name = 1;
 			p = e+1;
 		}
@@ -384,7 +386,7 @@ u_char *getEnviroment(u_char *p, u_char *end)
 	if (!get_var_name)
 	{
 		/* Expecting matching value for variable */
-		logprintf(master_pid,"TELOPT: WARNING: Unexpected end of enviroment variable list.");
+		logprintfLimit(NULL,master_pid,"TELOPT: WARNING: Unexpected end of enviroment variable list.");
 	}
 	return end;
 }
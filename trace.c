@@ -0,0 +1,440 @@
+/*****************************************************************************
+ Per session tracing. A traced session logs at trace level and dumps or
+ captures its data (see capture.c) without the hexdump option having to be
+ turned on for everyone and the daemon restarted.
+
+ If control_socket is set the parent listens on a unix socket there for
+ one line commands, eg "echo trace user fred | nc -U <control_socket>":
+
+     trace   pid|user|ip <value>
+     untrace pid|user|ip <value>
+     untrace all
+     list
+
+ list replies with the rules, one per line, followed by the DNS cache hit
+ and miss counts if the cache is on.
+
+ The rules are kept in shared memory and each time they change the parent
+ sends every master a SIGUSR1 so it checks whether it matches. New masters
+ check when they start and again when they get a username. A SIGUSR2 sent
+ straight to a master turns tracing on or off for it whatever the rules.
+ Masters that aren't traced only ever test a flag set by the signal.
+ *****************************************************************************/
+
+#include "globals.h"
+#include <sys/un.h>
+
+#define TRACE_MAX_RULES 32
+#define TRACE_VALUE_LEN 64
+#define TRACE_CMD_LEN   200
+
+enum
+{
+	TRACE_PID,
+	TRACE_USER,
+	TRACE_IP,
+
+	NUM_TRACE_TYPES
+};
+
+struct st_trace_rule
+{
+	int type;
+	char value[TRACE_VALUE_LEN];
+};
+
+struct st_trace_table
+{
+	volatile pid_t lock;
+	int cnt;
+	struct st_trace_rule rule[TRACE_MAX_RULES];
+};
+
+static char *trace_type_name[NUM_TRACE_TYPES] =
+{
+	"pid",
+	"user",
+	"ip"
+};
+
+static struct st_trace_table *table = NULL;
+static int ctl_sock = -1;
+
+/* Master */
+static volatile sig_atomic_t trace_pending = 0;
+static volatile sig_atomic_t trace_toggled = 0;
+static struct sockaddr_in trace_addr;
+static int traced = 0;
+static int trace_started_capture;
+static int saved_log_level;
+static int saved_hexdump;
+
+static void runCommand(int csock);
+static void addRule(char *reply, int type, char *value);
+static void removeRule(char *reply, int type, char *value);
+static int  matchRules(void);
+static void setTrace(int on);
+
+
+/*** Called by the parent after the config has been read. The rules are
+     kept over a restart. ***/
+void initTrace(void)
+{
+	struct sockaddr_un addr;
+
+	if (!control_socket)
+	{
+		if (table) table->cnt = 0;
+		return;
+	}
+	if (!table &&
+	    !(table = (struct st_trace_table *)mapSharedMem(
+		sizeof(struct st_trace_table))))
+	{
+		logprintf(0,"WARNING: Control socket disabled.\n");
+		return;
+	}
+	if (strlen(control_socket) >= sizeof(addr.sun_path))
+	{
+		logprintf(0,"ERROR: Control socket path \"%s\" is too long.\n",
+			control_socket);
+		parentExit(1);
+	}
+	bzero(&addr,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,control_socket);
+
+	/* Remove the one left by the last run or before the restart */
+	unlink(control_socket);
+	if ((ctl_sock = socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0)) == -1 ||
+	    bind(ctl_sock,(struct sockaddr *)&addr,sizeof(addr)) == -1 ||
+	    chmod(control_socket,0600) == -1 ||
+	    listen(ctl_sock,5) == -1)
+	{
+		logprintf(0,"ERROR: initTrace(): \"%s\": %s\n",
+			control_socket,strerror(errno));
+		parentExit(1);
+	}
+}
+
+
+
+
+/*** Called by clear() in the parent and by new masters ***/
+void closeControlSocket(void)
+{
+	if (ctl_sock == -1) return;
+	close(ctl_sock);
+	ctl_sock = -1;
+}
+
+
+
+
+void setControlMask(fd_set *mask)
+{
+	if (ctl_sock != -1) FD_SET(ctl_sock,mask);
+}
+
+
+
+
+/*** Call after select() returns in the parent ***/
+void checkControl(fd_set *mask)
+{
+	struct timeval tv;
+	int csock;
+
+	if (ctl_sock == -1 || !FD_ISSET(ctl_sock,mask)) return;
+	if ((csock = accept(ctl_sock,NULL,NULL)) == -1)
+	{
+		if (errno != EINTR)
+		{
+			logprintf(parent_pid,"ERROR: checkControl(): accept(): %s\n",
+				strerror(errno));
+		}
+		return;
+	}
+
+	/* Don't let a client that never sends anything hang the parent */
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(csock,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	runCommand(csock);
+	close(csock);
+}
+
+
+
+
+/*** Signal handler installed by the parent so a master has it from the
+     moment it's forked ***/
+void traceSigHandler(int sig)
+{
+	if (sig == SIGUSR2) trace_toggled = !trace_toggled;
+	trace_pending = 1;
+}
+
+
+
+
+/*** Called by the master when it starts ***/
+void startTrace(struct sockaddr_in *ip_addr)
+{
+	trace_addr = *ip_addr;
+	trace_toggled = 0;
+	traced = 0;
+	trace_pending = (table && table->cnt);
+	checkTrace();
+}
+
+
+
+
+/*** Called by the master when it gets the username ***/
+void recheckTrace(void)
+{
+	if (table && table->cnt) trace_pending = 1;
+}
+
+
+
+
+/*** Call after select() in the master ***/
+void checkTrace(void)
+{
+	int on;
+
+	if (!trace_pending) return;
+	trace_pending = 0;
+
+	on = (trace_toggled || matchRules());
+	if (on != traced) setTrace(on);
+}
+
+
+
+
+/********************************** PARENT **********************************/
+
+void runCommand(int csock)
+{
+	char cmd[TRACE_CMD_LEN];
+	char reply[TRACE_CMD_LEN + 50];
+	char *reply_ptr;
+	u_long hits;
+	u_long misses;
+	char **words;
+	int word_cnt;
+	int len;
+	int i;
+
+	for(len=0;len < TRACE_CMD_LEN - 1;len += i)
+	{
+		if ((i = read(csock,cmd + len,TRACE_CMD_LEN - 1 - len)) < 1 ||
+		    memchr(cmd + len,'\n',i))
+		{
+			if (i > 0) len += i;
+			break;
+		}
+	}
+	cmd[len] = 0;
+	splitString(cmd,NULL,&words,&word_cnt);
+
+	strcpy(reply,"OK\n");
+	if (word_cnt == 1 && !strcmp(words[0],"list"))
+	{
+		/* One line per rule then OK */
+		shmLock(&table->lock);
+		for(i=0,reply_ptr=NULL;i < table->cnt;++i)
+		{
+			len = asprintf(&reply_ptr,"%s %s\n",
+				trace_type_name[table->rule[i].type],
+				table->rule[i].value);
+			if (len != -1)
+			{
+				send(csock,reply_ptr,len,MSG_NOSIGNAL);
+				free(reply_ptr);
+			}
+		}
+		shmUnlock(&table->lock);
+
+		if (getDNSCacheStats(&hits,&misses) &&
+		    (len = asprintf(&reply_ptr,"dns_cache hits %lu misses %lu\n",
+		                    hits,misses)) != -1)
+		{
+			send(csock,reply_ptr,len,MSG_NOSIGNAL);
+			free(reply_ptr);
+		}
+	}
+	else if (word_cnt == 2 &&
+	         !strcmp(words[0],"untrace") && !strcmp(words[1],"all"))
+	{
+		removeRule(reply,NUM_TRACE_TYPES,NULL);
+	}
+	else if (word_cnt == 3 &&
+	         (!strcmp(words[0],"trace") || !strcmp(words[0],"untrace")))
+	{
+		for(i=0;i < NUM_TRACE_TYPES &&
+		        strcmp(words[1],trace_type_name[i]);++i);
+		if (i == NUM_TRACE_TYPES)
+			strcpy(reply,"ERROR: Type must be pid, user or ip.\n");
+		else if (words[0][0] == 't')
+			addRule(reply,i,words[2]);
+		else
+			removeRule(reply,i,words[2]);
+	}
+	else strcpy(reply,"ERROR: Unknown command.\n");
+
+	if (strncmp(reply,"OK",2))
+	{
+		logprintf(parent_pid,"CONTROL: \"%.*s\": %s",
+			(int)strcspn(cmd,"\r\n"),cmd,reply);
+	}
+	send(csock,reply,strlen(reply),MSG_NOSIGNAL);
+	freeWordArray(words,word_cnt);
+}
+
+
+
+
+void addRule(char *reply, int type, char *value)
+{
+	int i;
+
+	if (strlen(value) >= TRACE_VALUE_LEN)
+	{
+		strcpy(reply,"ERROR: Value too long.\n");
+		return;
+	}
+	shmLock(&table->lock);
+	for(i=0;i < table->cnt;++i)
+	{
+		if (table->rule[i].type == type &&
+		    !strcmp(table->rule[i].value,value)) break;
+	}
+	if (i == table->cnt)
+	{
+		if (table->cnt == TRACE_MAX_RULES)
+		{
+			shmUnlock(&table->lock);
+			strcpy(reply,"ERROR: Too many rules.\n");
+			return;
+		}
+		table->rule[i].type = type;
+		strcpy(table->rule[i].value,value);
+		++table->cnt;
+	}
+	shmUnlock(&table->lock);
+
+	logprintf(parent_pid,"CONTROL: Tracing %s %s\n",
+		trace_type_name[type],value);
+	signalSessions(SIGUSR1);
+}
+
+
+
+
+/*** NUM_TRACE_TYPES removes all of them ***/
+void removeRule(char *reply, int type, char *value)
+{
+	int cnt;
+	int i;
+
+	shmLock(&table->lock);
+	cnt = table->cnt;
+	if (type == NUM_TRACE_TYPES) table->cnt = 0;
+	for(i=0;i < table->cnt;)
+	{
+		if (table->rule[i].type == type && !strcmp(table->rule[i].value,value))
+			table->rule[i] = table->rule[--table->cnt];
+		else
+			++i;
+	}
+	cnt -= table->cnt;
+	shmUnlock(&table->lock);
+
+	if (!cnt && type != NUM_TRACE_TYPES)
+	{
+		strcpy(reply,"ERROR: No such rule.\n");
+		return;
+	}
+	if (type == NUM_TRACE_TYPES)
+		logprintf(parent_pid,"CONTROL: Untracing all\n");
+	else
+	{
+		logprintf(parent_pid,"CONTROL: Untracing %s %s\n",
+			trace_type_name[type],value);
+	}
+	signalSessions(SIGUSR1);
+}
+
+
+
+
+/********************************** MASTER **********************************/
+
+/*** Returns 1 if any of the rules is for this session ***/
+int matchRules(void)
+{
+	struct st_trace_rule *rule;
+	char pidstr[20];
+	char *uname;
+	int match = 0;
+	int i;
+
+	if (!table) return 0;
+
+	snprintf(pidstr,sizeof(pidstr),"%d",master_pid);
+	uname = username[0] ? username : telopt_username;
+
+	shmLock(&table->lock);
+	for(i=0,rule=table->rule;i < table->cnt && !match;++i,++rule)
+	{
+		switch(rule->type)
+		{
+		case TRACE_PID:
+			match = !strcmp(rule->value,pidstr);
+			break;
+		case TRACE_USER:
+			match = (uname && !strcmp(rule->value,uname));
+			break;
+		case TRACE_IP:
+			match = !strcmp(rule->value,inet_ntoa(trace_addr.sin_addr));
+		}
+	}
+	shmUnlock(&table->lock);
+	return match;
+}
+
+
+
+
+/*** Capture if there's somewhere to put it otherwise hexdump to the log.
+     Turning it off puts back what the config file says. ***/
+void setTrace(int on)
+{
+	if (on)
+	{
+		saved_log_level = log_level;
+		saved_hexdump = flags.hexdump;
+		log_level = LOG_TRACE;
+		trace_started_capture = 0;
+		if (capture_dir && !flags.capture)
+		{
+			startCapture(&trace_addr);
+			trace_started_capture = flags.capture;
+		}
+		if (!flags.capture) flags.hexdump = 1;
+		logprintf(master_pid,"TRACE: On (%s)\n",
+			flags.capture ? "capture" : "hexdump");
+	}
+	else
+	{
+		logprintf(master_pid,"TRACE: Off\n");
+		log_level = saved_log_level;
+		flags.hexdump = saved_hexdump;
+		if (trace_started_capture) endCapture();
+	}
+	traced = on;
+}
@@ -1,13 +1,10 @@
 /*** For when telnetd does its own login validation ***/
 #include "globals.h"
+#include "cdb.h"
 
-static struct stat fs;
-static char *map_start;
-static char *map_end;
-
-static int   validateTelnetdPwd(char *password);
-static int   mapTelnetdPwdFile(void);
-static int   parseTelnetdPwdFile(char *password);
+static int validateTelnetdPwd(char *password);
+static int validateTelnetdPwdDB(char *password);
+static int checkTelnetdPwd(char **field, int linenum, char *password);
 
 
 /*** Validate the user password. 1 means valid, 0 means invalid, -1 means
@@ -69,87 +66,90 @@ int validatePwd(char *password)
 
 
 
-/*** Validate the user from the telnetd password file. Could have the file
-     permanently mapped to save re-opening it all the time but that wouldn't
-     see updates and it would be a security risk anyway ***/
+/*** Validate the user from the telnetd password file. The file is held in
+     memory by the parent and reloaded whenever it changes so there's no I/O
+     here unless the compiled version built by tduser is being used. ***/
 int validateTelnetdPwd(char *password)
 {
-	int ret;
+	struct st_pwd_entry *entry;
 
 	assert(password);
 	if (!*password) return 0;
+	if (pwd_db_file) return validateTelnetdPwdDB(password);
 
-	if (!mapTelnetdPwdFile()) return -1;
-	ret = parseTelnetdPwdFile(password);
+	if (!pwdDBLoaded())
+	{
+		logprintf(master_pid,"ERROR: validateTelnetdPwd(): Password file \"%s\" not loaded.\n",
+			pwd_file);
+		return -1;
+	}
+	/* User not found */
+	if (!(entry = findPwdEntry(username))) return 0;
 
-	munmap(map_start,fs.st_size);
-	return ret;
+	return checkTelnetdPwd(entry->field,entry->linenum,password);
 }
 
 
 
 
-/*** Map the file instead of reading it in 1 char at a time as its easier
-     parsing it with pointers ***/
-int mapTelnetdPwdFile(void)
+/*** Look the user up in the cdb file. It's opened each time so that a
+     rebuild by tduser, which renames the new file into place, is seen
+     straight away. Each record is the original line number as 4 bytes
+     little endian followed by the password file line. ***/
+int validateTelnetdPwdDB(char *password)
 {
+	char *field[NUM_PWD_FIELDS];
+	u_char *data;
+	uint32_t dlen;
+	int linenum;
+	int ret;
 	int fd;
 
-	if ((fd=open(pwd_file,O_RDONLY,0666)) == -1)
+	if ((fd = open(pwd_db_file,O_RDONLY)) == -1)
 	{
-		logprintf(master_pid,"ERROR: mapTelnetdPwdFile(): open(): %s\n",
-			strerror(errno));
-		return 0;
+		logprintf(master_pid,"ERROR: validateTelnetdPwdDB(): open(\"%s\"): %s\n",
+			pwd_db_file,strerror(errno));
+		return -1;
 	}
-	if (fstat(fd,&fs) == -1)
+	ret = cdbFind(fd,username,strlen(username),(char **)&data,&dlen);
+	close(fd);
+
+	switch(ret)
 	{
-		logprintf(master_pid,"ERROR: mapTelnetdPwdFile(): fstat(): %s\n",
+	case -1:
+		logprintf(master_pid,"ERROR: validateTelnetdPwdDB(): cdbFind(): %s\n",
 			strerror(errno));
+		return -1;
+	case 0:
 		return 0;
 	}
-	/* size+1 so we can temporarily shove a \0 on end */
-	if ((map_start = (char *)mmap(
-		NULL,fs.st_size+1,
-		PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+	if (dlen < 4)
 	{
-		logprintf(master_pid,"ERROR: mapTelnetdPwdFile(): mmap(): %s\n",
-			strerror(errno));
-		return 0;
+		logprintf(master_pid,"ERROR: validateTelnetdPwdDB(): Corrupt record for user \"%s\".\n",
+			username);
+		free(data);
+		return -1;
 	}
-	close(fd);
-
-	map_end = map_start + fs.st_size;
-	return 1;
+	linenum = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+	splitPwdLine((char *)data + 4,(char *)data + dlen,field);
+	ret = checkTelnetdPwd(field,linenum,password);
+	free(data);
+	return ret;
 }
 
 
 
 
-/*** Go through the file and find the user which is in global 'username' ***/
-int parseTelnetdPwdFile(char *password)
+/*** Check the password against the user's entry in the password file ***/
+int checkTelnetdPwd(char **field, int linenum, char *password)
 {
-	char *field[NUM_PWD_FIELDS];
 	char *ptr;
 	char *salt;
 	char *epwd;
 	char *estr;
 	char c;
-	int linenum;
 	int attempts;
 
-	logprintf(master_pid,"Reading password file \"%s\"...\n",pwd_file);
-
-	/* Go through each line until we find user we're looking for */
-	for(ptr=map_start,linenum=1;ptr < map_end;++linenum)
-	{
-		ptr = splitPwdLine(ptr,map_end,field);
-		if (!field[PWD_USER]) continue;
-		if (!strcmp(username,field[PWD_USER])) goto FOUND_USER;
-	}
-	/* User not found */
-	return 0;
-
-	FOUND_USER:
 	epwd = field[PWD_EPWD];
 	estr = field[PWD_EXEC_STR];
 
@@ -176,7 +176,7 @@ int parseTelnetdPwdFile(char *password)
 		/* Have to flag this because MacOS crypt() will happily try
 		   and decrypt a non DES encryption because the dollar chars 
 		   have no special meaning for it */
-		logprintf(master_pid,"ERROR: User \"%s\": parseTelnetdPwd(): Only DES encryption is supported by MacOS crypt() on line %d.\n",
+		logprintf(master_pid,"ERROR: User \"%s\": checkTelnetdPwd(): Only DES encryption is supported by MacOS crypt() on line %d.\n",
 			username,linenum);
 		return -1;
 #endif
@@ -186,7 +186,7 @@ int parseTelnetdPwdFile(char *password)
 
 	if (!(ptr = crypt(password,salt)))
 	{
-		logprintf(master_pid,"ERROR: User \"%s\": parseTelnetdPwd(): crypt() returned NULL. Possibly encryption type not supported on line %d.\n",
+		logprintf(master_pid,"ERROR: User \"%s\": checkTelnetdPwd(): crypt() returned NULL. Possibly encryption type not supported on line %d.\n",
 			username,linenum);
 		return -1;
 	}
@@ -195,6 +195,10 @@ int parseTelnetdPwdFile(char *password)
 	/* If password doesn't match then return before we bother parsing
 	   the exec line */
 	if (strcmp(ptr,epwd)) return 0;
+
+	/* Per user resource limits override the config ones */
+	if (field[PWD_LIMITS] && !parseUserLimits(field[PWD_LIMITS],linenum))
+		return -1;
 	if (!estr) return 1;
 
 	/* Overwrite global shell exec string. Because we're a forked process 
@@ -205,7 +209,7 @@ int parseTelnetdPwdFile(char *password)
 	splitString(estr,NULL,&shell_exec_argv,&shell_exec_argv_cnt);
 	if (shell_exec_argv_cnt < 1)
 	{
-		logprintf(master_pid,"ERROR: User \"%s\": parseTelnetdPwd(): Empty or invalid exec string on line %d.\n",
+		logprintf(master_pid,"ERROR: User \"%s\": checkTelnetdPwd(): Empty or invalid exec string on line %d.\n",
 			username,linenum);
 		return -1;
 	}
@@ -0,0 +1,189 @@
+/*****************************************************************************
+ Watches files the parent process has loaded into memory so they can be
+ reloaded when they change without needing a restart. On Linux this uses
+ inotify on the file's directory so that files replaced by a rename (which
+ is what editors and tduser do) are spotted. Elsewhere the modification time
+ is polled every WATCH_POLL_SECS from the parent's main loop.
+ *****************************************************************************/
+
+#include "globals.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define WATCH_POLL_SECS 5
+
+struct st_watch
+{
+	char *path;
+	char *dir;
+	char *base;
+	int wd;
+	time_t mtime;
+	void (*func)(void);
+};
+
+static struct st_watch *watches = NULL;
+static int watch_cnt = 0;
+static int inotify_fd = -1;
+static time_t last_poll = 0;
+
+static void callWatch(struct st_watch *w);
+
+
+/*** Add a file to watch. func is called after the file has been changed ***/
+void addWatch(char *path, void (*func)(void))
+{
+	struct st_watch *w;
+	struct stat fs;
+	char *ptr;
+
+	watches = (struct st_watch *)realloc(
+		watches,sizeof(struct st_watch) * (watch_cnt + 1));
+	assert(watches);
+	w = &watches[watch_cnt];
+
+	w->path = strdup(path);
+	w->func = func;
+	w->wd = -1;
+	w->mtime = stat(path,&fs) == -1 ? 0 : fs.st_mtime;
+
+	if ((ptr = strrchr(path,'/')))
+	{
+		asprintf(&w->dir,"%.*s",(int)(ptr - path),path);
+		w->base = strdup(ptr + 1);
+	}
+	else
+	{
+		w->dir = strdup(".");
+		w->base = strdup(path);
+	}
+	++watch_cnt;
+
+#ifdef __linux__
+	if (inotify_fd == -1 &&
+	    (inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+	{
+		logprintf(0,"WARNING: addWatch(): inotify_init1(): %s\n",
+			strerror(errno));
+		return;
+	}
+	/* Watch the directory, not the file, so a rename over it is seen.
+	   Watching the same directory twice returns the same descriptor. */
+	if ((w->wd = inotify_add_watch(
+		inotify_fd,w->dir,IN_CLOSE_WRITE | IN_MOVED_TO)) == -1)
+	{
+		logprintf(0,"WARNING: addWatch(): inotify_add_watch(\"%s\"): %s\n",
+			w->dir,strerror(errno));
+	}
+#endif
+}
+
+
+
+
+void clearWatches(void)
+{
+	int i;
+
+	for(i=0;i < watch_cnt;++i)
+	{
+		free(watches[i].path);
+		free(watches[i].dir);
+		free(watches[i].base);
+	}
+	FREE(watches);
+	watches = NULL;
+	watch_cnt = 0;
+
+	if (inotify_fd != -1)
+	{
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+}
+
+
+
+
+/*** Set up the select() mask and timeout for the parent's main loop. The
+     timeout is only set if we have to poll. ***/
+void setWatchMask(fd_set *mask, struct timeval *tv, struct timeval **tvp)
+{
+	if (!watch_cnt) return;
+	if (inotify_fd != -1)
+	{
+		FD_SET(inotify_fd,mask);
+		return;
+	}
+	tv->tv_sec = WATCH_POLL_SECS;
+	tv->tv_usec = 0;
+	*tvp = tv;
+}
+
+
+
+
+/*** Call after select() returns in the parent ***/
+void checkWatches(fd_set *mask)
+{
+#ifdef __linux__
+	struct inotify_event *ev;
+	char evbuff[4096];
+	char *ptr;
+	int len;
+#endif
+	struct stat fs;
+	time_t now;
+	int i;
+
+	if (!watch_cnt) return;
+#ifdef __linux__
+	if (inotify_fd != -1)
+	{
+		if (!FD_ISSET(inotify_fd,mask)) return;
+
+		while((len = read(inotify_fd,evbuff,sizeof(evbuff))) > 0)
+		{
+			for(ptr=evbuff;ptr < evbuff + len;ptr += sizeof(*ev) + ev->len)
+			{
+				ev = (struct inotify_event *)ptr;
+				if (!ev->len) continue;
+
+				for(i=0;i < watch_cnt;++i)
+				{
+					if (watches[i].wd == ev->wd &&
+					    !strcmp(watches[i].base,ev->name))
+					{
+						callWatch(&watches[i]);
+					}
+				}
+			}
+		}
+		return;
+	}
+#endif
+	/* No inotify so poll */
+	time(&now);
+	if (now - last_poll < WATCH_POLL_SECS) return;
+	last_poll = now;
+
+	for(i=0;i < watch_cnt;++i)
+	{
+		if (stat(watches[i].path,&fs) != -1 &&
+		    fs.st_mtime != watches[i].mtime)
+		{
+			watches[i].mtime = fs.st_mtime;
+			callWatch(&watches[i]);
+		}
+	}
+}
+
+
+
+
+void callWatch(struct st_watch *w)
+{
+	logprintf(parent_pid,"File \"%s\" changed, reloading...\n",w->path);
+	w->func();
+}
@@ -0,0 +1,375 @@
+/*****************************************************************************
+ All the patterns are put into a trie so ones with a common prefix share
+ nodes and the trie is then used as an NFA where each state is a node. A
+ node reached by a '*' loops back to itself on any character. The NFA is
+ turned into a DFA lazily: each DFA state is the set of trie nodes it
+ represents and its transitions are only worked out the first time they're
+ needed, then cached. Matching is therefore one table lookup per character
+ no matter how many patterns there are and there is no backtracking. If the
+ cache grows past WC_MAX_MEMORY it is thrown away and rebuilt as needed.
+
+ Characters are mapped to classes first so the transition tables only need
+ an entry per character actually used in a pattern plus one for everything
+ else.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "wildcard.h"
+
+#define WC_MAX_MEMORY (8 * 1024 * 1024)
+
+static int  addNode(struct st_wildcard *wc, int parent, char c);
+static void addPos(struct st_wildcard *wc, int pos, int *cnt);
+static int  addState(struct st_wildcard *wc, int *set, int set_cnt);
+static int  startState(struct st_wildcard *wc);
+static int  buildNext(struct st_wildcard *wc, int snum, int cls);
+static void flushStates(struct st_wildcard *wc);
+static uint32_t hashSet(int *set, int set_cnt);
+static int  cmpInt(const void *a, const void *b);
+
+
+/*** Returns NULL if there are no patterns ***/
+struct st_wildcard *compileWildcards(char **pats, int pat_cnt)
+{
+	struct st_wildcard *wc;
+	char *ptr;
+	char c;
+	int node;
+	int i;
+
+	if (!pat_cnt) return NULL;
+
+	wc = (struct st_wildcard *)calloc(1,sizeof(struct st_wildcard));
+	assert(wc);
+
+	/* Node 0 is the root. Class 0 is any character not used literally in
+	   a pattern. */
+	addNode(wc,-1,0);
+	wc->class_cnt = 1;
+
+	for(i=0;i < pat_cnt;++i)
+	{
+		for(ptr=pats[i],node=0;*ptr;++ptr)
+		{
+			/* "**" is the same as "*" */
+			if (*ptr == '*' && ptr[1] == '*') continue;
+
+			c = tolower(*ptr);
+			node = addNode(wc,node,c);
+			if (c == '*' || c == '?' || wc->cclass[(u_char)c])
+				continue;
+
+			wc->cclass[(u_char)c] = wc->class_cnt;
+			wc->cclass[toupper((u_char)c)] = wc->class_cnt;
+			++wc->class_cnt;
+		}
+		wc->nodes[node].accept = 1;
+	}
+
+	wc->scratch = (int *)malloc(sizeof(int) * wc->node_cnt);
+	wc->mark = (u_char *)calloc(1,wc->node_cnt);
+	assert(wc->scratch && wc->mark);
+
+	flushStates(wc);
+	wc->start = startState(wc);
+	return wc;
+}
+
+
+
+
+/*** Returns 1 if the string matches any of the patterns ***/
+int matchWildcards(struct st_wildcard *wc, char *str)
+{
+	int snum;
+	int next;
+
+	if (!wc) return 0;
+
+	for(snum=wc->start;*str;++str)
+	{
+		next = wc->states[snum].next[wc->cclass[(u_char)*str]];
+		if (next == -1)
+			next = buildNext(wc,snum,wc->cclass[(u_char)*str]);
+		snum = next;
+
+		/* Nothing left that can match */
+		if (!wc->states[snum].set_cnt) return 0;
+	}
+	return wc->states[snum].accept;
+}
+
+
+
+
+void freeWildcards(struct st_wildcard *wc)
+{
+	int i;
+
+	if (!wc) return;
+	for(i=0;i < wc->state_cnt;++i)
+	{
+		free(wc->states[i].set);
+		free(wc->states[i].next);
+	}
+	free(wc->states);
+	free(wc->table);
+	free(wc->nodes);
+	free(wc->scratch);
+	free(wc->mark);
+	free(wc);
+}
+
+
+
+
+/*** Returns the child of parent on c, adding it if it doesn't exist ***/
+int addNode(struct st_wildcard *wc, int parent, char c)
+{
+	struct st_wc_node *n;
+	int node;
+
+	if (parent != -1)
+	{
+		for(node=wc->nodes[parent].child;
+		    node != -1;node=wc->nodes[node].sibling)
+		{
+			if (wc->nodes[node].c == c) return node;
+		}
+	}
+	wc->nodes = (struct st_wc_node *)realloc(
+		wc->nodes,sizeof(struct st_wc_node) * (wc->node_cnt + 1));
+	assert(wc->nodes);
+
+	node = wc->node_cnt++;
+	n = &wc->nodes[node];
+	n->child = -1;
+	n->c = c;
+	n->accept = 0;
+	if (parent == -1)
+		n->sibling = -1;
+	else
+	{
+		n->sibling = wc->nodes[parent].child;
+		wc->nodes[parent].child = node;
+	}
+	return node;
+}
+
+
+
+
+/*** Add a node to the scratch set along with its '*' child as a '*' can
+     match nothing. A '*' can't have a '*' child so no need to go deeper. ***/
+void addPos(struct st_wildcard *wc, int pos, int *cnt)
+{
+	int node;
+
+	if (wc->mark[pos]) return;
+	wc->mark[pos] = 1;
+	wc->scratch[(*cnt)++] = pos;
+
+	for(node=wc->nodes[pos].child;node != -1;node=wc->nodes[node].sibling)
+	{
+		if (wc->nodes[node].c == '*' && !wc->mark[node])
+		{
+			wc->mark[node] = 1;
+			wc->scratch[(*cnt)++] = node;
+		}
+	}
+}
+
+
+
+
+/*** Find or create the DFA state for the set. Clears the marks. ***/
+int addState(struct st_wildcard *wc, int *set, int set_cnt)
+{
+	struct st_wc_state *st;
+	uint32_t h;
+	int *ptr;
+	int snum;
+	int i;
+
+	for(i=0;i < set_cnt;++i) wc->mark[set[i]] = 0;
+	qsort(set,set_cnt,sizeof(int),cmpInt);
+
+	for(h=hashSet(set,set_cnt);;++h)
+	{
+		ptr = &wc->table[h & (wc->table_size - 1)];
+		if ((snum = *ptr) == -1) break;
+		st = &wc->states[snum];
+		if (st->set_cnt == set_cnt &&
+		    !memcmp(st->set,set,sizeof(int) * set_cnt)) return snum;
+	}
+
+	if (wc->state_cnt == wc->state_alloc)
+	{
+		wc->state_alloc *= 2;
+		wc->states = (struct st_wc_state *)realloc(
+			wc->states,sizeof(struct st_wc_state) * wc->state_alloc);
+		assert(wc->states);
+
+		/* Rehash into a table twice the size */
+		free(wc->table);
+		wc->table_size = wc->state_alloc * 2;
+		wc->table = (int *)malloc(sizeof(int) * wc->table_size);
+		assert(wc->table);
+		for(i=0;i < wc->table_size;++i) wc->table[i] = -1;
+		for(snum=0;snum < wc->state_cnt;++snum)
+		{
+			st = &wc->states[snum];
+			for(h=hashSet(st->set,st->set_cnt);
+			    wc->table[h & (wc->table_size - 1)] != -1;++h);
+			wc->table[h & (wc->table_size - 1)] = snum;
+		}
+		for(h=hashSet(set,set_cnt);;++h)
+		{
+			ptr = &wc->table[h & (wc->table_size - 1)];
+			if (*ptr == -1) break;
+		}
+	}
+
+	snum = wc->state_cnt++;
+	*ptr = snum;
+	st = &wc->states[snum];
+	st->set_cnt = set_cnt;
+	st->set = (int *)malloc(sizeof(int) * (set_cnt ? set_cnt : 1));
+	st->next = (int *)malloc(sizeof(int) * wc->class_cnt);
+	assert(st->set && st->next);
+	memcpy(st->set,set,sizeof(int) * set_cnt);
+	for(i=0;i < wc->class_cnt;++i) st->next[i] = -1;
+
+	for(i=st->accept=0;i < set_cnt;++i)
+	{
+		if (wc->nodes[set[i]].accept)
+		{
+			st->accept = 1;
+			break;
+		}
+	}
+	wc->mem_used += sizeof(int) * (set_cnt + wc->class_cnt);
+	return snum;
+}
+
+
+
+
+int startState(struct st_wildcard *wc)
+{
+	int cnt = 0;
+	addPos(wc,0,&cnt);
+	return addState(wc,wc->scratch,cnt);
+}
+
+
+
+
+/*** Work out where the state goes on the character class ***/
+int buildNext(struct st_wildcard *wc, int snum, int cls)
+{
+	struct st_wc_node *n;
+	int *set;
+	int set_cnt;
+	int next;
+	int node;
+	int cnt;
+	int i;
+
+	/* If the cache is too big start again. Keep the current state's set
+	   as we're part way through a match. */
+	if (wc->mem_used > WC_MAX_MEMORY)
+	{
+		set_cnt = wc->states[snum].set_cnt;
+		set = (int *)malloc(sizeof(int) * (set_cnt ? set_cnt : 1));
+		assert(set);
+		memcpy(set,wc->states[snum].set,sizeof(int) * set_cnt);
+
+		flushStates(wc);
+		wc->start = startState(wc);
+		for(i=cnt=0;i < set_cnt;++i) addPos(wc,set[i],&cnt);
+		snum = addState(wc,wc->scratch,cnt);
+		free(set);
+	}
+
+	set = wc->states[snum].set;
+	set_cnt = wc->states[snum].set_cnt;
+	for(i=cnt=0;i < set_cnt;++i)
+	{
+		/* A '*' eats anything and stays where it is */
+		if (wc->nodes[set[i]].c == '*') addPos(wc,set[i],&cnt);
+
+		for(node=wc->nodes[set[i]].child;node != -1;node=n->sibling)
+		{
+			n = &wc->nodes[node];
+			if (n->c == '?' ||
+			    (cls && n->c != '*' && wc->cclass[(u_char)n->c] == cls))
+			{
+				addPos(wc,node,&cnt);
+			}
+		}
+	}
+	next = addState(wc,wc->scratch,cnt);
+
+	/* addState() may have moved the states array */
+	wc->states[snum].next[cls] = next;
+	return next;
+}
+
+
+
+
+void flushStates(struct st_wildcard *wc)
+{
+	int i;
+
+	for(i=0;i < wc->state_cnt;++i)
+	{
+		free(wc->states[i].set);
+		free(wc->states[i].next);
+	}
+	free(wc->states);
+	free(wc->table);
+
+	wc->state_cnt = 0;
+	wc->state_alloc = 64;
+	wc->states = (struct st_wc_state *)malloc(
+		sizeof(struct st_wc_state) * wc->state_alloc);
+	wc->table_size = wc->state_alloc * 2;
+	wc->table = (int *)malloc(sizeof(int) * wc->table_size);
+	assert(wc->states && wc->table);
+	for(i=0;i < wc->table_size;++i) wc->table[i] = -1;
+	wc->mem_used = 0;
+}
+
+
+
+
+/*** FNV-1a over the positions ***/
+uint32_t hashSet(int *set, int set_cnt)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for(i=0;i < set_cnt;++i)
+	{
+		h ^= (uint32_t)set[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
+
+
+int cmpInt(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
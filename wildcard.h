@@ -0,0 +1,41 @@
+/*****************************************************************************
+ Multi pattern wildcard matcher. Patterns may contain '*' and '?' and are
+ case insensitive. Shared by telnetd and the benchmarks.
+ *****************************************************************************/
+
+struct st_wc_node
+{
+	int child;
+	int sibling;
+	char c;
+	char accept;
+};
+
+struct st_wc_state
+{
+	int *set;
+	int set_cnt;
+	int accept;
+	int *next;
+};
+
+struct st_wildcard
+{
+	struct st_wc_node *nodes;
+	int node_cnt;
+	u_char cclass[256];
+	int class_cnt;
+	struct st_wc_state *states;
+	int state_cnt;
+	int state_alloc;
+	int *table;
+	int table_size;
+	size_t mem_used;
+	int *scratch;
+	u_char *mark;
+	int start;
+};
+
+struct st_wildcard *compileWildcards(char **pats, int pat_cnt);
+int  matchWildcards(struct st_wildcard *wc, char *str);
+void freeWildcards(struct st_wildcard *wc);